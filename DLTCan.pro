@@ -10,18 +10,57 @@ CONFIG += c++11
 
 SOURCES += \
     dltcan.cpp \
+    dltcanbackend.cpp \
+    dltcancapture.cpp \
+    dltcanclocksync.cpp \
+    dltcancontroller.cpp \
+    dltcandbc.cpp \
+    dltcandelta.cpp \
+    dltcandecoder.cpp \
+    dltcanfilewriter.cpp \
+    dltcanfilter.cpp \
+    dltcanlogreader.cpp \
+    dltcanlogwriter.cpp \
+    dltcanmerge.cpp \
+    dltcanrecorder.cpp \
+    dltcanreplay.cpp \
+    dltcanscheduler.cpp \
     dltminiserver.cpp \
     main.cpp \
     dialog.cpp \
     settingsdialog.cpp
 
 HEADERS += \
+    canframe.h \
     dialog.h \
     dltcan.h \
+    dltcanbackend.h \
+    dltcancapture.h \
+    dltcanclock.h \
+    dltcanclocksync.h \
+    dltcancontroller.h \
+    dltcandbc.h \
+    dltcandelta.h \
+    dltcandecoder.h \
+    dltcanfilewriter.h \
+    dltcanfilter.h \
+    dltcanlogreader.h \
+    dltcanlogwriter.h \
+    dltcanmerge.h \
+    dltcanrecorder.h \
+    dltcanreplay.h \
+    dltcanring.h \
+    dltcanscheduler.h \
     dltminiserver.h \
     settingsdialog.h \
     version.h
 
+# SocketCAN backend
+linux {
+    SOURCES += dltcansocketcan.cpp
+    HEADERS += dltcansocketcan.h
+}
+
 FORMS += \
     dialog.ui \
     settingsdialog.ui
@@ -20,20 +20,432 @@ RST -> RST
 */
 
 #include <WCan.h>
+#include <mcp_can.h>
 #include <WTimer.h>
 #include <WSerial.h>
 
-WCan can(CAN_500KBPS,MCP_16MHZ,D10,D2); // Wemos D1 R1 + Diymore CAN Bus Shield
+#define CAN_SPEED CAN_500KBPS
+#define CAN_CLOCK MCP_16MHZ
+#define CAN_CS D10
+#define CAN_INT D2
+WCan can(CAN_SPEED,CAN_CLOCK,CAN_CS,CAN_INT); // Wemos D1 R1 + Diymore CAN Bus Shield
+MCP_CAN mcp(CAN_CS); // same MCP2515, used for extended and remote frames and the acceptance filters
 WTimer timer;
 WSerial serial(WSerial::Binary);
 
 char msgString[256];
 unsigned char canMessage[256];                        
 
+// Maximum number of CAN messages in one batch, the result is sent as 16 bit mask
+#define BATCH_MAX 16
+
+// Cyclic messages uploaded by the host and sent by the firmware itself
+#define CYCLIC_MAX 8
+struct CyclicMessage
+{
+  unsigned long id;
+  unsigned char length;
+  unsigned char data[8];
+  unsigned short period; // ms, 0 if inactive
+  unsigned long next; // deadline of next transmission in ms
+  unsigned long sent;
+  unsigned long missed;
+};
+CyclicMessage cyclic[CYCLIC_MAX];
+int cyclicCount = 0;
+
+// Acceptance masks and filters of the MCP2515 programmed by the host, filters 0-1 use mask 0, filters 2-5 use mask 1
+#define FILTER_MASKS 2
+#define FILTER_FILTERS 6
+unsigned char filterFlags[FILTER_MASKS+FILTER_FILTERS];
+unsigned long filterValues[FILTER_MASKS+FILTER_FILTERS];
+
+// Link speed handshake, host confirms new baud rate or we fall back to default
+#define LINK_BAUD_RATE_DEFAULT 115200
+#define LINK_TIMEOUT 1000
+bool linkSwitching = false;
+unsigned long linkSwitchTime = 0;
+
+// Commands received from the host, kept until they are complete
+#define COMMAND_BUFFER 2048
+unsigned char commandBuffer[COMMAND_BUFFER];
+int commandLength = 0;
+
+void writeStuffed(unsigned char value)
+{
+  Serial.write(value);
+  if(value==0x7f)
+    Serial.write(0x7f); // add stuff byte to be able to detect unique header
+}
+
+void writeTimestamp(unsigned long timestamp)
+{
+  writeStuffed((timestamp>>24)&0xff); // Timestamp High Byte
+  writeStuffed((timestamp>>16)&0xff);
+  writeStuffed((timestamp>>8)&0xff);
+  writeStuffed(timestamp&0xff); // Timestamp Low Byte
+}
+
+void writeCounter(unsigned long counter)
+{
+  writeStuffed((counter>>24)&0xff); // Counter High Byte
+  writeStuffed((counter>>16)&0xff);
+  writeStuffed((counter>>8)&0xff);
+  writeStuffed(counter&0xff); // Counter Low Byte
+}
+
+bool canSend(unsigned long id,unsigned char *data,unsigned char length)
+{
+  // WCan only sends standard data frames, the host marks extended ids with bit 31 and remote frames with bit 30
+  bool extended = id&0x80000000;
+  bool remote = id&0x40000000;
+  if(remote)
+    return mcp.sendMsgBuf(id,length,data)==CAN_OK; // MCP_CAN decodes both flags from the id
+  if(extended)
+    return mcp.sendMsgBuf(id&0x1fffffff,1,length,data)==CAN_OK;
+  return can.send(id,data,length);
+}
+
+void cyclicEvent()
+{
+  for(int num=0;num<cyclicCount;num++)
+  {
+    CyclicMessage &message = cyclic[num];
+    if(message.period==0 || (long)(millis()-message.next)<0)
+      continue;
+
+    if(canSend(message.id,message.data,message.length)==true)
+    {
+      message.sent++;
+      Serial.write(0x7f); // Start of messages
+      Serial.write(0x07); // Cyclic message sent
+      Serial.write(0); // Length
+      writeStuffed(num); // Index
+      writeTimestamp(micros());
+    }
+    else
+    {
+      message.missed++;
+    }
+
+    // next deadline relative to the last one, so the period does not drift
+    message.next += message.period;
+    if((long)(millis()-message.next)>=0)
+    {
+      // too late for one or more periods, skip them
+      unsigned long late = (millis()-message.next)/message.period+1;
+      message.missed += late;
+      message.next += late*message.period;
+    }
+  }
+}
+
+bool filterProgram(int index,unsigned char flags,unsigned long value)
+{
+  // MCP_CAN expects standard ids in bit 16 to 26, the lower bits are compared with the first data bytes
+  bool extended = flags&0x01;
+  unsigned long data = extended ? value : (value<<16);
+  bool ok;
+  if(index<FILTER_MASKS)
+    ok = mcp.init_Mask(index,extended,data)==MCP2515_OK;
+  else
+    ok = mcp.init_Filt(index-FILTER_MASKS,extended,data)==MCP2515_OK;
+  if(ok)
+  {
+    filterFlags[index] = flags;
+    filterValues[index] = value;
+  }
+  return ok;
+}
+
+int readStuffed(unsigned char *data,int length,int pos,unsigned char *value,int count)
+{
+  // remove stuff bytes, returns the position after the values,
+  // -1 if not yet complete or -2 if the next command starts before all values were read
+  int num = 0;
+  while(num<count)
+  {
+    if(pos>=length)
+      return -1;
+    if(data[pos]==0x7f)
+    {
+      if(pos+1>=length)
+        return -1;
+      if(data[pos+1]!=0x7f)
+        return -2; // start of next command
+      pos++; // skip stuff byte
+    }
+    value[num++] = data[pos++];
+  }
+  return pos;
+}
+
+int skipCommand(int result)
+{
+  // wait for the rest of an incomplete command, skip the start of a truncated command
+  return result==-1 ? 0 : 2;
+}
+
+bool linkSupported(unsigned long baudRate)
+{
+  switch(baudRate)
+  {
+    case 115200:
+    case 230400:
+    case 460800:
+    case 921600:
+    case 1000000:
+    case 2000000:
+      return true;
+  }
+  return false;
+}
+
+int commandMessage(unsigned char *data,int length)
+{
+  // Standard CAN message: length 2BytesId payload, not stuffed
+  if(length<3)
+    return 0;
+  int msgLength = data[2];
+  if(length<5+msgLength)
+    return 0; // no full message yet received
+  unsigned short id = ((unsigned short)data[3]<<8)|data[4];
+  memcpy(canMessage,data+5,msgLength);
+  if(can.send(id,canMessage,msgLength)==true)
+  { 
+    Serial.write(0x7f); // Start of messages
+    Serial.write(0x01); // Send OK
+  }
+  else
+  {
+    Serial.write(0x7f); // Start of messages
+    Serial.write(0xfe); // Error Send
+  }
+  return 5+msgLength;
+}
+
+int commandBatch(unsigned char *data,int length)
+{
+  // Batch of CAN messages: count, then flags length 4BytesId payload for each message, all stuffed
+  unsigned char count;
+  unsigned char header[6];
+  int start = readStuffed(data,length,2,&count,1);
+  if(start<0)
+    return skipCommand(start);
+  int end = start;
+  for(int num=0;num<count;num++)
+  {
+    end = readStuffed(data,length,end,header,6);
+    if(end>=0)
+      end = readStuffed(data,length,end,canMessage,header[1]);
+    if(end<0)
+      return skipCommand(end); // no full batch yet received
+  }
+  unsigned short result = 0;
+  int pos = start;
+  for(int num=0;num<count;num++)
+  {
+    pos = readStuffed(data,length,pos,header,6);
+    pos = readStuffed(data,length,pos,canMessage,header[1]);
+    unsigned char flags = header[0];
+    int msgLength = header[1];
+    unsigned long id = ((unsigned long)header[2]<<24)|((unsigned long)header[3]<<16)|((unsigned long)header[4]<<8)|header[5];
+    if(flags&0x01)
+      id |= 0x80000000; // Extended Id
+    if(flags&0x02)
+      id |= 0x40000000; // Remote request
+    if(num<BATCH_MAX && msgLength<=8)
+    {
+      if(canSend(id,canMessage,msgLength)==true)
+        result |= (1<<num);
+    }
+  }
+  Serial.write(0x7f); // Start of messages
+  Serial.write(0x05); // Send batch result
+  Serial.write(3); // Length
+  Serial.write(count); // Number of messages
+  Serial.write(result&0xff); // Bit mask of sent messages Low Byte
+  if((result&0xff)==0x7f)
+    Serial.write(0x7f); // add stuff byte to be able to detect unique header
+  Serial.write((result>>8)&0xff); // Bit mask of sent messages High Byte
+  if(((result>>8)&0xff)==0x7f)
+    Serial.write(0x7f); // add stuff byte to be able to detect unique header
+  return end;
+}
+
+int commandCyclicTable(unsigned char *data,int length)
+{
+  // Cyclic table: count, then flags length 4BytesId 2BytesPeriod 2BytesPhase payload for each message, all stuffed
+  unsigned char count;
+  unsigned char header[10];
+  int start = readStuffed(data,length,2,&count,1);
+  if(start<0)
+    return skipCommand(start);
+  int end = start;
+  for(int num=0;num<count;num++)
+  {
+    end = readStuffed(data,length,end,header,10);
+    if(end>=0)
+      end = readStuffed(data,length,end,canMessage,header[1]);
+    if(end<0)
+      return skipCommand(end); // no full table yet received
+  }
+  unsigned long now = millis();
+  cyclicCount = 0;
+  int pos = start;
+  for(int num=0;num<count;num++)
+  {
+    pos = readStuffed(data,length,pos,header,10);
+    pos = readStuffed(data,length,pos,canMessage,header[1]);
+    unsigned char flags = header[0];
+    int msgLength = header[1];
+    if(num<CYCLIC_MAX && msgLength<=8)
+    {
+      CyclicMessage &message = cyclic[cyclicCount++];
+      message.id = ((unsigned long)header[2]<<24)|((unsigned long)header[3]<<16)|((unsigned long)header[4]<<8)|header[5];
+      if(flags&0x01)
+        message.id |= 0x80000000; // Extended Id
+      message.period = ((unsigned short)header[6]<<8)|header[7];
+      message.next = now+(((unsigned short)header[8]<<8)|header[9])+message.period;
+      message.length = msgLength;
+      memcpy(message.data,canMessage,msgLength);
+      message.sent = 0;
+      message.missed = 0;
+    }
+  }
+  return end;
+}
+
+int commandFilter(unsigned char *data,int length)
+{
+  // Acceptance configuration: flags 4BytesValue for each mask, then for each filter, all stuffed
+  unsigned char values[(FILTER_MASKS+FILTER_FILTERS)*5];
+  int end = readStuffed(data,length,2,values,sizeof(values));
+  if(end<0)
+    return skipCommand(end);
+  bool ok = true;
+  for(int num=0;num<FILTER_MASKS+FILTER_FILTERS;num++)
+  {
+    int pos = num*5;
+    unsigned long value = ((unsigned long)values[pos+1]<<24)|((unsigned long)values[pos+2]<<16)|((unsigned long)values[pos+3]<<8)|values[pos+4];
+    if(!filterProgram(num,values[pos],value))
+      ok = false;
+  }
+  if(!ok)
+  {
+    Serial.write(0x7f); // Start of messages
+    Serial.write(0xfc); // Error Filter
+  }
+  // report the programmed configuration
+  for(int num=0;num<FILTER_MASKS+FILTER_FILTERS;num++)
+  {
+    Serial.write(0x7f); // Start of messages
+    Serial.write(0x0a); // Acceptance mask or filter
+    Serial.write(5); // Length
+    writeStuffed(num); // Index
+    writeStuffed(filterFlags[num]); // Flags
+    writeCounter(filterValues[num]); // Value
+  }
+  return end;
+}
+
+int commandLink(unsigned char *data,int length)
+{
+  // Link speed request, baud rate big endian and stuffed
+  unsigned char value[4];
+  int end = readStuffed(data,length,2,value,4);
+  if(end<0)
+    return skipCommand(end);
+  unsigned long baudRate = ((unsigned long)value[0]<<24)|((unsigned long)value[1]<<16)|((unsigned long)value[2]<<8)|value[3];
+  if(linkSupported(baudRate))
+  {
+    Serial.write(0x7f); // Start of messages
+    Serial.write(0x03); // Link speed acknowledge
+    Serial.write(4); // Length
+    writeCounter(baudRate); // Baud rate
+    Serial.flush(); // acknowledge is sent with old baud rate
+    Serial.begin(baudRate);
+    linkSwitching = true;
+    linkSwitchTime = millis();
+    return length; // data received around the switch is not valid
+  }
+  Serial.write(0x7f); // Start of messages
+  Serial.write(0xfd); // Error Link speed
+  return end;
+}
+
+int handleCommand(unsigned char *data,int length)
+{
+  // handle the command at the start of data, returns the number of used bytes or 0 if it is not yet complete
+  if(data[0]!=0x7f)
+    return 1; // no command, wait for next start byte
+  if(length<2)
+    return 0;
+  switch(data[1])
+  {
+    case 0x7f:
+      return 2; // stuffed data byte outside of a command
+    case 0x80:
+      return commandMessage(data,length);
+    case 0x82:
+      return commandBatch(data,length);
+    case 0x84:
+      return commandCyclicTable(data,length);
+    case 0x86:
+      return commandFilter(data,length);
+    case 0x90:
+      return commandLink(data,length);
+    case 0x91:
+      // Link speed confirmed by host with new baud rate
+      if(linkSwitching)
+      {
+        linkSwitching = false;
+        Serial.write(0x7f); // Start of messages
+        Serial.write(0x04); // Link speed OK
+      }
+      return 2;
+    case 0x92:
+      // Capabilities request
+      Serial.write(0x7f); // Start of messages
+      Serial.write(0x09); // Capabilities
+      Serial.write(1); // Length
+      Serial.write(CYCLIC_MAX); // Size of cyclic table
+      return 2;
+  }
+  return 2; // unknown command
+}
+
+void commandEvent(unsigned char *data,int length)
+{
+  // the host sends further commands without waiting for the answer,
+  // so only the handled commands are removed and an incomplete rest is kept
+  if(commandLength+length>COMMAND_BUFFER)
+    commandLength = 0; // overflow, drop the incomplete command
+  if(length>COMMAND_BUFFER)
+    return;
+  memcpy(commandBuffer+commandLength,data,length);
+  commandLength += length;
+
+  int pos = 0;
+  while(pos<commandLength)
+  {
+    int used = handleCommand(commandBuffer+pos,commandLength-pos);
+    if(used==0)
+      break; // wait for the rest of the command
+    pos += used;
+  }
+  if(pos>commandLength)
+    pos = commandLength;
+  memmove(commandBuffer,commandBuffer+pos,commandLength-pos);
+  commandLength -= pos;
+}
+
 void setup() {
   serial.setup();
   
-  if(can.setup()==true)
+  // WCan starts the MCP2515 in MCP_ANY mode, which ignores masks and filters,
+  // restart it with masks and filters enabled, all frames pass until the host programs them
+  if(can.setup()==true && mcp.begin(MCP_STDEXT,CAN_SPEED,CAN_CLOCK)==CAN_OK && mcp.setMode(MCP_NORMAL)==MCP2515_OK)
   {
     Serial.write(0x7f); // Start of messages
     Serial.write(0x00); // Init OK
@@ -52,17 +464,20 @@ void loop()
   switch(can.event())
   {
     case WCan::Received:
-           
+      // time of reception in us, used by the host to correct the USB and serial latency
+      unsigned long timestamp = micros();
+
       if((can.getId() & 0x80000000) == 0x80000000)     // Determine if ID is standard (11 bits) or extended (29 bits)
       {
         ;//sprintf(msgString, "Extended ID: 0x%.8lX  DLC: %1d  Data:", (can.getId() & 0x1FFFFFFF), can.getLength());
         Serial.write(0x7f); // Start of messages
-        Serial.write(0x81); // Extended Msg
+        Serial.write(0x84); // Extended Msg with timestamp
         Serial.write(can.getLength()); // Msg
-        Serial.write((can.getId()>>24)&0xff); // Id High Byte
-        Serial.write((can.getId()>>16)&0xff); // Id High Byte
-        Serial.write((can.getId()>>8)&0xff); // Id High Byte
-        Serial.write(can.getId()&0xff); // Id Low Byte
+        writeStuffed((can.getId()>>24)&0xff); // Id High Byte
+        writeStuffed((can.getId()>>16)&0xff); // Id High Byte
+        writeStuffed((can.getId()>>8)&0xff); // Id High Byte
+        writeStuffed(can.getId()&0xff); // Id Low Byte
+        writeTimestamp(timestamp);
         for(int num=0;num<can.getLength();num++)
         {
             Serial.write(can.getData()[num]); // Msg          
@@ -73,10 +488,11 @@ void loop()
       else
       {
         Serial.write(0x7f); // Start of messages
-        Serial.write(0x80); // Msg
+        Serial.write(0x83); // Msg with timestamp
         Serial.write(can.getLength()); // Msg
-        Serial.write((can.getId()>>8)&0xff); // Id High Byte
-        Serial.write(can.getId()&0xff); // Id Low Byte
+        writeStuffed((can.getId()>>8)&0xff); // Id High Byte
+        writeStuffed(can.getId()&0xff); // Id Low Byte
+        writeTimestamp(timestamp);
         for(int num=0;num<can.getLength();num++)
         {
           Serial.write(can.getData()[num]); // Msg          
@@ -106,78 +522,37 @@ void loop()
     case WSerial::Data:
       int length;
       unsigned char *data = serial.getData(length);
-      if(length>=1)
-      {
-        if(data[0]==0x7f)
-        {
-          if(length>=2)
-          {
-            if(data[1]==0x80)
-            {
-              if(length>=3)
-              {
-                int msgLength = data[2];
-                if(length>=(5+msgLength))
-                {
-                  unsigned short id = ((unsigned short)data[3]<<8)|data[4];
-                  int pos=0;
-                  bool stuffFound=false;
-                  for(int num=5;num<length;num++)
-                  {
- /*                   if(data[num]==0x7f)
-                    {
-                      if(stuffFound)
-                      {
-                        stuffFound=false;
-                        canMessage[pos++]=data[num];                      
-                      }
-                      else
-                      {
-                        stuffFound=true;
-                      }
-                    }
-                    else*/
-                    {
-                      canMessage[pos++]=data[num];
-                    }
-                    if(pos>=msgLength)
-                      break; // full message found
-                  }
-                  if(pos<msgLength)
-                    break; // no full message yet found
-                  if(can.send(id,canMessage,msgLength)==true)
-                  { 
-                    Serial.write(0x7f); // Start of messages
-                    Serial.write(0x01); // Send OK
-                  }
-                  else
-                  {
-                    Serial.write(0x7f); // Start of messages
-                    Serial.write(0xfe); // Error Send
-                  }
-                  serial.clearData();                        
-                }
-              }
-            }
-            else
-            {
-              serial.clearData();          
-            }
-          }
-        }
-        else
-        {
-          serial.clearData();          
-        }
-      }
+      commandEvent(data,length);
+      serial.clearData();
       break;
   }
   
+  if(linkSwitching && (millis()-linkSwitchTime)>LINK_TIMEOUT)
+  {
+    // no confirmation from host, fall back to default baud rate
+    linkSwitching = false;
+    commandLength = 0;
+    Serial.flush();
+    Serial.begin(LINK_BAUD_RATE_DEFAULT);
+  }
+
+  cyclicEvent();
+
   switch(timer.event())
   {
     case WTimer::Expired:
       Serial.write(0x7f); // Start of messages
-      Serial.write(0x02); // Watchdog
+      Serial.write(0x06); // Watchdog with timestamp
+      writeTimestamp(micros());
+      for(int num=0;num<cyclicCount;num++)
+      {
+        Serial.write(0x7f); // Start of messages
+        Serial.write(0x08); // Cyclic message counters
+        Serial.write(8); // Length
+        writeStuffed(num); // Index
+        writeCounter(cyclic[num].sent);
+        writeCounter(cyclic[num].missed);
+      }
       timer.start(1000);
       break;      
   }
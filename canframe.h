@@ -0,0 +1,58 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file canframe.h
+ * @licence end@
+ */
+
+#ifndef CAN_FRAME_H
+#define CAN_FRAME_H
+
+#include <QtGlobal>
+
+// maximum payload length of a CAN FD frame
+#define CAN_FRAME_MAX_DATA 64
+
+// maximum payload length of a classic CAN frame
+#define CAN_FRAME_MAX_DATA_CLASSIC 8
+
+// mask of the 29 bit CAN id
+#define CAN_FRAME_ID_MASK 0x1fffffff
+
+// maximum number of CAN channels captured at once
+#define DLT_CAN_CHANNELS_MAX 8
+
+// flags of a CAN frame
+#define CAN_FRAME_FLAG_EXTENDED 0x01    // 29 bit id
+#define CAN_FRAME_FLAG_RTR 0x02         // remote transmission request
+#define CAN_FRAME_FLAG_FD 0x04          // CAN FD frame
+#define CAN_FRAME_FLAG_TX 0x08          // direction, set if sent by DLTCan
+
+/**
+ * Compact binary CAN frame as passed between capture, DLT output and UI.
+ *
+ * Trivially copyable, so it can be stored in rings and arrays without
+ * any allocation.
+ */
+struct CanFrame
+{
+    quint64 timestamp;      // nanoseconds, monotonic clock
+    quint32 id;             // CAN id, 11 or 29 bit
+    quint8 flags;           // CAN_FRAME_FLAG_*
+    quint8 dlc;             // payload length in bytes
+    quint8 channel;         // index of the capture channel, 0 is the first
+    quint8 reserved;
+    quint8 data[CAN_FRAME_MAX_DATA];
+
+    bool isExtended() const { return flags & CAN_FRAME_FLAG_EXTENDED; }
+    bool isTx() const { return flags & CAN_FRAME_FLAG_TX; }
+};
+
+#endif // CAN_FRAME_H
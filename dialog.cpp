@@ -21,17 +21,18 @@
 #include "ui_dialog.h"
 #include "settingsdialog.h"
 #include "version.h"
+#include "dltcanclock.h"
 
 Dialog::Dialog(bool autostart,QString configuration,QWidget *parent)
     : QDialog(parent)
     , ui(new Ui::Dialog)
-    , dltCan(this)
+    , dltCan(controller.getDltCan())
+    , dltMiniServer(controller.getDltMiniServer())
 {
     ui->setupUi(this);
 
     // clear settings
     on_pushButtonDefaultSettings_clicked();
-    dltMiniServer.setContextId("CAN");
 
     // set window title with version information
     setWindowTitle(QString("DLTCan %1").arg(DLT_CAN_VERSION));
@@ -40,11 +41,19 @@ Dialog::Dialog(bool autostart,QString configuration,QWidget *parent)
     // disable stop button at startup
     ui->pushButtonStop->setDisabled(true);
 
+    // refresh counters and status with 10 Hz
+    refreshTimestamp = 0;
+    refreshMsgCounter = 0;
+    refreshByteCounter = 0;
+    statusCanChanged = false;
+    timerRefresh.setInterval(100);
+    connect(&timerRefresh, SIGNAL(timeout()), this, SLOT(refresh()));
+
     // connect status slots
     connect(&dltCan, SIGNAL(status(QString)), this, SLOT(statusCan(QString)));
     connect(&dltMiniServer, SIGNAL(status(QString)), this, SLOT(statusDlt(QString)));
 
-    connect(&dltMiniServer, SIGNAL(injection(QString)), this, SLOT(injection(QString)));
+    connect(&controller, SIGNAL(settingsChanged()), this, SLOT(restoreSettings()));
 
     //  load global settings from registry
     QSettings settings;
@@ -55,16 +64,14 @@ Dialog::Dialog(bool autostart,QString configuration,QWidget *parent)
     // autoload settings, when activated in global settings
     if(autoload)
     {
-        dltCan.readSettings(filename);
-        dltMiniServer.readSettings(filename);
+        controller.readSettings(filename);
         restoreSettings();
     }
 
     // autoload settings, when provided by command line
     if(!configuration.isEmpty())
     {
-        dltCan.readSettings(configuration);
-        dltMiniServer.readSettings(configuration);
+        controller.readSettings(configuration);
         restoreSettings();
     }
 
@@ -82,7 +89,9 @@ Dialog::~Dialog()
     disconnect(&dltCan, SIGNAL(status(QString)), this, SLOT(statusCan(QString)));
     disconnect(&dltMiniServer, SIGNAL(status(QString)), this, SLOT(statusDlt(QString)));
 
-    disconnect(&dltMiniServer, SIGNAL(injection(QString)), this, SLOT(injection(QString)));
+    disconnect(&controller, SIGNAL(settingsChanged()), this, SLOT(restoreSettings()));
+
+    disconnect(&timerRefresh, SIGNAL(timeout()), this, SLOT(refresh()));
 
     delete ui;
 }
@@ -91,28 +100,30 @@ void Dialog::restoreSettings()
 {
     ui->lineEditMsgId->setText(QString("%1").arg(dltCan.getMessageId(),0,16));
     ui->lineEditMsgData->setText(dltCan.getMessageData().toHex());
-    ui->lineEditTime1->setText(QString("%1").arg(dltCan.getCyclicMessageTimeout1()));
-    ui->lineEditMsgId1->setText(QString("%1").arg(dltCan.getCyclicMessageId1(),0,16));
-    ui->lineEditMsgData1->setText(dltCan.getCyclicMessageData1().toHex());
-    ui->lineEditTime2->setText(QString("%1").arg(dltCan.getCyclicMessageTimeout2()));
-    ui->lineEditMsgId2->setText(QString("%1").arg(dltCan.getCyclicMessageId2(),0,16));
-    ui->lineEditMsgData2->setText(dltCan.getCyclicMessageData2().toHex());
-    ui->checkBoxActive1->setChecked(dltCan.getCyclicMessageActive1());
-    ui->checkBoxActive2->setChecked(dltCan.getCyclicMessageActive2());
+
+    // the dialog shows the first two cyclic messages
+    DLTCanCyclicMessage cyclicMessage1 = dltCan.getScheduler().getMessage(0);
+    DLTCanCyclicMessage cyclicMessage2 = dltCan.getScheduler().getMessage(1);
+    ui->lineEditTime1->setText(QString("%1").arg(cyclicMessage1.period));
+    ui->lineEditMsgId1->setText(QString("%1").arg(cyclicMessage1.id,0,16));
+    ui->lineEditMsgData1->setText(cyclicMessage1.data.toHex());
+    ui->lineEditTime2->setText(QString("%1").arg(cyclicMessage2.period));
+    ui->lineEditMsgId2->setText(QString("%1").arg(cyclicMessage2.id,0,16));
+    ui->lineEditMsgData2->setText(cyclicMessage2.data.toHex());
+    ui->checkBoxActive1->setChecked(cyclicMessage1.active);
+    ui->checkBoxActive2->setChecked(cyclicMessage2.active);
 }
 
 void Dialog::updateSettings()
 {
     dltCan.setMessageId(ui->lineEditMsgId->text().toUShort(nullptr,16));
     dltCan.setMessageData(QByteArray::fromHex(ui->lineEditMsgData->text().toLatin1()));
-    dltCan.setCyclicMessageActive1(ui->checkBoxActive1->isChecked());
-    dltCan.setCyclicMessageTimeout1(ui->lineEditTime1->text().toInt());
-    dltCan.setCyclicMessageId1(ui->lineEditMsgId1->text().toUShort(nullptr,16));
-    dltCan.setCyclicMessageData1(QByteArray::fromHex(ui->lineEditMsgData1->text().toLatin1()));
-    dltCan.setCyclicMessageActive2(ui->checkBoxActive2->isChecked());
-    dltCan.setCyclicMessageTimeout2(ui->lineEditTime2->text().toInt());
-    dltCan.setCyclicMessageId2(ui->lineEditMsgId2->text().toUShort(nullptr,16));
-    dltCan.setCyclicMessageData2(QByteArray::fromHex(ui->lineEditMsgData2->text().toLatin1()));
+    dltCan.setCyclicMessage(0,ui->lineEditMsgId1->text().toUInt(nullptr,16),QByteArray::fromHex(ui->lineEditMsgData1->text().toLatin1()));
+    dltCan.getScheduler().setPeriod(0,ui->lineEditTime1->text().toInt());
+    dltCan.getScheduler().setActive(0,ui->checkBoxActive1->isChecked());
+    dltCan.setCyclicMessage(1,ui->lineEditMsgId2->text().toUInt(nullptr,16),QByteArray::fromHex(ui->lineEditMsgData2->text().toLatin1()));
+    dltCan.getScheduler().setPeriod(1,ui->lineEditTime2->text().toInt());
+    dltCan.getScheduler().setActive(1,ui->checkBoxActive2->isChecked());
 }
 
 void Dialog::on_pushButtonStart_clicked()
@@ -120,9 +131,8 @@ void Dialog::on_pushButtonStart_clicked()
     // start communication
     updateSettings();
 
-    // start Relais and DLT communication
-    dltCan.start();
-    dltMiniServer.start();
+    // start CAN and DLT communication
+    controller.start();
 
     // disable settings and start button
     // enable stop button
@@ -132,21 +142,28 @@ void Dialog::on_pushButtonStart_clicked()
     ui->pushButtonLoadSettings->setDisabled(true);
     ui->pushButtonSettings->setDisabled(true);
 
-    connect(&dltCan, SIGNAL(message(unsigned int,QString,QByteArray)), this, SLOT(message(unsigned int,QString,QByteArray)));
-
-    msgCounter = 0;
-    ui->lineEditMsgCount->setText(QString("%1").arg(msgCounter));
+    // start refresh of counters
+    refreshTimestamp = DLTCanClock::now();
+    refreshMsgCounter = controller.getMsgCounter();
+    refreshByteCounter = dltCan.getByteCounter();
+    ui->lineEditMsgRate->setText("0");
+    ui->lineEditByteRate->setText("0");
+    timerRefresh.start();
+    refresh();
 }
 
 void Dialog::on_pushButtonStop_clicked()
 {
     // stop communication
 
-    disconnect(&dltCan, SIGNAL(message(unsigned int,QString,QByteArray)), this, SLOT(message(unsigned int,QString,QByteArray)));
+    // stop CAN and DLT communication
+    controller.stop();
 
-    // stop Relais and DLT communication
-    dltCan.stop();
-    dltMiniServer.stop();
+    // show final counters and status
+    timerRefresh.stop();
+    refresh();
+    ui->lineEditMsgRate->setText("0");
+    ui->lineEditByteRate->setText("0");
 
     // enable settings and start button
     // disable stop button
@@ -161,6 +178,20 @@ void Dialog::statusCan(QString text)
 {
     // status from Relais
 
+    // status is reported with every sent message,
+    // so it is only stored here and shown by refresh
+    if(text != statusCanText)
+    {
+        statusCanText = text;
+        statusCanChanged = true;
+    }
+
+    if(!timerRefresh.isActive())
+        refresh();
+}
+
+void Dialog::updateStatusCan(QString text)
+{
     // status of CAN communication changed
     if(text == "" || text == "stopped" || text == "not active")
     {
@@ -190,8 +221,6 @@ void Dialog::statusCan(QString text)
         ui->lineEditStatusCan->setPalette(palette);
         ui->lineEditStatusCan->setText(text);
     }
-    if(text!="send ok" && text!="started")
-        dltMiniServer.sendValue(text);
 }
 
 void Dialog::statusDlt(QString text)
@@ -229,8 +258,7 @@ void Dialog::statusDlt(QString text)
 void Dialog::on_pushButtonDefaultSettings_clicked()
 {
     // Reset settings to default
-    dltCan.clearSettings();
-    dltMiniServer.clearSettings();
+    controller.clearSettings();
 
     restoreSettings();
 }
@@ -249,8 +277,7 @@ void Dialog::on_pushButtonLoadSettings_clicked()
     }
 
     // read the settings from XML file
-    dltCan.readSettings(fileName);
-    dltMiniServer.readSettings(fileName);
+    controller.readSettings(fileName);
 
     restoreSettings();
 }
@@ -270,31 +297,8 @@ void Dialog::on_pushButtonSaveSettings_clicked()
         return;
     }
 
-    // read the settings from XML file
-    QFile file(fileName);
-    if (!file.open(QFile::WriteOnly | QFile::Text))
-    {
-        // Cannot open the file for writing
-        return;
-    }
-
-    QXmlStreamWriter xml(&file);
-    xml.setAutoFormatting(true);
-
-    // FIXME: Cannot read data from XML file, which contains a start document
-    // So currently do not call StartDocument
-    //xml.writeStartDocument();
-
-    xml.writeStartElement("DLTCanSettings");
-        dltCan.writeSettings(xml);
-        dltMiniServer.writeSettings(xml);
-    xml.writeEndElement(); // DLTRelaisSettings
-
-    // FIXME: Cannot read data from XML file, which contains a end document
-    // So currently do not call EndDocument
-    //xml.writeEndDocument();
-    file.close();
-
+    // write the settings into XML file
+    controller.saveSettings(fileName);
 }
 
 void Dialog::on_pushButtonSettings_clicked()
@@ -336,14 +340,33 @@ void Dialog::on_pushButtonInfo_clicked()
     msgBox.exec();
 }
 
-void  Dialog::message(unsigned int id,QString direction,QByteArray data)
+void Dialog::refresh()
 {
-    dltMiniServer.sendValue3(direction,QString("%1").arg(id, 3, 16, QLatin1Char( '0' )),data.toHex());
+    if(statusCanChanged)
+    {
+        statusCanChanged = false;
+        updateStatusCan(statusCanText);
+    }
 
-    if(direction=="Rx")
-        msgCounter++;
+    unsigned int msgCounter = controller.getMsgCounter();
+    quint64 byteCounter = dltCan.getByteCounter();
 
     ui->lineEditMsgCount->setText(QString("%1").arg(msgCounter));
+    ui->lineEditDropped->setText(QString("%1").arg(dltCan.getOverflowCounter()+dltMiniServer.getDroppedMessages()+controller.getDltCanRecorder().getDroppedMessages()
+                                     +controller.getCandumpWriter().getDroppedFrames()+controller.getAscWriter().getDroppedFrames()));
+
+    // rates are calculated over one second to keep the values readable
+    quint64 timestamp = DLTCanClock::now();
+    quint64 elapsed = timestamp - refreshTimestamp;
+    if(timerRefresh.isActive() && elapsed >= 1000000000ULL)
+    {
+        ui->lineEditMsgRate->setText(QString("%1").arg((quint64)(msgCounter-refreshMsgCounter)*1000000000ULL/elapsed));
+        ui->lineEditByteRate->setText(QString("%1").arg((byteCounter-refreshByteCounter)*1000000000ULL/elapsed));
+
+        refreshTimestamp = timestamp;
+        refreshMsgCounter = msgCounter;
+        refreshByteCounter = byteCounter;
+    }
 }
 
 void Dialog::on_pushButtonSend_clicked()
@@ -357,12 +380,12 @@ void Dialog::on_checkBoxActive1_stateChanged(int arg1)
 {
     if(arg1)
     {
-        dltCan.setCyclicMessage1(ui->lineEditMsgId1->text().toUShort(nullptr,16),QByteArray::fromHex(ui->lineEditMsgData1->text().toLatin1()));
-        dltCan.startCyclicMessage1(ui->lineEditTime1->text().toInt());
+        dltCan.setCyclicMessage(0,ui->lineEditMsgId1->text().toUInt(nullptr,16),QByteArray::fromHex(ui->lineEditMsgData1->text().toLatin1()));
+        dltCan.startCyclicMessage(0,ui->lineEditTime1->text().toInt());
     }
     else
-    {dltCan.stopCyclicMessage1();
-
+    {
+        dltCan.stopCyclicMessage(0);
     }
 }
 
@@ -370,65 +393,12 @@ void Dialog::on_checkBoxActive2_stateChanged(int arg1)
 {
     if(arg1)
     {
-        dltCan.setCyclicMessage2(ui->lineEditMsgId2->text().toUShort(nullptr,16),QByteArray::fromHex(ui->lineEditMsgData2->text().toLatin1()));
-        dltCan.startCyclicMessage2(ui->lineEditTime2->text().toInt());
+        dltCan.setCyclicMessage(1,ui->lineEditMsgId2->text().toUInt(nullptr,16),QByteArray::fromHex(ui->lineEditMsgData2->text().toLatin1()));
+        dltCan.startCyclicMessage(1,ui->lineEditTime2->text().toInt());
     }
     else
     {
-        dltCan.stopCyclicMessage2();
-    }
-
-}
-
-void Dialog::injection(QString text)
-{
-    QStringList list = text.split(' ');
-
-    qDebug() << "Injection received: " << text;
-
-    if(list[0] == "CAN")
-    {
-        unsigned short id = list[1].toUShort(nullptr,16);
-        QByteArray data = QByteArray::fromHex(list[2].toLatin1());
-        dltCan.sendMessage(id,(unsigned char*)data.data(),data.length());
-    }
-    else if(list[0] == "CANCYC1")
-    {
-        if(list[1]=="off")
-        {
-            ui->checkBoxActive1->setChecked(false);
-            on_checkBoxActive1_stateChanged(false);
-        }
-        else
-        {
-            unsigned short time = list[1].toUShort();
-            unsigned short id = list[2].toUShort(nullptr,16);
-            QByteArray data = QByteArray::fromHex(list[3].toLatin1());
-
-            dltCan.setCyclicMessage1(id,data);
-            dltCan.startCyclicMessage1(time);
-
-            restoreSettings();
-        }
-    }
-    else if(list[0] == "CANCYC2")
-    {
-        if(list[1]=="off")
-        {
-            ui->checkBoxActive2->setChecked(false);
-            on_checkBoxActive2_stateChanged(false);
-        }
-        else
-        {
-            unsigned short time = list[1].toUShort();
-            unsigned short id = list[2].toUShort(nullptr,16);
-            QByteArray data = QByteArray::fromHex(list[3].toLatin1());
-
-            dltCan.setCyclicMessage2(id,data);
-            dltCan.startCyclicMessage2(time);
-
-            restoreSettings();
-        }
+        dltCan.stopCyclicMessage(1);
     }
 
 }
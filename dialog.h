@@ -20,9 +20,9 @@
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QSettings>
+#include <QTimer>
 
-#include "dltcan.h"
-#include "dltminiserver.h"
+#include "dltcancontroller.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class Dialog; }
@@ -38,12 +38,13 @@ public:
 
 private slots:
 
+    // Settings were changed outside of the dialog
+    void restoreSettings();
+
     // Status of Relais and DLT connection
     void statusCan(QString text);
     void statusDlt(QString text);
 
-    void injection(QString text);
-
     // Settings and Info
     void on_pushButtonSettings_clicked();
     void on_pushButtonDefaultSettings_clicked();
@@ -55,7 +56,8 @@ private slots:
     void on_pushButtonStart_clicked();
     void on_pushButtonStop_clicked();
 
-    void message(unsigned int id,QString direction,QByteArray data);
+    // Refresh counters and status, called by timer
+    void refresh();
 
     void on_pushButtonSend_clicked();
 
@@ -66,14 +68,21 @@ private slots:
 private:
     Ui::Dialog *ui;
 
-    DLTCan dltCan;
-    DLTMiniServer dltMiniServer;
+    DLTCanController controller;
+    DLTCan &dltCan;
+    DLTMiniServer &dltMiniServer;
+
+    // Counters and status are refreshed with a fixed rate
+    QTimer timerRefresh;
+    quint64 refreshTimestamp;
+    unsigned int refreshMsgCounter;
+    quint64 refreshByteCounter;
+    QString statusCanText;
+    bool statusCanChanged;
 
     // Settings
-    void restoreSettings();
     void updateSettings();
-
-    int msgCounter;
+    void updateStatusCan(QString text);
 
 };
 #endif // DIALOG_H
@@ -13,6 +13,7 @@
  */
 
 #include "dltcan.h"
+#include "dltcanclock.h"
 
 #include <QDebug>
 #include <QFile>
@@ -20,12 +21,62 @@
 
 DLTCan::DLTCan(QObject *parent) : QObject(parent)
 {
+    channel = 0;
+    elementName = "DLTCan";
+
     clearSettings();
+
+    backend = &capture;
+
+    // backends run in their own thread, only the selected one is opened
+    thread.setObjectName("DLTCanCapture");
+    capture.moveToThread(&thread);
+
+    connect(&capture, SIGNAL(status(QString)), this, SIGNAL(status(QString)));
+    connect(&capture, SIGNAL(framesAvailable()), this, SLOT(framesAvailable()));
+
+#ifdef Q_OS_LINUX
+    socketCan.moveToThread(&thread);
+
+    connect(&socketCan, SIGNAL(status(QString)), this, SIGNAL(status(QString)));
+    connect(&socketCan, SIGNAL(framesAvailable()), this, SLOT(framesAvailable()));
+#endif
+
+    // scheduler runs in its own thread and sends directly in the backend thread,
+    // the cyclic table is only supported by the adapter
+    connect(&scheduler, SIGNAL(write(QByteArray)), &capture, SLOT(write(QByteArray)));
+    connect(&scheduler, SIGNAL(framesAvailable()), this, SLOT(cyclicFramesAvailable()));
+
+    // replay has its own timing thread like the scheduler
+    connect(&replay, SIGNAL(status(QString)), this, SIGNAL(status(QString)));
+    connect(&replay, SIGNAL(framesAvailable()), this, SLOT(replayFramesAvailable()));
+
+    // messages sent by the cyclic table of the adapter are reported to the scheduler
+    capture.setScheduler(&scheduler);
 }
 
 DLTCan::~DLTCan()
 {
     stop();
+
+    disconnect(&capture, SIGNAL(status(QString)), this, SIGNAL(status(QString)));
+    disconnect(&capture, SIGNAL(framesAvailable()), this, SLOT(framesAvailable()));
+
+#ifdef Q_OS_LINUX
+    disconnect(&socketCan, SIGNAL(status(QString)), this, SIGNAL(status(QString)));
+    disconnect(&socketCan, SIGNAL(framesAvailable()), this, SLOT(framesAvailable()));
+#endif
+
+    disconnect(&scheduler, SIGNAL(write(QByteArray)), &capture, SLOT(write(QByteArray)));
+    disconnect(&scheduler, SIGNAL(sendFrames(QByteArray)), backend, SLOT(sendFrames(QByteArray)));
+    disconnect(&scheduler, SIGNAL(framesAvailable()), this, SLOT(cyclicFramesAvailable()));
+
+    disconnect(&replay, SIGNAL(status(QString)), this, SIGNAL(status(QString)));
+    disconnect(&replay, SIGNAL(sendFrames(QByteArray)), backend, SLOT(sendFrames(QByteArray)));
+    disconnect(&replay, SIGNAL(framesAvailable()), this, SLOT(replayFramesAvailable()));
+
+    thread.quit();
+    thread.wait();
 }
 
 void DLTCan::checkPortName()
@@ -58,6 +109,30 @@ void DLTCan::checkPortName()
     }
 }
 
+void DLTCan::setChannel(int channel)
+{
+    this->channel = channel;
+
+    if(channel>0)
+    {
+        elementName = QString("DLTCan%1").arg(channel+1);
+        thread.setObjectName(QString("DLTCanCapture%1").arg(channel+1));
+    }
+    else
+    {
+        elementName = "DLTCan";
+        thread.setObjectName("DLTCanCapture");
+    }
+}
+
+void DLTCan::forward(CanFrame *batch,int count)
+{
+    for(int num=0;num<count;num++)
+        batch[num].channel = channel;
+
+    frames(batch,count);
+}
+
 void DLTCan::start()
 {
     if(!active)
@@ -69,44 +144,23 @@ void DLTCan::start()
     // start communication
     // checkPortName();
 
-    // set serial port parameters
-    serialPort.setBaudRate(QSerialPort::Baud115200);
-    serialPort.setDataBits(QSerialPort::Data8);
-    serialPort.setParity(QSerialPort::NoParity);
-    serialPort.setStopBits(QSerialPort::OneStop);
-    serialPort.setFlowControl(QSerialPort::NoFlowControl);
-    serialPort.setPortName(interface);
-
-    // open serial port
-    if(serialPort.open(QIODevice::ReadWrite)==true)
-    {
-        // open with success
+    if(!selectBackend())
+        return;
 
-        // prevent flash mode of Wemos D1 mini
-        serialPort.setDataTerminalReady(false);
+    if(!thread.isRunning())
+        thread.start();
 
-        // connect slot to receive data from serial port
-        connect(&serialPort, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    filter.clearStatistics();
+    applyFilter();
 
-        status("started");
-        qDebug() << "DLTCan: started" << interface;
-     }
-    else
-    {
-        // open failed
+    // open interface in capture thread
+    QMetaObject::invokeMethod(backend, "open", Qt::QueuedConnection, Q_ARG(QString, interface), Q_ARG(int, baudRate));
 
-        qDebug() << "DLTCan: Failed to open interface" << interface;
-        status("error");
-    }
+    // start sending of active cyclic messages
+    scheduler.start();
 
-    serialData.clear();
-
-    // connect slot watchdog timer and start watchdog timer
-    connect(&timer, SIGNAL(timeout()), this, SLOT(timeout()));
-    timer.start(5000);
-    watchDogCounter = 0;
-    watchDogCounterLast = 0;
-    startFound = false;
+    if(replay.getActive())
+        replay.start();
 }
 
 void DLTCan::stop()
@@ -120,212 +174,134 @@ void DLTCan::stop()
     status("stopped");
     qDebug() << "DLTCan: stopped" << interface;
 
-    // close serial port, if it is open
-    if(serialPort.isOpen())
-    {
-        serialPort.close();
+    scheduler.stop();
+    replay.stop();
 
-        // disconnect slot to receive data from serial port
-        disconnect(&serialPort, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    // close interface and wait until capture thread has finished
+    if(thread.isRunning())
+    {
+        QMetaObject::invokeMethod(backend, "close", Qt::BlockingQueuedConnection);
+        thread.quit();
+        thread.wait();
     }
 
-    // stop watchdog timer
-    timer.stop();
-    disconnect(&timer, SIGNAL(timeout()), this, SLOT(timeout()));
-
+    // drop frames not read yet
+    while(backend->readFrames(frameBuffer,DLT_CAN_RECORDS)>0);
+    while(scheduler.readFrames(frameBuffer,DLT_CAN_RECORDS)>0);
+    while(replay.readFrames(frameBuffer,DLT_CAN_RECORDS)>0);
 }
 
-void DLTCan::readyRead()
+void DLTCan::framesAvailable()
 {
-    QByteArray data = serialPort.readAll();
-    qDebug() << "DLTCan: Received " << data.toHex();
-    for(int num=0;num<data.length();num++)
-    {
-       if(data.at(num)==0x7f)
-       {
-            if(startFound)
-            {
-                // already last Byte was start byte; remove duplicate
-                rawData+=data[num];
-                startFound = false;
-            }
-            else
-            {
-                 startFound = true;
-            }
-       }
-       else
-       {
-           if(startFound)
-           {
-               // a new message starts
-               rawData.clear();
-           }
-           rawData+=data[num];
-           startFound = false;
-       }
-
-       // check if it is already a complete message
-       if(rawData.size()==1 && (unsigned char)rawData.at(0)==0x01)
-       {
-           // send ok
-           qDebug() << "DLTCan: Raw Data " << rawData.toHex();
-           qDebug() << "DLTCan: Send ok";
-           status("send ok");
-           rawData.clear();
-       }
-       else if(rawData.size()==1 && (unsigned char)rawData.at(0)==0x02)
-       {
-           // send ok
-           qDebug() << "DLTCan: Raw Data " << rawData.toHex();
-           qDebug() << "DLTCan: Watchdog";
-           watchDogCounter++;
-           rawData.clear();
-       }
-       else if(rawData.size()==1 && (unsigned char)rawData.at(0)==0xfe)
-       {
-           // error send
-           qDebug() << "DLTCan: Raw Data " << rawData.toHex();
-           qDebug() << "DLTCan: Send error";
-           status("send error");
-           rawData.clear();
-       }
-       else if(rawData.size()==1 && (unsigned char)rawData.at(0)==0x00)
-       {
-           // init ok
-           qDebug() << "DLTCan: Raw Data " << rawData.toHex();
-           qDebug() << "DLTCan: Init ok";
-           status("init ok");
-           rawData.clear();
-       }
-       else if(rawData.size()==1 && (unsigned char)rawData.at(0)==0xff)
-       {
-           // init error
-           qDebug() << "DLTCan: Raw Data " << rawData.toHex();
-           qDebug() << "DLTCan: Init Error";
-           status("init error");
-           rawData.clear();
-       }
-       else if(rawData.size()>=1 && (unsigned char)rawData.at(0)==0x80)
-       {
-           // standard CAN message
-           if(rawData.size()>=4)
-           {
-               unsigned char length = rawData.at(1);
-               if(rawData.size()>=(4+length))
-               {
-                   qDebug() << "DLTCan: Raw Data " << rawData.toHex();
-                   unsigned short id = ((unsigned short)rawData.at(2)<<8)|((unsigned short)rawData.at(3));
-                   QByteArray data = rawData.mid(4,length);
-                   qDebug() << "DLTCan: Standard CAN message " << id << length << data.toHex();
-                   message(id,"Rx",data);
-                   rawData.clear();
-               }
-           }
-       }
-       else if(rawData.size()>=1 && (unsigned char)rawData.at(0)==0x81)
-       {
-           // extended CAN message
-
-           if(rawData.size()>=6)
-           {
-               qDebug() << "DLTCan: Raw Data " << rawData.toHex();
-               unsigned char length = rawData.at(1);
-               if(rawData.size()>=(6+length))
-               {
-                   unsigned int id = ((unsigned int)rawData.at(2)<<8)|((unsigned int)rawData.at(3)<<8)|((unsigned int)rawData.at(4)<<8)|((unsigned int)rawData.at(5));
-                   QByteArray data = rawData.mid(6,length);
-                   qDebug() << "DLTCan: Extended CAN message " << id << length << data.toHex();
-                   message(id,"Rx",data);
-                   rawData.clear();
-               }
-           }
-       }
+    int count;
 
+    // drain ring in batches, rejected frames are dropped before they are forwarded
+    while((count = backend->readFrames(frameBuffer,DLT_CAN_RECORDS))>0)
+    {
+        count = filter.apply(frameBuffer,count);
+        if(count>0)
+            forward(frameBuffer,count);
     }
 }
 
-void DLTCan::timeout()
+bool DLTCan::selectBackend()
 {
-    // watchdog timeout
+    DLTCanBackend *selected = &capture;
 
-    // check if watchdog was triggered between last call
-    if(watchDogCounter!=watchDogCounterLast)
+    if(backendType==DLTCanBackend::TypeSocketCan)
     {
-        watchDogCounterLast = watchDogCounter;
-        status("started");
+#ifdef Q_OS_LINUX
+        selected = &socketCan;
+#else
+        qDebug() << "DLTCan: SocketCAN is only supported on Linux";
+        status("error");
+        return false;
+#endif
     }
-    else
-    {
-        // no watchdog was received
-        qDebug() << "DLTCan: Watchdog expired try to reconnect" ;
 
-        // if serial port is open close serial port
-        if(serialPort.isOpen())
-        {
-            serialPort.close();
-            disconnect(&serialPort, SIGNAL(readyRead()), this, SLOT(readyRead()));
-        }
+    // due frames of scheduler and replay are sent directly in the capture thread
+    disconnect(&scheduler, SIGNAL(sendFrames(QByteArray)), backend, SLOT(sendFrames(QByteArray)));
+    disconnect(&replay, SIGNAL(sendFrames(QByteArray)), backend, SLOT(sendFrames(QByteArray)));
 
-        // check if port name has changed
-        // checkPortName();
+    backend = selected;
 
-        serialData.clear();
+    connect(&scheduler, SIGNAL(sendFrames(QByteArray)), backend, SLOT(sendFrames(QByteArray)));
+    connect(&replay, SIGNAL(sendFrames(QByteArray)), backend, SLOT(sendFrames(QByteArray)));
 
-        // try to reopen serial port
-        if(serialPort.open(QIODevice::ReadWrite)==true)
-        {
-            // retry was succesful
+    return true;
+}
 
-            // prevent flash mode of Wemos D1 mini
-            serialPort.setDataTerminalReady(false);
+void DLTCan::applyFilter()
+{
+    // without hardware filter the adapter accepts all frames
+    DLTCanFilterHardware hardware;
+    if(hardwareFilter)
+        filter.compileHardware(hardware);
 
-            // connect slot to receive data from serial port
-            connect(&serialPort, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    char buffer[DLT_CAN_FILTER_BUFFER];
+    int length = DLTCanCapture::encodeFilter(hardware,buffer);
 
-            status("reconnect");
-            qDebug() << "DLTCan: reconnect" << interface;
-        }
-        else
-        {
-            // retry failed
+    // stored by the capture thread and sent again after each reset of the adapter
+    QMetaObject::invokeMethod(&capture, "setFilter", Qt::QueuedConnection, Q_ARG(QByteArray, QByteArray(buffer,length)));
+}
 
-            qDebug() << "DLTCan: Failed to open interface" << interface;
-            status("error");
-        }
-    }
+void DLTCan::write(const unsigned char *data,int length)
+{
+    // serial port is only accessed from capture thread
+    QMetaObject::invokeMethod(&capture, "write", Qt::QueuedConnection, Q_ARG(QByteArray, QByteArray((const char*)data,length)));
+}
+
+void DLTCan::sent(unsigned short id,const unsigned char *data,int length)
+{
+    CanFrame frame;
+
+    memset(&frame,0,sizeof(frame));
+    frame.timestamp = DLTCanClock::now();
+    frame.id = id;
+    frame.flags = CAN_FRAME_FLAG_TX;
+    frame.dlc = length<=CAN_FRAME_MAX_DATA ? length : CAN_FRAME_MAX_DATA;
+    memcpy(frame.data,data,frame.dlc);
 
+    forward(&frame,1);
 }
 
 void DLTCan::clearSettings()
 {
     active = 0;
+    baudRate = DLT_CAN_BAUD_RATE_DEFAULT;
+    backendType = DLTCanBackend::TypeSerial;
+    contextId = channel>0 ? QString("CAN%1").arg(channel+1) : QString();
+    hardwareFilter = true;
 
     interfaceSerialNumber = "";
     interfaceProductIdentifier = 0;
     interfaceVendorIdentifier = 0;
+
+    messageId = 0;
+    messageData.clear();
+    scheduler.clear();
+    filter.clear();
+    filter.setActive(true);
 }
 
 void DLTCan::writeSettings(QXmlStreamWriter &xml)
 {
     /* Write project settings */
-    xml.writeStartElement(QString("DLTCan"));
+    xml.writeStartElement(elementName);
         xml.writeTextElement("interface",interface);
         xml.writeTextElement("interfaceSerialNumber",QSerialPortInfo(interface).serialNumber());
         xml.writeTextElement("interfaceProductIdentifier",QString("%1").arg(QSerialPortInfo(interface).productIdentifier()));
         xml.writeTextElement("interfaceVendorIdentifier",QString("%1").arg(QSerialPortInfo(interface).vendorIdentifier()));
         xml.writeTextElement("active",QString("%1").arg(active));
+        xml.writeTextElement("baudRate",QString("%1").arg(baudRate));
+        xml.writeTextElement("backend",QString("%1").arg(backendType));
+        xml.writeTextElement("contextId",contextId);
+        xml.writeTextElement("hardwareFilter",QString("%1").arg(hardwareFilter));
         xml.writeTextElement("messageId",QString("%1").arg(messageId));
         xml.writeTextElement("messageData",messageData.toHex());
-        xml.writeTextElement("cyclicMessageActive1",QString("%1").arg(cyclicMessageActive1));
-        xml.writeTextElement("cyclicMessageTimeout1",QString("%1").arg(cyclicMessageTimeout1));
-        xml.writeTextElement("cyclicMessageId1",QString("%1").arg(cyclicMessageId1));
-        xml.writeTextElement("cyclicMessageData1",cyclicMessageData1.toHex());
-        xml.writeTextElement("cyclicMessageActive2",QString("%1").arg(cyclicMessageActive2));
-        xml.writeTextElement("cyclicMessageTimeout2",QString("%1").arg(cyclicMessageTimeout2));
-        xml.writeTextElement("cyclicMessageId2",QString("%1").arg(cyclicMessageId2));
-        xml.writeTextElement("cyclicMessageData2",cyclicMessageData2.toHex());
-    xml.writeEndElement(); // DLTCan
+        scheduler.writeSettings(xml);
+        filter.writeSettings(xml);
+    xml.writeEndElement(); // DLTCan or DLTCan<n>
 }
 
 void DLTCan::readSettings(const QString &filename)
@@ -379,48 +355,42 @@ void DLTCan::readSettings(const QString &filename)
                   {
                       active = xml.readElementText().toInt();
                   }
-                  else if(xml.name() == QString("messageId"))
+                  else if(xml.name() == QString("baudRate"))
                   {
-                      messageId = xml.readElementText().toInt();
+                      baudRate = xml.readElementText().toInt();
                   }
-                  else if(xml.name() == QString("messageData"))
+                  else if(xml.name() == QString("contextId"))
                   {
-                      messageData = QByteArray::fromHex(xml.readElementText().toLatin1());
+                      contextId = xml.readElementText();
                   }
-                  else if(xml.name() == QString("cyclicMessageActive1"))
+                  else if(xml.name() == QString("backend"))
                   {
-                      cyclicMessageActive1 = xml.readElementText().toInt();
+                      backendType = xml.readElementText().toInt();
                   }
-                  else if(xml.name() == QString("cyclicMessageTimeout1"))
+                  else if(xml.name() == QString("hardwareFilter"))
                   {
-                      cyclicMessageTimeout1 = xml.readElementText().toInt();
+                      hardwareFilter = xml.readElementText().toInt();
                   }
-                  else if(xml.name() == QString("cyclicMessageId1"))
-                  {
-                      cyclicMessageId1 = xml.readElementText().toInt();
-                  }
-                  else if(xml.name() == QString("cyclicMessageData1"))
-                  {
-                      cyclicMessageData1 = QByteArray::fromHex(xml.readElementText().toLatin1());
-                  }
-                  else if(xml.name() == QString("cyclicMessageActive2"))
+                  else if(xml.name() == QString("messageId"))
                   {
-                      cyclicMessageActive2 = xml.readElementText().toInt();
+                      messageId = xml.readElementText().toInt();
                   }
-                  else if(xml.name() == QString("cyclicMessageTimeout2"))
+                  else if(xml.name() == QString("messageData"))
                   {
-                      cyclicMessageTimeout2 = xml.readElementText().toInt();
+                      messageData = QByteArray::fromHex(xml.readElementText().toLatin1());
                   }
-                  else if(xml.name() == QString("cyclicMessageId2"))
+                  else if(xml.name() == QString("cyclicMessages"))
                   {
-                      cyclicMessageId2 = xml.readElementText().toInt();
+                      // read by the scheduler
+                      xml.skipCurrentElement();
                   }
-                  else if(xml.name() == QString("cyclicMessageData2"))
+                  else if(xml.name() == QString("filters"))
                   {
-                      cyclicMessageData2 = QByteArray::fromHex(xml.readElementText().toLatin1());
+                      // read by the filter
+                      xml.skipCurrentElement();
                   }
               }
-              else if(xml.name() == QString("DLTCan"))
+              else if(xml.name() == elementName)
               {
                     isDLTCan = true;
               }
@@ -428,7 +398,7 @@ void DLTCan::readSettings(const QString &filename)
           else if(xml.isEndElement())
           {
               /* Connection, plugin and filter */
-              if(xml.name() == QString("DLTCan"))
+              if(xml.name() == elementName)
               {
                     isDLTCan = false;
               }
@@ -440,6 +410,9 @@ void DLTCan::readSettings(const QString &filename)
     }
 
     file.close();
+
+    scheduler.readSettings(filename,elementName);
+    filter.readSettings(filename,elementName);
 }
 
 void DLTCan::sendMessage(unsigned short id,unsigned char *data,int length)
@@ -449,6 +422,21 @@ void DLTCan::sendMessage(unsigned short id,unsigned char *data,int length)
         return;
     }
 
+    if(backend!=&capture)
+    {
+        // only the adapter has its own command for a single message
+        CanFrame frame;
+        memset(&frame,0,sizeof(frame));
+        frame.id = id;
+        frame.dlc = length<=CAN_FRAME_MAX_DATA_CLASSIC ? length : CAN_FRAME_MAX_DATA_CLASSIC;
+        memcpy(frame.data,data,frame.dlc);
+        sendMessages(&frame,1);
+
+        messageId = id;
+        messageData = QByteArray((char*)data,length);
+        return;
+    }
+
     unsigned char msg[256];
 
     msg[0]=0x7f;
@@ -464,155 +452,102 @@ void DLTCan::sendMessage(unsigned short id,unsigned char *data,int length)
         //    msg[pos++]=0x7f; // add stuff byte to be able to detect unique header
     }
     //memcpy((void*)(msg+5),(void*)data,length);
-    serialPort.write((char*)msg,pos);
+    write(msg,pos);
 
     messageId = id;
     messageData = QByteArray((char*)data,length);
 
     qDebug() << "DLTCan: Send CAN message " << id << length << QByteArray((char*)msg,pos).toHex();
 
-    message(id,"Tx",QByteArray((char*)data,length));
-
-}
-
-void DLTCan::startCyclicMessage1(int timeout)
-{
-    connect(&timerCyclicMessage1, SIGNAL(timeout()), this, SLOT(timeoutCyclicMessage1()));
-
-    cyclicMessageTimeout1 = timeout;
-    cyclicMessageActive1 = true;
-
-    timerCyclicMessage1.start(timeout);
-}
-
-void DLTCan::startCyclicMessage2(int timeout)
-{
-    connect(&timerCyclicMessage2, SIGNAL(timeout()), this, SLOT(timeoutCyclicMessage2()));
-
-    cyclicMessageTimeout2 = timeout;
-    cyclicMessageActive2 = true;
-
-    timerCyclicMessage2.start(timeout);
-}
-
-void DLTCan::stopCyclicMessage1()
-{
-    timerCyclicMessage1.stop();
-    cyclicMessageActive1 = false;
-
-    disconnect(&timerCyclicMessage1, SIGNAL(timeout()), this, SLOT(timeoutCyclicMessage1()));
-}
-
-void DLTCan::stopCyclicMessage2()
-{
-    timerCyclicMessage2.stop();
-    cyclicMessageActive2 = false;
+    sent(id,data,length);
 
-    disconnect(&timerCyclicMessage2, SIGNAL(timeout()), this, SLOT(timeoutCyclicMessage2()));
 }
 
-void DLTCan::timeoutCyclicMessage1()
+void DLTCan::sendMessages(const CanFrame *messages,int count)
 {
     if(!active)
     {
         return;
     }
 
-    unsigned char msg[256];
-
-    msg[0]=0x7f;
-    msg[1]=0x80;
-    msg[2]=cyclicMessageData1.length();
-    msg[3]=(cyclicMessageId1>>8)&0xff;
-    msg[4]=cyclicMessageId1&0xff;
-    memcpy((void*)(msg+5),(void*)cyclicMessageData1.constData(),cyclicMessageData1.length());
-    serialPort.write((char*)msg,cyclicMessageData1.length()+5);
-
-    qDebug() << "DLTCan: Send CAN message " << cyclicMessageId1 << cyclicMessageData1.length() << QByteArray((char*)msg,cyclicMessageData1.length()+5).toHex();
-
-    message(cyclicMessageId1,"Tx",QByteArray((char*)cyclicMessageData1.constData(),cyclicMessageData1.length()));
-}
+    CanFrame sentFrames[DLT_CAN_BATCH_MAX];
 
-void DLTCan::timeoutCyclicMessage2()
-{
-    if(!active)
+    for(int start=0;start<count;start+=DLT_CAN_BATCH_MAX)
     {
-        return;
-    }
-
-    unsigned char msg[256];
-
-    msg[0]=0x7f;
-    msg[1]=0x80;
-    msg[2]=cyclicMessageData2.length();
-    msg[3]=(cyclicMessageId2>>8)&0xff;
-    msg[4]=cyclicMessageId2&0xff;
-    memcpy((void*)(msg+5),(void*)cyclicMessageData2.constData(),cyclicMessageData2.length());
-    serialPort.write((char*)msg,cyclicMessageData2.length()+5);
+        int batch = qMin(count-start,DLT_CAN_BATCH_MAX);
+        quint64 timestamp = DLTCanClock::now();
 
-    qDebug() << "DLTCan: Send CAN message " << cyclicMessageId2 << cyclicMessageData2.length() << QByteArray((char*)msg,cyclicMessageData2.length()+5).toHex();
+        // interface is only accessed from capture thread, the adapter gets one batch
+        QMetaObject::invokeMethod(backend, "sendFrames", Qt::QueuedConnection, Q_ARG(QByteArray, DLTCanBackend::packFrames(messages+start,batch)));
 
-    message(cyclicMessageId2,"Tx",QByteArray((char*)cyclicMessageData2.constData(),cyclicMessageData2.length()));
-}
+        for(int num=0;num<batch;num++)
+        {
+            sentFrames[num] = messages[start+num];
+            sentFrames[num].timestamp = timestamp;
+            sentFrames[num].flags |= CAN_FRAME_FLAG_TX;
+            // CAN FD is only sent by SocketCAN
+            if(backend==&capture && sentFrames[num].dlc>CAN_FRAME_MAX_DATA_CLASSIC)
+                sentFrames[num].dlc = CAN_FRAME_MAX_DATA_CLASSIC;
+        }
 
-bool DLTCan::getCyclicMessageActive2() const
-{
-    return cyclicMessageActive2;
-}
+        qDebug() << "DLTCan: Send CAN messages" << batch;
 
-void DLTCan::setCyclicMessageActive2(bool value)
-{
-    cyclicMessageActive2 = value;
+        forward(sentFrames,batch);
+    }
 }
 
-bool DLTCan::getCyclicMessageActive1() const
+void DLTCan::startCyclicMessage(int index,int timeout)
 {
-    return cyclicMessageActive1;
+    scheduler.setPeriod(index,timeout);
+    scheduler.setActive(index,true);
 }
 
-void DLTCan::setCyclicMessageActive1(bool value)
+void DLTCan::setCyclicMessage(int index,unsigned int id,QByteArray data)
 {
-    cyclicMessageActive1 = value;
+    scheduler.setMessage(index,id,data);
 }
 
-int DLTCan::getCyclicMessageTimeout2() const
+void DLTCan::stopCyclicMessage(int index)
 {
-    return cyclicMessageTimeout2;
+    scheduler.setActive(index,false);
 }
 
-void DLTCan::setCyclicMessageTimeout2(int value)
+void DLTCan::cyclicFramesAvailable()
 {
-    cyclicMessageTimeout2 = value;
-}
+    int count;
 
-int DLTCan::getCyclicMessageTimeout1() const
-{
-    return cyclicMessageTimeout1;
+    // sent cyclic messages are forwarded like received frames
+    while((count = scheduler.readFrames(frameBuffer,DLT_CAN_RECORDS))>0)
+    {
+        forward(frameBuffer,count);
+    }
 }
 
-void DLTCan::setCyclicMessageTimeout1(int value)
+void DLTCan::startReplay()
 {
-    cyclicMessageTimeout1 = value;
-}
+    if(!active || !thread.isRunning())
+    {
+        return;
+    }
 
-QByteArray DLTCan::getCyclicMessageData2() const
-{
-    return cyclicMessageData2;
+    replay.stop();
+    replay.start();
 }
 
-void DLTCan::setCyclicMessageData2(const QByteArray &value)
+void DLTCan::stopReplay()
 {
-    cyclicMessageData2 = value;
+    replay.stop();
 }
 
-QByteArray DLTCan::getCyclicMessageData1() const
+void DLTCan::replayFramesAvailable()
 {
-    return cyclicMessageData1;
-}
+    int count;
 
-void DLTCan::setCyclicMessageData1(const QByteArray &value)
-{
-    cyclicMessageData1 = value;
+    // replayed frames are forwarded as sent frames
+    while((count = replay.readFrames(frameBuffer,DLT_CAN_RECORDS))>0)
+    {
+        forward(frameBuffer,count);
+    }
 }
 
 QByteArray DLTCan::getMessageData() const
@@ -625,26 +560,6 @@ void DLTCan::setMessageData(const QByteArray &value)
     messageData = value;
 }
 
-unsigned short DLTCan::getCyclicMessageId2() const
-{
-    return cyclicMessageId2;
-}
-
-void DLTCan::setCyclicMessageId2(unsigned short value)
-{
-    cyclicMessageId2 = value;
-}
-
-unsigned short DLTCan::getCyclicMessageId1() const
-{
-    return cyclicMessageId1;
-}
-
-void DLTCan::setCyclicMessageId1(unsigned short value)
-{
-    cyclicMessageId1 = value;
-}
-
 unsigned short DLTCan::getMessageId() const
 {
     return messageId;
@@ -654,15 +569,3 @@ void DLTCan::setMessageId(unsigned short value)
 {
     messageId = value;
 }
-
-void DLTCan::setCyclicMessage1(unsigned short id,QByteArray data)
-{
-    cyclicMessageId1 = id;
-    cyclicMessageData1 = data;
-}
-
-void DLTCan::setCyclicMessage2(unsigned short id,QByteArray data)
-{
-    cyclicMessageId2 = id;
-    cyclicMessageData2 = data;
-}
@@ -18,9 +18,17 @@
 #include <QObject>
 #include <QXmlStreamWriter>
 #include <QXmlStreamReader>
-#include <QSerialPort>
+#include <QThread>
 #include <QTimer>
 
+#include "dltcancapture.h"
+#include "dltcanfilter.h"
+#ifdef Q_OS_LINUX
+#include "dltcansocketcan.h"
+#endif
+#include "dltcanreplay.h"
+#include "dltcanscheduler.h"
+
 class DLTCan : public QObject
 {
     Q_OBJECT
@@ -32,9 +40,26 @@ public:
     void start();
     void stop();
 
+    // Index of the channel, stamped into all forwarded frames, 0 is the first channel
+    int getChannel() { return channel; }
+    void setChannel(int channel);
+
+    // DLT context ID of the frames of this channel, empty uses the context ID of the DLT server
+    QString getContextId() { return contextId; }
+    void setContextId(QString id) { this->contextId = id; }
+
+    // Serial port of the adapter or SocketCAN network interface, e.g. can0 or vcan0
     QString getInterface() { return interface; }
     void setInterface(QString interface) { this->interface = interface; }
 
+    // Backend of the interface, DLTCanBackend::TypeSerial or DLTCanBackend::TypeSocketCan
+    int getBackend() { return backendType; }
+    void setBackend(int backendType) { this->backendType = backendType; }
+
+    // Baud rate of the serial link, negotiated with the adapter
+    int getBaudRate() { return baudRate; }
+    void setBaudRate(int baudRate) { this->baudRate = baudRate; }
+
     // Active
     bool getActive() { return active; }
     void setActive(bool active) { this->active = active; }
@@ -47,83 +72,93 @@ public:
     void off();
 
     void sendMessage(unsigned short id,unsigned char *data,int length);
-    void startCyclicMessage1(int timeout);
-    void startCyclicMessage2(int timeout);
-    void setCyclicMessage1(unsigned short id,QByteArray data);
-    void setCyclicMessage2(unsigned short id,QByteArray data);
-    void stopCyclicMessage1();
-    void stopCyclicMessage2();
-
-    unsigned short getMessageId() const;
-    void setMessageId(unsigned short value);
-
-    unsigned short getCyclicMessageId1() const;
-    void setCyclicMessageId1(unsigned short value);
+    // Send several messages with one write, the adapter acknowledges each batch once
+    void sendMessages(const CanFrame *messages,int count);
 
-    unsigned short getCyclicMessageId2() const;
-    void setCyclicMessageId2(unsigned short value);
+    // Cyclic messages, index starts with 0
+    DLTCanScheduler &getScheduler() { return scheduler; }
+    void startCyclicMessage(int index,int timeout);
+    void setCyclicMessage(int index,unsigned int id,QByteArray data);
+    void stopCyclicMessage(int index);
 
-    QByteArray getMessageData() const;
-    void setMessageData(const QByteArray &value);
+    // Filter of received frames, applied before the frames are forwarded
+    DLTCanFilter &getFilter() { return filter; }
 
-    QByteArray getCyclicMessageData1() const;
-    void setCyclicMessageData1(const QByteArray &value);
+    // Program the include rules of the filter into the MCP2515 of the adapter, serial backend only
+    bool getHardwareFilter() { return hardwareFilter; }
+    void setHardwareFilter(bool hardwareFilter) { this->hardwareFilter = hardwareFilter; }
 
-    QByteArray getCyclicMessageData2() const;
-    void setCyclicMessageData2(const QByteArray &value);
+    // Send the acceptance configuration to the adapter, must be called after the filter was changed
+    void applyFilter();
 
-    int getCyclicMessageTimeout1() const;
-    void setCyclicMessageTimeout1(int value);
+    // Replay of recorded frames, sent frames are forwarded like cyclic messages
+    DLTCanReplay &getReplay() { return replay; }
+    void startReplay();
+    void stopReplay();
 
-    int getCyclicMessageTimeout2() const;
-    void setCyclicMessageTimeout2(int value);
+    unsigned short getMessageId() const;
+    void setMessageId(unsigned short value);
 
-    bool getCyclicMessageActive1() const;
-    void setCyclicMessageActive1(bool value);
+    QByteArray getMessageData() const;
+    void setMessageData(const QByteArray &value);
 
-    bool getCyclicMessageActive2() const;
-    void setCyclicMessageActive2(bool value);
+    // Frames dropped because the consumer could not keep up with the capture thread
+    unsigned int getOverflowCounter() const { return backend->getOverflowCounter(); }
+    unsigned int getHighWaterMark() const { return backend->getHighWaterMark(); }
+    unsigned int getErrorCounter() const { return backend->getErrorCounter(); }
+    quint64 getByteCounter() const { return backend->getByteCounter(); }
 
 signals:
 
     void status(QString text);
-    void message(unsigned int id,QString direction,QByteArray data);
+    // Batch of received or sent frames, only valid during the call
+    void frames(const CanFrame *frames,int count);
 
 private slots:
 
-    void readyRead();
+    void framesAvailable();
 
-    // Watchdog Timeout
-    void timeout();
+    void cyclicFramesAvailable();
 
-    void timeoutCyclicMessage1();
-    void timeoutCyclicMessage2();
+    void replayFramesAvailable();
 
 private:
 
-    QSerialPort serialPort;
-    QTimer timer;
-    QTimer timerRequest;
-    unsigned int watchDogCounter,watchDogCounterLast;
+    QThread thread;
+    DLTCanCapture capture;
+#ifdef Q_OS_LINUX
+    DLTCanSocketCan socketCan;
+#endif
+    DLTCanBackend *backend;     // selected at start
+    CanFrame frameBuffer[DLT_CAN_RECORDS];
 
     QString interface;
     QString interfaceSerialNumber;
     ushort interfaceProductIdentifier;
     ushort interfaceVendorIdentifier;
     bool active;
+    int baudRate;
+    int backendType;
+    bool hardwareFilter;
+
+    bool selectBackend();
+    void forward(CanFrame *batch,int count);
+
+    int channel;
+    QString elementName;    // settings of the first channel are stored in DLTCan
+    QString contextId;
+
+    void write(const unsigned char *data,int length);
+    void sent(unsigned short id,const unsigned char *data,int length);
 
-    QByteArray serialData;
+    unsigned short messageId;
+    QByteArray messageData;
 
-    QByteArray rawData;
-    bool startFound;
+    DLTCanScheduler scheduler;
 
-    bool cyclicMessageActive1,cyclicMessageActive2;
-    int cyclicMessageTimeout1,cyclicMessageTimeout2;
-    unsigned short messageId,cyclicMessageId1,cyclicMessageId2;
-    QByteArray messageData,cyclicMessageData1,cyclicMessageData2;
+    DLTCanFilter filter;
 
-    QTimer timerCyclicMessage1;
-    QTimer timerCyclicMessage2;
+    DLTCanReplay replay;
 
 };
 
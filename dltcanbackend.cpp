@@ -0,0 +1,35 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanbackend.cpp
+ * @licence end@
+ */
+
+#include "dltcanbackend.h"
+
+DLTCanBackend::DLTCanBackend(QObject *parent) : QObject(parent)
+{
+    notified = false;
+    droppedCounter = 0;
+    errorCounter = 0;
+    byteCounter = 0;
+}
+
+DLTCanBackend::~DLTCanBackend()
+{
+}
+
+int DLTCanBackend::readFrames(CanFrame *frames,int maxFrames)
+{
+    // reset before reading, so frames pushed afterwards are signaled again
+    notified.store(false);
+
+    return ring.pop(frames,maxFrames);
+}
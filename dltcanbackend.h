@@ -0,0 +1,95 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanbackend.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_BACKEND_H
+#define DLT_CAN_BACKEND_H
+
+#include <QObject>
+#include <QByteArray>
+
+#include <atomic>
+
+#include "canframe.h"
+#include "dltcanring.h"
+
+// number of received frames buffered between backend thread and consumers
+#define DLT_CAN_RING_SIZE 4096
+
+typedef DLTCanRing<CanFrame,DLT_CAN_RING_SIZE> DLTCanFrameRing;
+
+/**
+ * Interface to the CAN bus used by DLTCan.
+ *
+ * A backend lives in its own thread, so the interface is read independently
+ * of the GUI. Received frames are pushed into a lock-free ring, which is
+ * drained by the consumer when framesAvailable() is signaled. Frames to be
+ * sent are passed as packed CanFrame structs, so they can be queued to the
+ * thread of the backend.
+ */
+class DLTCanBackend : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DLTCanBackend(QObject *parent = nullptr);
+    virtual ~DLTCanBackend();
+
+    enum Type
+    {
+        TypeSerial = 0,     // Wemos CAN adapter on a serial port
+        TypeSocketCan = 1   // SocketCAN network interface, Linux only
+    };
+
+    // Consumer side of the ring, must only be called from one thread
+    int readFrames(CanFrame *frames,int maxFrames);
+
+    // Frames dropped because the consumer or the backend thread could not keep up
+    unsigned int getOverflowCounter() const { return ring.getOverflowCounter()+droppedCounter.load(std::memory_order_relaxed); }
+    unsigned int getHighWaterMark() const { return ring.getHighWaterMark(); }
+    unsigned int getErrorCounter() const { return errorCounter.load(std::memory_order_relaxed); }
+    quint64 getByteCounter() const { return byteCounter.load(std::memory_order_relaxed); }
+
+    // Pack frames to be sent
+    static QByteArray packFrames(const CanFrame *frames,int count) { return QByteArray((const char*)frames,count*(int)sizeof(CanFrame)); }
+
+signals:
+
+    void status(QString text);
+    void framesAvailable();
+
+public slots:
+
+    // Open the interface, the baud rate is only used by the serial adapter
+    virtual void open(QString interface,int baudRate) = 0;
+    virtual void close() = 0;
+
+    // Send frames packed with packFrames()
+    virtual void sendFrames(QByteArray frames) = 0;
+
+protected:
+
+    // Signal the consumer only once until it has read the ring
+    void notify()
+    {
+        if(!notified.exchange(true))
+            framesAvailable();
+    }
+
+    DLTCanFrameRing ring;
+    std::atomic<bool> notified;
+    std::atomic<unsigned int> droppedCounter;
+    std::atomic<unsigned int> errorCounter;
+    std::atomic<quint64> byteCounter;
+};
+
+#endif // DLT_CAN_BACKEND_H
@@ -0,0 +1,661 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcancapture.cpp
+ * @licence end@
+ */
+
+#include "dltcancapture.h"
+#include "dltcanclock.h"
+#include "dltcanscheduler.h"
+
+#include <QDebug>
+
+#include <string.h>
+
+DLTCanCapture::DLTCanCapture(QObject *parent) : DLTCanBackend(parent)
+    , serialPort(this)
+    , timer(this)
+    , timerLink(this)
+{
+    watchDogCounter = 0;
+    watchDogCounterLast = 0;
+    overflowCounterLast = 0;
+    scheduler = 0;
+    filterPending = false;
+
+    baudRate = DLT_CAN_BAUD_RATE_DEFAULT;
+    linkBaudRate = DLT_CAN_BAUD_RATE_DEFAULT;
+    linkBaudRateNegotiated = 0;
+    linkState = LinkIdle;
+    linkDiscard = false;
+
+    timerLink.setSingleShot(true);
+    connect(&timerLink, SIGNAL(timeout()), this, SLOT(timeoutLink()));
+}
+
+DLTCanCapture::~DLTCanCapture()
+{
+    closePort();
+}
+
+void DLTCanCapture::open(QString interface,int baudRate)
+{
+    this->interface = interface;
+    this->baudRate = baudRate;
+
+    // adapter always starts with default baud rate
+    linkBaudRate = DLT_CAN_BAUD_RATE_DEFAULT;
+    linkBaudRateNegotiated = 0;
+    linkState = LinkIdle;
+    pendingData.clear();
+
+    clockSync.reset();
+
+    if(openPort())
+    {
+        status("started");
+        qDebug() << "DLTCan: started" << interface;
+    }
+    else
+    {
+        // open failed
+        qDebug() << "DLTCan: Failed to open interface" << interface;
+        status("error");
+    }
+
+    // connect slot watchdog timer and start watchdog timer
+    connect(&timer, SIGNAL(timeout()), this, SLOT(timeout()));
+    timer.start(5000);
+    watchDogCounter = 0;
+    watchDogCounterLast = 0;
+}
+
+void DLTCanCapture::close()
+{
+    closePort();
+
+    // stop watchdog and handshake timer
+    timer.stop();
+    timerLink.stop();
+    disconnect(&timer, SIGNAL(timeout()), this, SLOT(timeout()));
+}
+
+bool DLTCanCapture::openPort()
+{
+    // set serial port parameters
+    serialPort.setBaudRate(linkBaudRate);
+    serialPort.setDataBits(QSerialPort::Data8);
+    serialPort.setParity(QSerialPort::NoParity);
+    serialPort.setStopBits(QSerialPort::OneStop);
+    serialPort.setFlowControl(QSerialPort::NoFlowControl);
+    serialPort.setPortName(interface);
+
+    decoder.reset();
+
+    // open serial port
+    if(serialPort.open(QIODevice::ReadWrite)==true)
+    {
+        // open with success
+
+        // prevent flash mode of Wemos D1 mini
+        serialPort.setDataTerminalReady(false);
+
+        // connect slot to receive data from serial port
+        connect(&serialPort, SIGNAL(readyRead()), this, SLOT(readyRead()));
+
+        return true;
+    }
+
+    return false;
+}
+
+void DLTCanCapture::closePort()
+{
+    // close serial port, if it is open
+    if(serialPort.isOpen())
+    {
+        serialPort.close();
+
+        // disconnect slot to receive data from serial port
+        disconnect(&serialPort, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    }
+}
+
+void DLTCanCapture::write(QByteArray data)
+{
+    if(!serialPort.isOpen())
+        return;
+
+    if(!writeLink(data.constData(),data.size()))
+    {
+        qDebug() << "DLTCan: Data dropped during link speed handshake" << data.size();
+        status("send error");
+    }
+}
+
+bool DLTCanCapture::writeLink(const char *data,int length)
+{
+    if(linkState!=LinkRequested && linkState!=LinkSwitched)
+    {
+        serialPort.write(data,length);
+        return true;
+    }
+
+    // the baud rate is switched, sent when the handshake is done
+    if(pendingData.size()+length>DLT_CAN_PENDING_MAX)
+        return false;
+
+    pendingData.append(data,length);
+
+    return true;
+}
+
+void DLTCanCapture::writePending()
+{
+    if(filterPending)
+    {
+        filterPending = false;
+        serialPort.write(filterData);
+    }
+
+    if(!pendingData.isEmpty())
+    {
+        serialPort.write(pendingData);
+        pendingData.clear();
+    }
+}
+
+void DLTCanCapture::sendFrames(QByteArray frames)
+{
+    if(!serialPort.isOpen())
+        return;
+
+    // split into batches of the adapter, held back during the link speed handshake
+    const CanFrame *messages = (const CanFrame*)frames.constData();
+    int count = frames.size()/(int)sizeof(CanFrame);
+    int dropped = 0;
+    for(int pos=0;pos<count;pos+=DLT_CAN_BATCH_MAX)
+    {
+        int length = encodeMessages(messages+pos,qMin(count-pos,DLT_CAN_BATCH_MAX),batchBuffer);
+        if(!writeLink(batchBuffer,length))
+            dropped += qMin(count-pos,DLT_CAN_BATCH_MAX);
+    }
+
+    if(dropped)
+    {
+        qDebug() << "DLTCan: Messages dropped during link speed handshake" << dropped;
+        status("send error");
+    }
+}
+
+static inline int encodeStuffed(unsigned char *msg,int pos,unsigned char value)
+{
+    msg[pos++]=value;
+    if(value==0x7f)
+        msg[pos++]=0x7f; // add stuff byte to be able to detect unique header
+
+    return pos;
+}
+
+int DLTCanCapture::encodeMessages(const CanFrame *messages,int count,char *buffer)
+{
+    unsigned char *msg = (unsigned char*)buffer;
+
+    if(count>DLT_CAN_BATCH_MAX)
+        count = DLT_CAN_BATCH_MAX;
+
+    msg[0]=0x7f;
+    msg[1]=0x82;
+    int pos = encodeStuffed(msg,2,count);
+    for(int num=0;num<count;num++)
+    {
+        const CanFrame &frame = messages[num];
+        int length = frame.dlc<=CAN_FRAME_MAX_DATA_CLASSIC ? frame.dlc : CAN_FRAME_MAX_DATA_CLASSIC;
+
+        pos = encodeStuffed(msg,pos,frame.flags&(CAN_FRAME_FLAG_EXTENDED|CAN_FRAME_FLAG_RTR));
+        pos = encodeStuffed(msg,pos,length);
+        pos = encodeStuffed(msg,pos,(frame.id>>24)&0xff);
+        pos = encodeStuffed(msg,pos,(frame.id>>16)&0xff);
+        pos = encodeStuffed(msg,pos,(frame.id>>8)&0xff);
+        pos = encodeStuffed(msg,pos,frame.id&0xff);
+        for(int byte=0;byte<length;byte++)
+            pos = encodeStuffed(msg,pos,frame.data[byte]);
+    }
+
+    return pos;
+}
+
+int DLTCanCapture::encodeCyclicTable(const DLTCanCyclicMessage *messages,int count,char *buffer)
+{
+    unsigned char *msg = (unsigned char*)buffer;
+
+    if(count>DLT_CAN_CYCLIC_TABLE_MAX)
+        count = DLT_CAN_CYCLIC_TABLE_MAX;
+
+    msg[0]=0x7f;
+    msg[1]=0x84;
+    int pos = encodeStuffed(msg,2,count);
+    for(int num=0;num<count;num++)
+    {
+        const DLTCanCyclicMessage &message = messages[num];
+        int length = message.data.size()<=CAN_FRAME_MAX_DATA_CLASSIC ? message.data.size() : CAN_FRAME_MAX_DATA_CLASSIC;
+        // inactive messages are kept in the table with period 0, so the index stays the same
+        int period = message.active ? qBound(0,message.period,0xffff) : 0;
+        int phase = qBound(0,message.phase,0xffff);
+
+        pos = encodeStuffed(msg,pos,message.extended ? CAN_FRAME_FLAG_EXTENDED : 0);
+        pos = encodeStuffed(msg,pos,length);
+        pos = encodeStuffed(msg,pos,(message.id>>24)&0xff);
+        pos = encodeStuffed(msg,pos,(message.id>>16)&0xff);
+        pos = encodeStuffed(msg,pos,(message.id>>8)&0xff);
+        pos = encodeStuffed(msg,pos,message.id&0xff);
+        pos = encodeStuffed(msg,pos,(period>>8)&0xff);
+        pos = encodeStuffed(msg,pos,period&0xff);
+        pos = encodeStuffed(msg,pos,(phase>>8)&0xff);
+        pos = encodeStuffed(msg,pos,phase&0xff);
+        for(int byte=0;byte<length;byte++)
+            pos = encodeStuffed(msg,pos,(unsigned char)message.data[byte]);
+    }
+
+    return pos;
+}
+
+int DLTCanCapture::encodeFilter(const DLTCanFilterHardware &hardware,char *buffer)
+{
+    unsigned char *msg = (unsigned char*)buffer;
+
+    msg[0]=0x7f;
+    msg[1]=0x86;
+    int pos = 2;
+    for(int num=0;num<DLT_CAN_FILTER_HARDWARE_MASKS+DLT_CAN_FILTER_HARDWARE_FILTERS;num++)
+    {
+        bool extended;
+        quint32 value;
+        if(num<DLT_CAN_FILTER_HARDWARE_MASKS)
+        {
+            extended = hardware.maskExtended[num];
+            value = hardware.mask[num];
+        }
+        else
+        {
+            extended = hardware.filterExtended[num-DLT_CAN_FILTER_HARDWARE_MASKS];
+            value = hardware.filter[num-DLT_CAN_FILTER_HARDWARE_MASKS];
+        }
+
+        pos = encodeStuffed(msg,pos,extended ? CAN_FRAME_FLAG_EXTENDED : 0);
+        pos = encodeStuffed(msg,pos,(value>>24)&0xff);
+        pos = encodeStuffed(msg,pos,(value>>16)&0xff);
+        pos = encodeStuffed(msg,pos,(value>>8)&0xff);
+        pos = encodeStuffed(msg,pos,value&0xff);
+    }
+
+    return pos;
+}
+
+int DLTCanCapture::encodeLink(int baudRate,char *buffer)
+{
+    unsigned char *msg = (unsigned char*)buffer;
+
+    msg[0]=0x7f;
+    msg[1]=0x90;
+    int pos = 2;
+    for(int shift=24;shift>=0;shift-=8)
+    {
+        // baud rate big endian
+        pos = encodeStuffed(msg,pos,(baudRate>>shift)&0xff);
+    }
+
+    return pos;
+}
+
+void DLTCanCapture::setFilter(QByteArray data)
+{
+    filterData = data;
+
+    if(!serialPort.isOpen())
+        return;
+
+    // not sent while the baud rate is switched
+    if(linkState==LinkRequested || linkState==LinkSwitched)
+        filterPending = true;
+    else
+        serialPort.write(filterData);
+}
+
+void DLTCanCapture::readyRead()
+{
+    qint64 length;
+    bool pushed = false;
+
+    // read into preallocated buffer, no allocation for each received chunk
+    while((length = serialPort.read((char*)readBuffer,sizeof(readBuffer)))>0)
+    {
+        // all frames of a chunk get the time the chunk was read,
+        // if the adapter does not provide a timestamp
+        quint64 timestamp = DLTCanClock::now();
+        byteCounter.fetch_add(length,std::memory_order_relaxed);
+
+        int pos = 0;
+        linkDiscard = false;
+        while(pos<length && !linkDiscard)
+        {
+            int consumed = 0;
+            int count = decoder.decode(readBuffer+pos,length-pos,records,DLT_CAN_RECORDS,&consumed);
+            pos += consumed;
+
+            for(int num=0;num<count;num++)
+            {
+                if(records[num].type==DLTCanDecoder::TypeStandard || records[num].type==DLTCanDecoder::TypeExtended)
+                {
+                    if(records[num].timestamped && clockSync.isValid())
+                        records[num].frame.timestamp = clockSync.toHost(records[num].deviceTimestamp);
+                    else
+                        records[num].frame.timestamp = timestamp;
+                    ring.push(records[num].frame);
+                    pushed = true;
+                }
+                else if(records[num].type==DLTCanDecoder::TypeCyclicSent)
+                {
+                    // rebuild the sent message from the table of the scheduler
+                    CanFrame frame;
+                    quint64 sentTimestamp = clockSync.isValid() ? clockSync.toHost(records[num].deviceTimestamp) : timestamp;
+                    if(scheduler && scheduler->firmwareSent(records[num].frame.id,sentTimestamp,frame))
+                    {
+                        ring.push(frame);
+                        pushed = true;
+                    }
+                }
+                else
+                {
+                    record(records[num],timestamp);
+                    if(linkDiscard)
+                        break; // following records were received after the switch
+                }
+            }
+        }
+    }
+
+    errorCounter.store(decoder.getErrorCounter(),std::memory_order_relaxed);
+
+    if(pushed)
+        notify();
+}
+
+void DLTCanCapture::record(const DLTCanDecoder::Record &record,quint64 timestamp)
+{
+    switch(record.type)
+    {
+    case DLTCanDecoder::TypeSendOk:
+        // send ok
+        status("send ok");
+        break;
+    case DLTCanDecoder::TypeWatchdog:
+        // watchdog
+        watchDogCounter++;
+        if(record.timestamped)
+            clockSync.addSample(record.deviceTimestamp,timestamp);
+        // adapter was already running, when port was opened
+        if(linkState==LinkIdle)
+            requestLink();
+        break;
+    case DLTCanDecoder::TypeSendError:
+        // error send
+        qDebug() << "DLTCan: Send error";
+        status("send error");
+        break;
+    case DLTCanDecoder::TypeInitOk:
+        // init ok
+        qDebug() << "DLTCan: Init ok";
+        status("init ok");
+        // adapter was reset and uses default baud rate again
+        linkState = LinkIdle;
+        clockSync.reset();
+        // cyclic table of the adapter is lost, host sends until the capabilities are reported again
+        if(scheduler)
+            scheduler->setFirmwareCount(0);
+        requestLink();
+        break;
+    case DLTCanDecoder::TypeInitError:
+        // init error
+        qDebug() << "DLTCan: Init Error";
+        status("init error");
+        break;
+    case DLTCanDecoder::TypeSendBatch:
+        // result of a batch, one bit for each message
+        if(record.frame.dlc==3)
+        {
+            int count = record.frame.data[0];
+            unsigned int result = record.frame.data[1] | ((unsigned int)record.frame.data[2]<<8);
+            if(count>0 && count<=16 && result==(0xffffu>>(16-count)))
+            {
+                status("send ok");
+            }
+            else
+            {
+                qDebug() << "DLTCan: Send error in batch" << count << QString::number(result,2);
+                status("send error");
+            }
+        }
+        break;
+    case DLTCanDecoder::TypeCyclicCounters:
+        // counters of a cyclic message sent by the adapter, big endian
+        if(record.frame.dlc==8 && scheduler)
+        {
+            quint32 sent = ((quint32)record.frame.data[0]<<24) | ((quint32)record.frame.data[1]<<16) |
+                           ((quint32)record.frame.data[2]<<8) | record.frame.data[3];
+            quint32 missed = ((quint32)record.frame.data[4]<<24) | ((quint32)record.frame.data[5]<<16) |
+                             ((quint32)record.frame.data[6]<<8) | record.frame.data[7];
+            scheduler->firmwareCounters(record.frame.id,sent,missed);
+        }
+        break;
+    case DLTCanDecoder::TypeCapabilities:
+        // size of cyclic table of the adapter
+        if(record.frame.dlc==1)
+        {
+            int count = qMin((int)record.frame.data[0],DLT_CAN_CYCLIC_TABLE_MAX);
+            qDebug() << "DLTCan: Adapter supports cyclic messages" << count;
+            if(scheduler)
+                scheduler->setFirmwareCount(count);
+        }
+        break;
+    case DLTCanDecoder::TypeFilter:
+        // programmed acceptance mask or filter, the last filter completes the configuration
+        if(record.frame.dlc==5)
+        {
+            int index = record.frame.id;
+            bool extended = record.frame.data[0] & CAN_FRAME_FLAG_EXTENDED;
+            quint32 value = ((quint32)record.frame.data[1]<<24) | ((quint32)record.frame.data[2]<<16) |
+                            ((quint32)record.frame.data[3]<<8) | record.frame.data[4];
+            if(index<DLT_CAN_FILTER_HARDWARE_MASKS)
+            {
+                filterReported.maskExtended[index] = extended;
+                filterReported.mask[index] = value;
+            }
+            else if(index<DLT_CAN_FILTER_HARDWARE_MASKS+DLT_CAN_FILTER_HARDWARE_FILTERS)
+            {
+                filterReported.filterExtended[index-DLT_CAN_FILTER_HARDWARE_MASKS] = extended;
+                filterReported.filter[index-DLT_CAN_FILTER_HARDWARE_MASKS] = value;
+                if(index==DLT_CAN_FILTER_HARDWARE_MASKS+DLT_CAN_FILTER_HARDWARE_FILTERS-1)
+                {
+                    qDebug() << "DLTCan: Adapter" << filterReported.toString();
+                    status(filterReported.toString());
+                }
+            }
+        }
+        break;
+    case DLTCanDecoder::TypeFilterError:
+        // acceptance configuration could not be programmed
+        qDebug() << "DLTCan: Filter error";
+        status("filter error");
+        break;
+    case DLTCanDecoder::TypeLinkAck:
+        // link speed acknowledge
+        if(linkState==LinkRequested)
+        {
+            int ackBaudRate = (int)(((quint32)record.frame.data[0]<<24) | ((quint32)record.frame.data[1]<<16) |
+                                    ((quint32)record.frame.data[2]<<8) | record.frame.data[3]);
+            if(record.frame.dlc!=4 || ackBaudRate!=baudRate)
+            {
+                qDebug() << "DLTCan: Link speed acknowledge invalid" << ackBaudRate;
+                fallbackLink();
+                break;
+            }
+
+            // adapter has already switched, follow and confirm with new baud rate,
+            // data read after the acknowledge was sent with the new baud rate and is discarded
+            serialPort.setBaudRate(baudRate);
+            linkBaudRate = baudRate;
+            decoder.reset();
+            linkDiscard = true;
+
+            const char msg[2] = { 0x7f, (char)0x91 };
+            serialPort.write(msg,sizeof(msg));
+
+            linkState = LinkSwitched;
+            timerLink.start(DLT_CAN_LINK_TIMEOUT);
+        }
+        break;
+    case DLTCanDecoder::TypeLinkOk:
+        // link speed confirmed
+        if(linkState==LinkSwitched)
+        {
+            timerLink.stop();
+            linkState = LinkDone;
+            linkBaudRateNegotiated = linkBaudRate;
+            qDebug() << "DLTCan: Link speed" << linkBaudRate;
+            status(QString("link %1").arg(linkBaudRate));
+            writePending();
+        }
+        break;
+    case DLTCanDecoder::TypeLinkError:
+        // link speed not supported by adapter
+        qDebug() << "DLTCan: Link speed not supported" << baudRate;
+        fallbackLink();
+        break;
+    }
+}
+
+void DLTCanCapture::requestCapabilities()
+{
+    // answered by the adapter with the old baud rate, before the link speed is switched
+    const char msg[2] = { 0x7f, (char)0x92 };
+    serialPort.write(msg,sizeof(msg));
+
+    // acceptance configuration is lost after a reset of the adapter
+    filterPending = false;
+    if(!filterData.isEmpty())
+        serialPort.write(filterData);
+}
+
+void DLTCanCapture::requestLink()
+{
+    linkState = LinkDone;
+
+    requestCapabilities();
+
+    if(baudRate==DLT_CAN_BAUD_RATE_DEFAULT || baudRate<=0)
+        return;
+
+    // request baud rate
+    char msg[2+4*2];
+    serialPort.write(msg,encodeLink(baudRate,msg));
+
+    linkState = LinkRequested;
+    timerLink.start(DLT_CAN_LINK_TIMEOUT);
+}
+
+void DLTCanCapture::fallbackLink()
+{
+    timerLink.stop();
+    linkState = LinkDone;
+
+    // adapter falls back by itself, if it does not receive the confirmation
+    if(linkBaudRate!=DLT_CAN_BAUD_RATE_DEFAULT)
+    {
+        serialPort.setBaudRate(DLT_CAN_BAUD_RATE_DEFAULT);
+        linkBaudRate = DLT_CAN_BAUD_RATE_DEFAULT;
+        decoder.reset();
+    }
+
+    qDebug() << "DLTCan: Link speed fallback" << linkBaudRate;
+    status(QString("link %1").arg(linkBaudRate));
+
+    writePending();
+}
+
+void DLTCanCapture::timeoutLink()
+{
+    // no answer of adapter, e.g. firmware without link speed handshake
+    qDebug() << "DLTCan: Link speed handshake timeout";
+    fallbackLink();
+}
+
+void DLTCanCapture::timeout()
+{
+    // watchdog timeout
+
+    // report if consumer could not keep up
+    if(ring.getOverflowCounter()!=overflowCounterLast)
+    {
+        qDebug() << "DLTCan: Ring overflow" << ring.getOverflowCounter()-overflowCounterLast << "frames dropped";
+        overflowCounterLast = ring.getOverflowCounter();
+    }
+
+    // check if watchdog was triggered between last call
+    if(watchDogCounter!=watchDogCounterLast)
+    {
+        watchDogCounterLast = watchDogCounter;
+        status("started");
+    }
+    else
+    {
+        // no watchdog was received
+        qDebug() << "DLTCan: Watchdog expired try to reconnect" ;
+
+        // if serial port is open close serial port
+        closePort();
+        timerLink.stop();
+
+        // adapter might have been reset or still use the negotiated baud rate,
+        // so alternate between both on each retry
+        if(linkBaudRate!=DLT_CAN_BAUD_RATE_DEFAULT)
+        {
+            linkBaudRate = DLT_CAN_BAUD_RATE_DEFAULT;
+            linkState = LinkIdle;
+        }
+        else if(linkBaudRateNegotiated)
+        {
+            linkBaudRate = linkBaudRateNegotiated;
+            linkState = LinkDone;
+        }
+        else
+        {
+            linkState = LinkIdle;
+        }
+
+        // try to reopen serial port
+        if(openPort())
+        {
+            // retry was succesful
+            status("reconnect");
+            qDebug() << "DLTCan: reconnect" << interface;
+
+            // data held back by an interrupted handshake
+            writePending();
+        }
+        else
+        {
+            // retry failed
+            qDebug() << "DLTCan: Failed to open interface" << interface;
+            status("error");
+        }
+    }
+}
@@ -0,0 +1,164 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcancapture.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_CAPTURE_H
+#define DLT_CAN_CAPTURE_H
+
+#include <QObject>
+#include <QSerialPort>
+#include <QTimer>
+
+#include "dltcanbackend.h"
+#include "dltcanclocksync.h"
+#include "dltcandecoder.h"
+#include "dltcanfilter.h"
+
+class DLTCanScheduler;
+struct DLTCanCyclicMessage;
+
+// size of the receive buffer for the serial port
+#define DLT_CAN_READ_BUFFER_SIZE 4096
+
+// maximum number of decoded frames handled at once
+#define DLT_CAN_RECORDS 64
+
+// maximum number of CAN messages sent to the adapter in one batch
+#define DLT_CAN_BATCH_MAX 16
+
+// maximum size of an encoded batch, each byte after the command might be stuffed
+#define DLT_CAN_BATCH_BUFFER (2+2*(1+DLT_CAN_BATCH_MAX*(6+CAN_FRAME_MAX_DATA_CLASSIC)))
+
+// maximum number of cyclic messages uploaded to the adapter
+#define DLT_CAN_CYCLIC_TABLE_MAX 16
+
+// maximum size of an encoded cyclic table, each byte after the command might be stuffed
+#define DLT_CAN_CYCLIC_TABLE_BUFFER (2+2*(1+DLT_CAN_CYCLIC_TABLE_MAX*(10+CAN_FRAME_MAX_DATA_CLASSIC)))
+
+// maximum size of an encoded acceptance configuration, each byte after the command might be stuffed
+#define DLT_CAN_FILTER_BUFFER (2+2*(DLT_CAN_FILTER_HARDWARE_MASKS+DLT_CAN_FILTER_HARDWARE_FILTERS)*5)
+
+// baud rate after reset of the adapter, used until a higher baud rate is negotiated
+#define DLT_CAN_BAUD_RATE_DEFAULT 115200
+
+// timeout of each step of the link speed handshake in ms
+#define DLT_CAN_LINK_TIMEOUT 1000
+
+// maximum size of the data held back during the link speed handshake
+#define DLT_CAN_PENDING_MAX 65536
+
+/**
+ * Serial port and decoder of the Wemos CAN adapter, backend of DLTCan.
+ *
+ * The link starts with the default baud rate. After the adapter reports init ok
+ * or its first watchdog, a higher baud rate is requested. The adapter acknowledges
+ * and switches, the host follows and confirms with the new baud rate. If any step
+ * fails or times out, both sides fall back to the default baud rate.
+ *
+ * Together with the link speed the capabilities of the adapter are requested.
+ * Older firmware does not answer, then cyclic messages are sent by the host.
+ * The acceptance masks and filters of the MCP2515 are sent with each capabilities
+ * request and when they change, the adapter answers with the programmed values.
+ * Data written during the link speed handshake is held back until it is done.
+ */
+class DLTCanCapture : public DLTCanBackend
+{
+    Q_OBJECT
+public:
+    explicit DLTCanCapture(QObject *parent = nullptr);
+    ~DLTCanCapture();
+
+    // Encode up to DLT_CAN_BATCH_MAX messages into one batch for the adapter, a 0x7f is stuffed, returns the length
+    static int encodeMessages(const CanFrame *messages,int count,char *buffer);
+
+    // Encode up to DLT_CAN_CYCLIC_TABLE_MAX cyclic messages into a table for the adapter, a 0x7f is stuffed, returns the length
+    static int encodeCyclicTable(const DLTCanCyclicMessage *messages,int count,char *buffer);
+
+    // Encode the acceptance masks and filters of the MCP2515 for the adapter, a 0x7f is stuffed, returns the length
+    static int encodeFilter(const DLTCanFilterHardware &hardware,char *buffer);
+
+    // Encode the link speed request for the adapter, a 0x7f in the baud rate is stuffed, returns the length
+    static int encodeLink(int baudRate,char *buffer);
+
+    // Scheduler which gets the cyclic messages sent by the adapter
+    void setScheduler(DLTCanScheduler *scheduler) { this->scheduler = scheduler; }
+
+public slots:
+
+    void open(QString interface,int baudRate) override;
+    void close() override;
+    void sendFrames(QByteArray frames) override;
+
+    // Raw data in the protocol of the adapter
+    void write(QByteArray data);
+
+    // Encoded acceptance configuration, sent now and after each reset of the adapter
+    void setFilter(QByteArray data);
+
+private slots:
+
+    void readyRead();
+
+    // Watchdog Timeout
+    void timeout();
+
+    // Link speed handshake timeout
+    void timeoutLink();
+
+private:
+
+    bool openPort();
+    void closePort();
+    void record(const DLTCanDecoder::Record &record,quint64 timestamp);
+
+    void requestCapabilities();
+    void requestLink();
+    void fallbackLink();
+    bool writeLink(const char *data,int length);
+    void writePending();
+
+    enum LinkState
+    {
+        LinkIdle = 0,   // default baud rate, not negotiated yet
+        LinkRequested,  // waiting for acknowledge of adapter
+        LinkSwitched,   // switched, waiting for confirmation of adapter
+        LinkDone        // negotiated or fallen back
+    };
+
+    QSerialPort serialPort;
+    QTimer timer;
+    QTimer timerLink;
+    unsigned int watchDogCounter,watchDogCounterLast;
+
+    QString interface;
+    int baudRate;
+    int linkBaudRate;
+    int linkBaudRateNegotiated;
+    LinkState linkState;
+    bool linkDiscard;       // rest of the read data is not valid after the baud rate was switched
+
+    DLTCanDecoder decoder;
+    DLTCanClockSync clockSync;
+    DLTCanScheduler *scheduler;
+    QByteArray filterData;
+    bool filterPending;     // changed during the link speed handshake
+    QByteArray pendingData; // written during the link speed handshake
+    DLTCanFilterHardware filterReported;
+    unsigned char readBuffer[DLT_CAN_READ_BUFFER_SIZE];
+    DLTCanDecoder::Record records[DLT_CAN_RECORDS];
+    char batchBuffer[DLT_CAN_BATCH_BUFFER];
+
+    unsigned int overflowCounterLast;
+};
+
+#endif // DLT_CAN_CAPTURE_H
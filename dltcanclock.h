@@ -0,0 +1,44 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanclock.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_CLOCK_H
+#define DLT_CAN_CLOCK_H
+
+#include <QtGlobal>
+
+#include <chrono>
+
+/**
+ * Monotonic clock used for all frame timestamps.
+ *
+ * The reference is the system start, like the timestamp of an ECU in DLT.
+ */
+class DLTCanClock
+{
+public:
+
+    // current time in nanoseconds
+    static quint64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // convert nanoseconds into DLT timestamp with 0.1ms resolution
+    static quint32 toDltTimestamp(quint64 timestamp)
+    {
+        return (quint32)(timestamp/100000);
+    }
+};
+
+#endif // DLT_CAN_CLOCK_H
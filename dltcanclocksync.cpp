@@ -0,0 +1,101 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanclocksync.cpp
+ * @licence end@
+ */
+
+#include "dltcanclocksync.h"
+
+DLTCanClockSync::DLTCanClockSync()
+{
+    reset();
+}
+
+void DLTCanClockSync::reset()
+{
+    count = 0;
+    next = 0;
+    deviceLast = 0;
+    deviceLastUnwrapped = 0;
+    deviceReference = 0;
+    hostReference = 0;
+    intercept = 0;
+    slope = 1000.0;
+}
+
+qint64 DLTCanClockSync::unwrap(quint32 deviceTimestamp) const
+{
+    // signed difference, so times shortly before the last sample are also valid
+    return deviceLastUnwrapped + (qint32)(deviceTimestamp-deviceLast);
+}
+
+void DLTCanClockSync::addSample(quint32 deviceTimestamp,quint64 hostTimestamp)
+{
+    if(count>0 && (qint32)(deviceTimestamp-deviceLast)<=0)
+    {
+        // adapter clock went backwards, adapter was reset
+        reset();
+    }
+
+    qint64 device = count>0 ? unwrap(deviceTimestamp) : deviceTimestamp;
+
+    deviceLast = deviceTimestamp;
+    deviceLastUnwrapped = device;
+
+    deviceSamples[next] = device;
+    hostSamples[next] = hostTimestamp;
+    next = (next+1)%DLT_CAN_CLOCK_SYNC_SAMPLES;
+    if(count<DLT_CAN_CLOCK_SYNC_SAMPLES)
+        count++;
+
+    fit();
+}
+
+void DLTCanClockSync::fit()
+{
+    // oldest sample is the reference, so doubles keep the precision
+    int first = (next-count+DLT_CAN_CLOCK_SYNC_SAMPLES)%DLT_CAN_CLOCK_SYNC_SAMPLES;
+    deviceReference = deviceSamples[first];
+    hostReference = hostSamples[first];
+
+    double sumX = 0, sumY = 0;
+    for(int num=0;num<count;num++)
+    {
+        int index = (first+num)%DLT_CAN_CLOCK_SYNC_SAMPLES;
+        sumX += (double)(deviceSamples[index]-deviceReference);
+        sumY += (double)(qint64)(hostSamples[index]-hostReference);
+    }
+    double meanX = sumX/count;
+    double meanY = sumY/count;
+
+    double sumXX = 0, sumXY = 0;
+    for(int num=0;num<count;num++)
+    {
+        int index = (first+num)%DLT_CAN_CLOCK_SYNC_SAMPLES;
+        double x = (double)(deviceSamples[index]-deviceReference) - meanX;
+        double y = (double)(qint64)(hostSamples[index]-hostReference) - meanY;
+        sumXX += x*x;
+        sumXY += x*y;
+    }
+
+    // ns per us, limited as a short window with latency jitter gives a noisy slope
+    slope = sumXX>0 ? sumXY/sumXX : 1000.0;
+    slope = qBound(1000.0-DLT_CAN_CLOCK_SYNC_MAX_DRIFT/1000.0,slope,1000.0+DLT_CAN_CLOCK_SYNC_MAX_DRIFT/1000.0);
+
+    intercept = meanY - slope*meanX;
+}
+
+quint64 DLTCanClockSync::toHost(quint32 deviceTimestamp) const
+{
+    double x = (double)(unwrap(deviceTimestamp)-deviceReference);
+
+    return hostReference + (qint64)(intercept + slope*x);
+}
@@ -0,0 +1,76 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanclocksync.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_CLOCK_SYNC_H
+#define DLT_CAN_CLOCK_SYNC_H
+
+#include <QtGlobal>
+
+// number of watchdog samples used for the fit, about one minute
+#define DLT_CAN_CLOCK_SYNC_SAMPLES 64
+
+// maximum accepted drift between adapter and host clock in ppm
+#define DLT_CAN_CLOCK_SYNC_MAX_DRIFT 500
+
+/**
+ * Conversion of the adapter clock (micros() of the firmware) into the host clock.
+ *
+ * Offset and drift are estimated by a linear fit over the last pairs of
+ * adapter and host time, taken from the timestamped watchdog messages.
+ * The host time of a sample contains the USB and serial latency, the fit
+ * averages its jitter, so the distance between frames gets the precision
+ * of the adapter clock.
+ */
+class DLTCanClockSync
+{
+public:
+    DLTCanClockSync();
+
+    void reset();
+
+    // Add adapter time in us and host time in ns of the same event
+    void addSample(quint32 deviceTimestamp,quint64 hostTimestamp);
+
+    // At least one sample was added, so toHost() can be used
+    bool isValid() const { return count>0; }
+
+    // Convert adapter time in us into host time in ns
+    quint64 toHost(quint32 deviceTimestamp) const;
+
+    // Drift of the adapter clock against the host clock in ppm
+    double getDrift() const { return (1000.0/slope-1.0)*1000000.0; }
+
+private:
+
+    // extend 32 bit adapter time, which wraps after about 71 minutes
+    qint64 unwrap(quint32 deviceTimestamp) const;
+
+    void fit();
+
+    qint64 deviceSamples[DLT_CAN_CLOCK_SYNC_SAMPLES];
+    quint64 hostSamples[DLT_CAN_CLOCK_SYNC_SAMPLES];
+    int count;
+    int next;
+
+    quint32 deviceLast;
+    qint64 deviceLastUnwrapped;
+
+    // host = hostReference + intercept + slope * (device - deviceReference)
+    qint64 deviceReference;
+    quint64 hostReference;
+    double intercept;
+    double slope;
+};
+
+#endif // DLT_CAN_CLOCK_SYNC_H
@@ -0,0 +1,595 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcancontroller.cpp
+ * @licence end@
+ */
+
+#include "dltcancontroller.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QVector>
+
+#include <stdio.h>
+#include <string.h>
+
+DLTCanController::DLTCanController(QObject *parent) : QObject(parent)
+    , candumpWriter(DLTCanLogWriter::FormatCandump)
+    , ascWriter(DLTCanLogWriter::FormatAsc)
+{
+    started = false;
+    msgCounter = 0;
+    dbcCounter = 0;
+
+    // clear settings
+    clearSettings();
+
+    // all DLT messages are also recorded
+    dltMiniServer.setRecorder(&dltCanRecorder);
+
+    // connect status slots
+    connect(&dltCan, SIGNAL(status(QString)), this, SLOT(statusCan(QString)));
+    connect(&dltMiniServer, SIGNAL(injection(QString)), this, SLOT(injection(QString)));
+
+    connect(&timerStatistics, SIGNAL(timeout()), this, SLOT(printStatistics()));
+    connect(&timerDelta, SIGNAL(timeout()), this, SLOT(reportDelta()));
+}
+
+DLTCanController::~DLTCanController()
+{
+    stop();
+
+    merge.setChannelCount(1);
+    updateChannels();
+
+    // disconnect all slots
+    disconnect(&dltCan, SIGNAL(status(QString)), this, SLOT(statusCan(QString)));
+    disconnect(&dltMiniServer, SIGNAL(injection(QString)), this, SLOT(injection(QString)));
+
+    disconnect(&timerStatistics, SIGNAL(timeout()), this, SLOT(printStatistics()));
+    disconnect(&timerDelta, SIGNAL(timeout()), this, SLOT(reportDelta()));
+}
+
+void DLTCanController::updateChannels()
+{
+    // channels are only created or removed while stopped
+    while(channels.size()>merge.getChannelCount()-1)
+    {
+        DLTCan *channel = channels.takeLast();
+        disconnect(channel, SIGNAL(status(QString)), this, SLOT(statusCan(QString)));
+        delete channel;
+    }
+
+    while(channels.size()<merge.getChannelCount()-1)
+    {
+        DLTCan *channel = new DLTCan();
+        channel->setChannel(channels.size()+1);
+        channel->clearSettings();
+        connect(channel, SIGNAL(status(QString)), this, SLOT(statusCan(QString)));
+        channels.append(channel);
+    }
+}
+
+void DLTCanController::clearSettings()
+{
+    if(!started)
+    {
+        merge.clearSettings();
+        updateChannels();
+    }
+
+    dltCan.clearSettings();
+    for(int num=0;num<channels.size();num++)
+        channels[num]->clearSettings();
+    dltMiniServer.clearSettings();
+    dltMiniServer.setContextId("CAN");
+    dltCanRecorder.clearSettings();
+    candumpWriter.clearSettings();
+    ascWriter.clearSettings();
+    dltCan.getReplay().clearSettings();
+    dbc.clearSettings();
+    delta.clearSettings();
+}
+
+void DLTCanController::writeSettings(QXmlStreamWriter &xml)
+{
+    merge.writeSettings(xml);
+    dltCan.writeSettings(xml);
+    for(int num=0;num<channels.size();num++)
+        channels[num]->writeSettings(xml);
+    dltMiniServer.writeSettings(xml);
+    dltCanRecorder.writeSettings(xml);
+    candumpWriter.writeSettings(xml);
+    ascWriter.writeSettings(xml);
+    dltCan.getReplay().writeSettings(xml);
+    dbc.writeSettings(xml);
+    delta.writeSettings(xml);
+}
+
+void DLTCanController::readSettings(const QString &filename)
+{
+    if(!started)
+    {
+        merge.readSettings(filename);
+        updateChannels();
+    }
+
+    dltCan.readSettings(filename);
+    for(int num=0;num<channels.size();num++)
+        channels[num]->readSettings(filename);
+    dltMiniServer.readSettings(filename);
+    dltCanRecorder.readSettings(filename);
+    candumpWriter.readSettings(filename);
+    ascWriter.readSettings(filename);
+    dltCan.getReplay().readSettings(filename);
+    dbc.readSettings(filename);
+    delta.readSettings(filename);
+}
+
+bool DLTCanController::saveSettings(const QString &filename)
+{
+    // write the settings into XML file
+    QFile file(filename);
+    if (!file.open(QFile::WriteOnly | QFile::Text))
+    {
+        // Cannot open the file for writing
+        return false;
+    }
+
+    QXmlStreamWriter xml(&file);
+    xml.setAutoFormatting(true);
+
+    // FIXME: Cannot read data from XML file, which contains a start document
+    // So currently do not call StartDocument
+    //xml.writeStartDocument();
+
+    xml.writeStartElement("DLTCanSettings");
+        writeSettings(xml);
+    xml.writeEndElement(); // DLTCanSettings
+
+    // FIXME: Cannot read data from XML file, which contains a end document
+    // So currently do not call EndDocument
+    //xml.writeEndDocument();
+    file.close();
+
+    return true;
+}
+
+void DLTCanController::start()
+{
+    if(started)
+        return;
+
+    // start recording before the first message is sent
+    dltCanRecorder.setEcuId(dltMiniServer.getEcuId());
+    dltCanRecorder.start();
+    candumpWriter.start();
+    ascWriter.start();
+
+    // compile the signals before the first frame is received
+    dbcCounter = 0;
+    if(dbc.getActive())
+        dbc.load(dbc.getFileName());
+
+    // delta mode forwards only changed frames into DLT
+    if(delta.isActive())
+    {
+        delta.start();
+        if(delta.getReportInterval()>0)
+            timerDelta.start(delta.getReportInterval());
+    }
+
+    // each channel gets its own context ID
+    for(int num=0;num<getChannelCount();num++)
+        dltMiniServer.setChannelContextId(num,getChannel(num).getContextId());
+
+    // start CAN and DLT communication
+    dltCan.start();
+    for(int num=0;num<channels.size();num++)
+        channels[num]->start();
+    dltMiniServer.start();
+
+    msgCounter = 0;
+    if(channels.isEmpty())
+    {
+        connect(&dltCan, SIGNAL(frames(const CanFrame*,int)), this, SLOT(frames(const CanFrame*,int)));
+    }
+    else
+    {
+        // frames of all channels are forwarded in timestamp order
+        merge.start();
+        connect(&merge, SIGNAL(frames(const CanFrame*,int)), this, SLOT(frames(const CanFrame*,int)));
+        for(int num=0;num<getChannelCount();num++)
+            connect(&getChannel(num), SIGNAL(frames(const CanFrame*,int)), &merge, SLOT(push(const CanFrame*,int)));
+    }
+
+    started = true;
+}
+
+void DLTCanController::stop()
+{
+    if(!started)
+        return;
+
+    if(channels.isEmpty())
+    {
+        disconnect(&dltCan, SIGNAL(frames(const CanFrame*,int)), this, SLOT(frames(const CanFrame*,int)));
+    }
+    else
+    {
+        for(int num=0;num<getChannelCount();num++)
+            disconnect(&getChannel(num), SIGNAL(frames(const CanFrame*,int)), &merge, SLOT(push(const CanFrame*,int)));
+
+        // forward the frames still held for sorting
+        merge.stop();
+        disconnect(&merge, SIGNAL(frames(const CanFrame*,int)), this, SLOT(frames(const CanFrame*,int)));
+    }
+
+    // report the last suppressed frames before DLT is stopped
+    if(delta.isActive())
+    {
+        timerDelta.stop();
+        reportDelta();
+        delta.stop();
+    }
+
+    // stop CAN and DLT communication
+    dltCan.stop();
+    for(int num=0;num<channels.size();num++)
+        channels[num]->stop();
+    dltMiniServer.stop();
+
+    // write all remaining messages
+    dltCanRecorder.stop();
+    candumpWriter.stop();
+    ascWriter.stop();
+
+    dbc.unload();
+
+    started = false;
+}
+
+void DLTCanController::setStatisticsInterval(int interval)
+{
+    if(interval>0)
+        timerStatistics.start(interval);
+    else
+        timerStatistics.stop();
+}
+
+void DLTCanController::printStatistics()
+{
+    fprintf(stdout,"DLTCan: frames %u overflow %u errors %u clients %d writes %llu bytes %llu\n",
+            getMsgCounter(),dltCan.getOverflowCounter(),dltCan.getErrorCounter(),dltMiniServer.getClientCount(),
+            (unsigned long long)dltMiniServer.getWriteCount(),(unsigned long long)dltMiniServer.getWriteBytes());
+
+    for(int num=0;num<channels.size();num++)
+    {
+        fprintf(stdout,"DLTCan: channel %d %s overflow %u errors %u bytes %llu\n",
+                num+2,channels[num]->getInterface().toLocal8Bit().constData(),channels[num]->getOverflowCounter(),
+                channels[num]->getErrorCounter(),(unsigned long long)channels[num]->getByteCounter());
+    }
+
+    if(!channels.isEmpty())
+    {
+        fprintf(stdout,"DLTCan: merge frames %llu late %llu forced %llu window %d ms\n",
+                (unsigned long long)merge.getFrameCounter(),(unsigned long long)merge.getLateCounter(),
+                (unsigned long long)merge.getForcedCounter(),merge.getReorderWindow());
+    }
+
+    if(dltCanRecorder.isRecording())
+    {
+        fprintf(stdout,"DLTCan: recorder messages %llu bytes %llu files %u dropped %llu errors %u file %s\n",
+                (unsigned long long)dltCanRecorder.getMessageCounter(),(unsigned long long)dltCanRecorder.getWrittenBytes(),
+                dltCanRecorder.getFileCounter(),(unsigned long long)dltCanRecorder.getDroppedMessages(),dltCanRecorder.getErrorCounter(),
+                dltCanRecorder.getFileName().toLocal8Bit().constData());
+    }
+
+    const DLTCanLogWriter *writers[] = { &candumpWriter, &ascWriter };
+    for(int num=0;num<2;num++)
+    {
+        if(!writers[num]->isRecording())
+            continue;
+
+        fprintf(stdout,"DLTCan: %s frames %llu bytes %llu files %u dropped %llu errors %u file %s\n",
+                writers[num]->getFormat()==DLTCanLogWriter::FormatAsc ? "asc" : "candump",
+                (unsigned long long)writers[num]->getFrameCounter(),(unsigned long long)writers[num]->getWrittenBytes(),
+                writers[num]->getFileCounter(),(unsigned long long)writers[num]->getDroppedFrames(),writers[num]->getErrorCounter(),
+                writers[num]->getFileName().toLocal8Bit().constData());
+    }
+
+    if(delta.isActive())
+    {
+        fprintf(stdout,"DLTCan: delta ids %d forwarded %llu suppressed %llu keyframes %llu keyframe interval %d ms\n",
+                delta.getCount(),(unsigned long long)delta.getForwardedCounter(),(unsigned long long)delta.getSuppressedCounter(),
+                (unsigned long long)delta.getKeyframeCounter(),delta.getKeyframeInterval());
+    }
+
+    if(dbc.isLoaded())
+    {
+        fprintf(stdout,"DLTCan: dbc decoded %llu messages %d signals %d errors %d file %s\n",
+                (unsigned long long)dbcCounter,dbc.getMessageCount(),dbc.getSignalCount(),dbc.getErrorCounter(),
+                dbc.getFileName().toLocal8Bit().constData());
+    }
+
+    const DLTCanFilter &filter = dltCan.getFilter();
+    if(filter.isActive())
+    {
+        fprintf(stdout,"DLTCan: filter filtered %llu not matched accepted %llu rejected %llu\n",
+                (unsigned long long)filter.getFilteredCounter(),(unsigned long long)filter.getAcceptedCounter(),(unsigned long long)filter.getRejectedCounter());
+        for(int index=0;index<filter.getCount();index++)
+        {
+            fprintf(stdout,"DLTCan: filter %d %s hits %llu\n",index+1,filter.toString(index).toLatin1().constData(),
+                    (unsigned long long)filter.getRule(index).hitCounter);
+        }
+    }
+
+    const DLTCanReplay &replay = dltCan.getReplay();
+    if(replay.isRunning() || replay.getFrameCounter()>0)
+    {
+        fprintf(stdout,"DLTCan: replay %s frames %llu filtered %llu errors %llu loops %u progress %d%% rate %.1f frames/s timing error avg %llu max %llu us\n",
+                replay.isRunning() ? "running" : "stopped",(unsigned long long)replay.getFrameCounter(),(unsigned long long)replay.getFilteredCounter(),
+                (unsigned long long)replay.getErrorCounter(),replay.getLoopCounter(),replay.getProgress(),replay.getRate(),
+                (unsigned long long)replay.getTimingErrorAverage()/1000,(unsigned long long)replay.getTimingErrorMax()/1000);
+    }
+
+    const DLTCanScheduler &scheduler = dltCan.getScheduler();
+    for(int index=0;index<scheduler.getCount();index++)
+    {
+        DLTCanCyclicMessage cyclicMessage = scheduler.getMessage(index);
+        if(!cyclicMessage.active)
+            continue;
+
+        fprintf(stdout,"DLTCan: cyclic %d %s id %x period %d ms sent %llu missed %llu period avg %llu min %llu max %llu us jitter avg %llu max %llu us\n",
+                index+1,index<scheduler.getFirmwareCount() ? "adapter" : "host",cyclicMessage.id,cyclicMessage.period,
+                (unsigned long long)cyclicMessage.sendCounter,(unsigned long long)cyclicMessage.missedCounter,
+                (unsigned long long)cyclicMessage.getPeriodAverage()/1000,(unsigned long long)cyclicMessage.periodMin/1000,(unsigned long long)cyclicMessage.periodMax/1000,
+                (unsigned long long)cyclicMessage.getJitterAverage()/1000,(unsigned long long)cyclicMessage.jitterMax/1000);
+
+        fprintf(stdout,"DLTCan: cyclic %d jitter",index+1);
+        for(int bucket=0;bucket<DLT_CAN_SCHEDULER_HISTOGRAM;bucket++)
+        {
+            if(bucket<DLT_CAN_SCHEDULER_HISTOGRAM-1)
+                fprintf(stdout," <%llu us %llu",(unsigned long long)DLTCanScheduler::getHistogramLimit(bucket)/1000,(unsigned long long)cyclicMessage.jitterHistogram[bucket]);
+            else
+                fprintf(stdout," more %llu",(unsigned long long)cyclicMessage.jitterHistogram[bucket]);
+        }
+        fprintf(stdout,"\n");
+    }
+
+    fflush(stdout);
+}
+
+void DLTCanController::frames(const CanFrame *frames,int count)
+{
+    candumpWriter.writeFrames(frames,count);
+    ascWriter.writeFrames(frames,count);
+
+    if(delta.isActive())
+    {
+        // forward the runs of changed frames without copying
+        int first = 0;
+        for(int num=0;num<count;num++)
+        {
+            if(!delta.forward(frames[num]))
+            {
+                sendFrames(frames+first,num-first);
+                first = num+1;
+            }
+        }
+        sendFrames(frames+first,count-first);
+    }
+    else
+    {
+        sendFrames(frames,count);
+    }
+
+    unsigned int received = 0;
+    for(int num=0;num<count;num++)
+    {
+        if(!frames[num].isTx())
+            received++;
+    }
+    msgCounter.fetch_add(received,std::memory_order_relaxed);
+}
+
+void DLTCanController::sendFrames(const CanFrame *frames,int count)
+{
+    if(count<=0)
+        return;
+
+    dltMiniServer.sendFrames(frames,count);
+
+    if(dbc.isLoaded() && dltMiniServer.isSending())
+    {
+        for(int num=0;num<count;num++)
+        {
+            int arguments = 0;
+            int length = dbc.decode(frames[num],dbcArguments,&arguments);
+            if(length>0)
+            {
+                dltMiniServer.sendArguments(dbcArguments,length,arguments,frames[num].timestamp,dbc.getContextIdData());
+                dbcCounter++;
+            }
+        }
+    }
+}
+
+void DLTCanController::reportDelta()
+{
+    // suppressed frames of each id since the last report, so nothing is hidden
+    for(int index=0;index<delta.getCount();index++)
+    {
+        quint64 suppressed = delta.takeSuppressed(index);
+        if(suppressed==0)
+            continue;
+
+        const DLTCanDeltaEntry &entry = delta.getEntry(index);
+        dltMiniServer.sendValue3("delta",QString("%1 %2").arg(entry.channel+1).arg(entry.id,0,16),
+                                 QString("suppressed %1 forwarded %2").arg(suppressed).arg(entry.forwardedCounter));
+    }
+}
+
+void DLTCanController::statusCan(QString text)
+{
+    // forward status of CAN communication into DLT
+    if(text!="send ok" && text!="started")
+        dltMiniServer.sendValue(text);
+}
+
+void DLTCanController::injection(QString text)
+{
+    QStringList list = text.split(' ');
+
+    qDebug() << "Injection received: " << text;
+
+    if(list[0] == "CAN" && list.size()>3)
+    {
+        // several messages are sent as one batch
+        QVector<CanFrame> messages;
+        for(int num=1;num+1<list.size();num+=2)
+        {
+            CanFrame frame;
+            memset(&frame,0,sizeof(frame));
+            frame.id = list[num].toUInt(nullptr,16) & CAN_FRAME_ID_MASK;
+            if(frame.id>0x7ff)
+                frame.flags = CAN_FRAME_FLAG_EXTENDED;
+            QByteArray data = QByteArray::fromHex(list[num+1].toLatin1());
+            frame.dlc = qMin(data.length(),CAN_FRAME_MAX_DATA_CLASSIC);
+            memcpy(frame.data,data.constData(),frame.dlc);
+            messages.append(frame);
+        }
+        dltCan.sendMessages(messages.constData(),messages.size());
+    }
+    else if(list[0] == "CAN")
+    {
+        unsigned short id = list[1].toUShort(nullptr,16);
+        QByteArray data = QByteArray::fromHex(list[2].toLatin1());
+        dltCan.sendMessage(id,(unsigned char*)data.data(),data.length());
+    }
+    else if(list[0].startsWith("CANCYC") && list.size()>1)
+    {
+        // CANCYC<n> with n starting at 1
+        int index = list[0].mid(6).toInt()-1;
+        if(index<0)
+            return;
+
+        if(list[1]=="off")
+        {
+            dltCan.stopCyclicMessage(index);
+        }
+        else if(list.size()>3)
+        {
+            int time = list[1].toInt();
+            unsigned int id = list[2].toUInt(nullptr,16);
+            QByteArray data = QByteArray::fromHex(list[3].toLatin1());
+
+            dltCan.setCyclicMessage(index,id,data);
+            dltCan.startCyclicMessage(index,time);
+        }
+
+        settingsChanged();
+    }
+    else if(list[0] == "CANFILTER" && list.size()>1)
+    {
+        DLTCanFilter &filter = dltCan.getFilter();
+
+        if((list[1]=="include" || list[1]=="exclude") && list.size()>2)
+        {
+            // CANFILTER include|exclude <id>|<first>-<last>|<id>/<mask> ...
+            for(int num=2;num<list.size();num++)
+            {
+                if(!filter.addRule(list[1]=="include",list[num]))
+                    qDebug() << "DLTCan: Invalid filter" << list[num];
+            }
+        }
+        else if(list[1]=="remove" && list.size()>2)
+        {
+            // CANFILTER remove <n> with n starting at 1
+            filter.removeRule(list[2].toInt()-1);
+        }
+        else if(list[1]=="clear")
+        {
+            filter.clear();
+        }
+        else if(list[1]=="on" || list[1]=="off")
+        {
+            filter.setActive(list[1]=="on");
+        }
+        else if(list[1]=="stats")
+        {
+            dltMiniServer.sendValue2("filtered",QString("%1").arg(filter.getFilteredCounter()));
+            for(int index=0;index<filter.getCount();index++)
+                dltMiniServer.sendValue2(filter.toString(index),QString("%1").arg(filter.getRule(index).hitCounter));
+            return;
+        }
+
+        // acceptance configuration of the adapter follows the include rules
+        if(started)
+            dltCan.applyFilter();
+
+        settingsChanged();
+    }
+    else if(list[0] == "CANREPLAY" && list.size()>1)
+    {
+        DLTCanReplay &replay = dltCan.getReplay();
+
+        if(list[1]=="start")
+        {
+            // CANREPLAY start [file], the file name may contain spaces
+            // the running replay is stopped before its settings are changed
+            dltCan.stopReplay();
+            if(list.size()>2)
+                replay.setFileName(list.mid(2).join(' '));
+            dltCan.startReplay();
+            return;
+        }
+        else if(list[1]=="stop")
+        {
+            dltCan.stopReplay();
+            return;
+        }
+        else if(list[1]=="stats")
+        {
+            dltMiniServer.sendValue2("frames",QString("%1").arg(replay.getFrameCounter()));
+            dltMiniServer.sendValue2("rate",QString("%1").arg(replay.getRate(),0,'f',1));
+            dltMiniServer.sendValue3("timing error us",QString("%1").arg(replay.getTimingErrorAverage()/1000),QString("%1").arg(replay.getTimingErrorMax()/1000));
+            return;
+        }
+        else if(list[1]=="speed" && list.size()>2)
+        {
+            // factor of the original timing, 0 as fast as possible
+            replay.setSpeed(list[2].toDouble());
+        }
+        else if(list[1]=="loop" && list.size()>2)
+        {
+            replay.setLoop(list[2]=="on");
+        }
+        else if((list[1]=="include" || list[1]=="exclude") && list.size()>2)
+        {
+            for(int num=2;num<list.size();num++)
+            {
+                if(!replay.getFilter().addRule(list[1]=="include",list[num]))
+                    qDebug() << "DLTCan: Invalid replay filter" << list[num];
+            }
+        }
+        else if(list[1]=="remove" && list.size()>2)
+        {
+            replay.getFilter().removeRule(list[2].toInt()-1);
+        }
+        else if(list[1]=="clear")
+        {
+            replay.getFilter().clear();
+        }
+
+        settingsChanged();
+    }
+}
@@ -0,0 +1,123 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcancontroller.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_CONTROLLER_H
+#define DLT_CAN_CONTROLLER_H
+
+#include <QObject>
+#include <QTimer>
+
+#include <atomic>
+
+#include "dltcan.h"
+#include "dltcandbc.h"
+#include "dltcandelta.h"
+#include "dltcanlogwriter.h"
+#include "dltcanmerge.h"
+#include "dltcanrecorder.h"
+#include "dltminiserver.h"
+
+/**
+ * Capture to DLT pipeline without any user interface.
+ *
+ * Starts and stops DLTCan, DLTMiniServer, DLTCanRecorder and the candump and
+ * ASC writers, forwards frames and status into DLT and executes DLT injections. Used by the dialog and by the
+ * headless mode.
+ *
+ * Additional channels are further DLTCan instances with their own interface and
+ * thread. With more than one channel the frames are merged in timestamp order.
+ *
+ * If a DBC file is active, the signals of each frame are sent as an additional
+ * verbose DLT message with physical values.
+ *
+ * In delta mode only changed frames and periodic keyframes are sent into DLT,
+ * the candump and ASC files still get all frames.
+ */
+class DLTCanController : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DLTCanController(QObject *parent = nullptr);
+    ~DLTCanController();
+
+    DLTCan &getDltCan() { return dltCan; }
+    DLTMiniServer &getDltMiniServer() { return dltMiniServer; }
+    DLTCanRecorder &getDltCanRecorder() { return dltCanRecorder; }
+    DLTCanLogWriter &getCandumpWriter() { return candumpWriter; }
+    DLTCanLogWriter &getAscWriter() { return ascWriter; }
+    DLTCanMerge &getMerge() { return merge; }
+    DLTCanDbc &getDbc() { return dbc; }
+    DLTCanDelta &getDelta() { return delta; }
+
+    // Capture channels, channel 0 is getDltCan()
+    int getChannelCount() { return channels.size()+1; }
+    DLTCan &getChannel(int index) { return index>0 ? *channels[index-1] : dltCan; }
+
+    void start();
+    void stop();
+    bool isStarted() { return started; }
+
+    void clearSettings();
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename);
+    bool saveSettings(const QString &filename);
+
+    // Number of received frames since start
+    unsigned int getMsgCounter() const { return msgCounter.load(std::memory_order_relaxed); }
+
+    // Print statistics to stdout every interval ms, 0 disables output
+    void setStatisticsInterval(int interval);
+
+signals:
+
+    // Settings were changed by a DLT injection
+    void settingsChanged();
+
+public slots:
+
+    void printStatistics();
+
+private slots:
+
+    void statusCan(QString text);
+    void injection(QString text);
+    void frames(const CanFrame *frames,int count);
+    void reportDelta();
+
+private:
+
+    DLTCan dltCan;
+    DLTMiniServer dltMiniServer;
+    DLTCanRecorder dltCanRecorder;
+    DLTCanLogWriter candumpWriter;
+    DLTCanLogWriter ascWriter;
+    QList<DLTCan*> channels;    // additional channels
+    DLTCanMerge merge;
+    DLTCanDbc dbc;
+    DLTCanDelta delta;
+
+    char dbcArguments[DLT_CAN_DBC_MAX_ARGUMENTS];
+    quint64 dbcCounter;
+
+    void updateChannels();
+    void sendFrames(const CanFrame *frames,int count);
+
+    bool started;
+    std::atomic<unsigned int> msgCounter;
+
+    QTimer timerStatistics;
+    QTimer timerDelta;
+};
+
+#endif // DLT_CAN_CONTROLLER_H
@@ -0,0 +1,537 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcandbc.cpp
+ * @licence end@
+ */
+
+#include "dltcandbc.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QRegularExpression>
+
+#include <stdio.h>
+#include <string.h>
+
+DLTCanDbc::DLTCanDbc(QObject *parent) : QObject(parent)
+{
+    errorCounter = 0;
+
+    clearSettings();
+}
+
+DLTCanDbc::~DLTCanDbc()
+{
+}
+
+void DLTCanDbc::setContextId(QString id)
+{
+    contextId = id;
+
+    // converted once, not for each frame
+    for(int num=0;num<4;num++)
+        contextIdData[num] = num<id.length()?id[num].toLatin1():0;
+}
+
+bool DLTCanDbc::isSelected(const QString &message,const QString &signal) const
+{
+    return selection.isEmpty() || selection.contains(message) || selection.contains(signal) ||
+           selection.contains(message+"."+signal);
+}
+
+void DLTCanDbc::unload()
+{
+    messages.clear();
+    signalList.clear();
+    standardMessages.clear();
+    extendedMessages.clear();
+    argumentHeaders.clear();
+    errorCounter = 0;
+}
+
+bool DLTCanDbc::load(const QString &fileName)
+{
+    // BO_ <id> <name>: <dlc> <transmitter>
+    static const QRegularExpression messageExpression("^BO_\\s+(\\d+)\\s+(\\w+)\\s*:\\s*(\\d+)");
+    // SG_ <name> [M|m<n>] : <start>|<length>@<order><sign> (<factor>,<offset>) [<min>|<max>] "<unit>" <receivers>
+    static const QRegularExpression signalExpression("^SG_\\s+(\\w+)\\s*(M|m\\d+M?)?\\s*:\\s*(\\d+)\\|(\\d+)@([01])([+-])\\s*"
+                                                     "\\(([^,]+),([^)]+)\\)\\s*\\[[^\\]]*\\]\\s*\"([^\"]*)\"");
+    // SIG_VALTYPE_ <id> <name> : <type>;
+    static const QRegularExpression valueTypeExpression("^SIG_VALTYPE_\\s+(\\d+)\\s+(\\w+)\\s*:\\s*(\\d)");
+
+    unload();
+
+    QFile file(fileName);
+    if(!file.open(QFile::ReadOnly | QFile::Text))
+    {
+        qDebug() << "DLTCanDbc: Cannot open" << fileName;
+        return false;
+    }
+
+    // parsed signals of each message, compiled at the end
+    QVector<DLTCanDbcMessage> parsedMessages;
+    QVector<QVector<DLTCanDbcSignal> > parsedSignals;
+    QVector<quint32> parsedIds;
+    QHash<QString,int> valueTypes;
+
+    while(!file.atEnd())
+    {
+        QString line = QString::fromLatin1(file.readLine()).trimmed();
+
+        if(line.startsWith("BO_ "))
+        {
+            QRegularExpressionMatch match = messageExpression.match(line);
+            if(!match.hasMatch())
+            {
+                errorCounter++;
+                continue;
+            }
+
+            // bit 31 marks 29 bit ids
+            quint32 rawId = match.captured(1).toUInt();
+            DLTCanDbcMessage message;
+            message.name = match.captured(2);
+            message.id = rawId & CAN_FRAME_ID_MASK;
+            message.extended = (rawId & 0x80000000) || message.id>0x7ff;
+            message.dlc = qMin(match.captured(3).toInt(),CAN_FRAME_MAX_DATA);
+            message.firstSignal = 0;
+            message.signalCount = 0;
+            message.multiplexor = -1;
+            message.argumentOffset = 0;
+            message.argumentLength = 0;
+            parsedMessages.append(message);
+            parsedSignals.append(QVector<DLTCanDbcSignal>());
+            parsedIds.append(rawId);
+        }
+        else if(line.startsWith("SG_ "))
+        {
+            QRegularExpressionMatch match = signalExpression.match(line);
+            if(!match.hasMatch() || parsedMessages.isEmpty())
+            {
+                errorCounter++;
+                continue;
+            }
+
+            DLTCanDbcSignal signal;
+            signal.name = match.captured(1);
+            signal.unit = match.captured(9);
+            signal.startBit = match.captured(3).toUInt();
+            signal.length = qBound(1,match.captured(4).toInt(),64);
+            signal.bigEndian = match.captured(5)=="0";
+            signal.isSigned = match.captured(6)=="-";
+            signal.valueType = 0;
+            signal.factor = match.captured(7).toDouble();
+            signal.offset = match.captured(8).toDouble();
+            signal.argumentOffset = 0;
+            signal.argumentLength = 0;
+
+            // multiplexor is marked with M, multiplexed signals with m<value>
+            QString multiplex = match.captured(2);
+            if(multiplex.startsWith("m"))
+                signal.multiplexValue = multiplex.mid(1).remove('M').toInt();
+            else if(multiplex=="M")
+                signal.multiplexValue = -2;
+            else
+                signal.multiplexValue = -1;
+
+            parsedSignals.last().append(signal);
+        }
+        else if(line.startsWith("SIG_VALTYPE_ "))
+        {
+            QRegularExpressionMatch match = valueTypeExpression.match(line);
+            if(match.hasMatch())
+                valueTypes.insert(match.captured(1)+" "+match.captured(2),match.captured(3).toInt());
+        }
+    }
+
+    file.close();
+
+    // compile the selected signals into flat lists
+    standardMessages.fill(-1,0x800);
+    for(int index=0;index<parsedMessages.size();index++)
+    {
+        DLTCanDbcMessage message = parsedMessages[index];
+        const QVector<DLTCanDbcSignal> &list = parsedSignals[index];
+
+        // pseudo message of signals not sent by any message
+        if(message.name=="VECTOR__INDEPENDENT_SIG_MSG")
+            continue;
+
+        message.firstSignal = signalList.size();
+        int multiplexor = -1;
+        for(int num=0;num<list.size();num++)
+        {
+            DLTCanDbcSignal signal = list[num];
+            signal.valueType = valueTypes.value(QString("%1 %2").arg(parsedIds[index]).arg(signal.name),0);
+            compile(signal);
+            if(signal.lastByte>=CAN_FRAME_MAX_DATA)
+            {
+                errorCounter++;
+                continue;
+            }
+
+            if(signal.multiplexValue==-2)
+            {
+                signal.multiplexValue = -1;
+                multiplexor = num;
+            }
+
+            if(!isSelected(message.name,signal.name) || message.signalCount>=DLT_CAN_DBC_MAX_SIGNALS)
+                continue;
+
+            appendArgumentHeader(signal.name,signal.unit,false,signal.argumentOffset,signal.argumentLength);
+            signalList.append(signal);
+            message.signalCount++;
+        }
+
+        if(message.signalCount==0)
+        {
+            // nothing selected, the message is not decoded
+            signalList.resize(message.firstSignal);
+            continue;
+        }
+
+        // multiplexor is decoded first, but only sent if it was selected
+        if(multiplexor>=0)
+        {
+            DLTCanDbcSignal signal = list[multiplexor];
+            signal.multiplexValue = -1;
+            compile(signal);
+            message.multiplexor = signalList.size();
+            signalList.append(signal);
+        }
+
+        appendArgumentHeader(message.name,QString(),true,message.argumentOffset,message.argumentLength);
+
+        if(message.extended)
+            extendedMessages.insert(message.id,messages.size());
+        else
+            standardMessages[message.id] = messages.size();
+        messages.append(message);
+    }
+
+    qDebug() << "DLTCanDbc: loaded" << fileName << "messages" << messages.size() << "signals" << signalList.size() << "errors" << errorCounter;
+
+    return true;
+}
+
+void DLTCanDbc::compile(DLTCanDbcSignal &signal)
+{
+    signal.mask = signal.length>=64 ? ~(quint64)0 : (((quint64)1<<signal.length)-1);
+    signal.byteOffset = signal.startBit/8;
+
+    if(signal.bigEndian)
+    {
+        // start bit is the most significant bit, bit 7 of a byte is sent first
+        int msbPosition = 7-signal.startBit%8;
+        signal.generic = msbPosition+signal.length>64;
+        signal.shift = signal.generic ? 0 : 64-msbPosition-signal.length;
+        signal.lastByte = signal.byteOffset+(msbPosition+signal.length-1)/8;
+    }
+    else
+    {
+        // start bit is the least significant bit
+        signal.shift = signal.startBit%8;
+        signal.generic = signal.shift+signal.length>64;
+        signal.lastByte = (signal.startBit+signal.length-1)/8;
+    }
+
+    // IEEE values need the full length
+    if((signal.valueType==1 && signal.length!=32) || (signal.valueType==2 && signal.length!=64))
+        signal.valueType = 0;
+}
+
+void DLTCanDbc::appendArgumentHeader(const QString &name,const QString &unit,bool isString,int &offset,int &length)
+{
+    QByteArray nameData = name.toLatin1();
+    QByteArray unitData = unit.toLatin1();
+
+    offset = argumentHeaders.size();
+
+    if(isString)
+    {
+        // Payload Type Info String, length of the data
+        argumentHeaders += (char)0x00;
+        argumentHeaders += (char)0x02;
+        argumentHeaders += (char)0x00;
+        argumentHeaders += (char)0x00;
+        argumentHeaders += (char)(nameData.length()&0xff);
+        argumentHeaders += (char)(nameData.length()>>8);
+        argumentHeaders += nameData;
+    }
+    else
+    {
+        // Payload Type Info float64 with name and unit, followed by the value
+        argumentHeaders += (char)0x84;
+        argumentHeaders += (char)0x08;
+        argumentHeaders += (char)0x00;
+        argumentHeaders += (char)0x00;
+        argumentHeaders += (char)((nameData.length()+1)&0xff);
+        argumentHeaders += (char)((nameData.length()+1)>>8);
+        argumentHeaders += (char)((unitData.length()+1)&0xff);
+        argumentHeaders += (char)((unitData.length()+1)>>8);
+        argumentHeaders += nameData;
+        argumentHeaders += (char)0x00;
+        argumentHeaders += unitData;
+        argumentHeaders += (char)0x00;
+    }
+
+    length = argumentHeaders.size()-offset;
+}
+
+quint64 DLTCanDbc::extractRaw(const DLTCanDbcSignal &signal,const quint8 *data)
+{
+    quint64 raw = 0;
+
+    if(!signal.generic)
+    {
+        const quint8 *bytes = data+signal.byteOffset;
+        if(signal.bigEndian)
+        {
+            for(int num=0;num<8;num++)
+                raw = (raw<<8)|bytes[num];
+        }
+        else
+        {
+            for(int num=7;num>=0;num--)
+                raw = (raw<<8)|bytes[num];
+        }
+        return (raw>>signal.shift)&signal.mask;
+    }
+
+    // long signals which are not aligned
+    int bit = signal.startBit;
+    if(signal.bigEndian)
+    {
+        for(int num=0;num<signal.length;num++)
+        {
+            raw = (raw<<1)|((data[bit/8]>>(bit%8))&1);
+            bit = (bit%8==0) ? bit+15 : bit-1;
+        }
+    }
+    else
+    {
+        for(int num=0;num<signal.length;num++,bit++)
+            raw |= (quint64)((data[bit/8]>>(bit%8))&1)<<num;
+    }
+
+    return raw;
+}
+
+double DLTCanDbc::extract(const DLTCanDbcSignal &signal,const quint8 *data)
+{
+    quint64 raw = extractRaw(signal,data);
+    double value;
+
+    if(signal.valueType==1)
+    {
+        quint32 bits = (quint32)raw;
+        float floatValue;
+        memcpy(&floatValue,&bits,sizeof(floatValue));
+        value = floatValue;
+    }
+    else if(signal.valueType==2)
+    {
+        memcpy(&value,&raw,sizeof(value));
+    }
+    else if(signal.isSigned)
+    {
+        // sign extension
+        if(signal.length<64 && (raw>>(signal.length-1))&1)
+            raw |= ~signal.mask;
+        value = (double)(qint64)raw;
+    }
+    else
+    {
+        value = (double)raw;
+    }
+
+    return value*signal.factor+signal.offset;
+}
+
+int DLTCanDbc::decode(const CanFrame &frame,char *arguments,int *count) const
+{
+    const DLTCanDbcMessage *message = find(frame);
+    if(!message)
+        return 0;
+
+    // 8 bytes beyond the payload can be loaded at once
+    quint8 data[CAN_FRAME_MAX_DATA+8];
+    int dlc = frame.dlc<=CAN_FRAME_MAX_DATA ? frame.dlc : CAN_FRAME_MAX_DATA;
+    memcpy(data,frame.data,dlc);
+    memset(data+dlc,0,sizeof(data)-dlc);
+
+    const char *headers = argumentHeaders.constData();
+
+    // Argument 1: message name
+    memcpy(arguments,headers+message->argumentOffset,message->argumentLength);
+    int pos = message->argumentLength;
+    int number = 1;
+
+    qint64 multiplexValue = -1;
+    if(message->multiplexor>=0 && signalList[message->multiplexor].lastByte<dlc)
+        multiplexValue = (qint64)extractRaw(signalList[message->multiplexor],data);
+
+    const DLTCanDbcSignal *signal = signalList.constData()+message->firstSignal;
+    for(int num=0;num<message->signalCount;num++,signal++)
+    {
+        // signals beyond the payload or of another multiplexer value are not sent
+        if(signal->lastByte>=dlc || (signal->multiplexValue>=0 && signal->multiplexValue!=multiplexValue))
+            continue;
+        if(pos+signal->argumentLength+8>DLT_CAN_DBC_MAX_ARGUMENTS)
+            break;
+
+        memcpy(arguments+pos,headers+signal->argumentOffset,signal->argumentLength);
+        pos += signal->argumentLength;
+
+        // float64 little endian
+        double value = extract(*signal,data);
+        quint64 bits;
+        memcpy(&bits,&value,sizeof(bits));
+        for(int byte=0;byte<8;byte++)
+            arguments[pos++] = (char)(bits>>(byte*8));
+        number++;
+    }
+
+    *count = number;
+
+    return pos;
+}
+
+bool DLTCanDbc::benchmark(const QString &fileName,int frames)
+{
+    DLTCanDbc dbc;
+    if(!dbc.load(fileName) || !dbc.isLoaded() || frames<=0)
+    {
+        fprintf(stderr,"DLTCan: No messages in DBC file %s\n",fileName.toLocal8Bit().constData());
+        return false;
+    }
+
+    // one frame of each message with a pseudo random payload
+    QVector<CanFrame> input(dbc.getMessageCount());
+    quint32 random = 12345;
+    for(int index=0;index<input.size();index++)
+    {
+        const DLTCanDbcMessage &message = dbc.getMessage(index);
+        CanFrame &frame = input[index];
+        memset(&frame,0,sizeof(frame));
+        frame.id = message.id;
+        frame.flags = message.extended ? CAN_FRAME_FLAG_EXTENDED : 0;
+        frame.dlc = message.dlc;
+        for(int num=0;num<frame.dlc;num++)
+        {
+            random = random*1103515245+12345;
+            frame.data[num] = (quint8)(random>>16);
+        }
+    }
+
+    char arguments[DLT_CAN_DBC_MAX_ARGUMENTS];
+    quint64 bytes = 0;
+    quint64 decodedSignals = 0;
+
+    quint64 start = DLTCanClock::now();
+    for(int num=0;num<frames;num++)
+    {
+        int count = 0;
+        bytes += dbc.decode(input[num%input.size()],arguments,&count);
+        decodedSignals += count>0 ? count-1 : 0;
+    }
+    quint64 duration = qMax(DLTCanClock::now()-start,(quint64)1);
+
+    double rate = (double)frames*1000000000.0/duration;
+    fprintf(stdout,"DLTCan: DBC %s messages %d signals %d errors %d\n",fileName.toLocal8Bit().constData(),
+            dbc.getMessageCount(),dbc.getSignalCount(),dbc.getErrorCounter());
+    fprintf(stdout,"DLTCan: decoded %d frames with %llu signals into %llu bytes in %.1f ms\n",frames,
+            (unsigned long long)decodedSignals,(unsigned long long)bytes,duration/1000000.0);
+    fprintf(stdout,"DLTCan: %.0f frames/s %.0f ns/frame, %.1f times a fully loaded 1 Mbit/s bus\n",
+            rate,(double)duration/frames,rate/DLT_CAN_DBC_FULL_LOAD);
+    fflush(stdout);
+
+    return true;
+}
+
+void DLTCanDbc::clearSettings()
+{
+    active = false;
+    fileName = "";
+    setContextId("SIG");
+    selection.clear();
+}
+
+void DLTCanDbc::writeSettings(QXmlStreamWriter &xml)
+{
+    /* Write project settings */
+    xml.writeStartElement("DLTCanDbc");
+        xml.writeTextElement("active",QString("%1").arg(active));
+        xml.writeTextElement("fileName",fileName);
+        xml.writeTextElement("contextId",contextId);
+        xml.writeTextElement("selection",selection.join(' '));
+    xml.writeEndElement(); // DLTCanDbc
+}
+
+void DLTCanDbc::readSettings(const QString &filename)
+{
+    bool isDLTCanDbc = false;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(isDLTCanDbc)
+              {
+                  /* Project settings */
+                  if(xml.name() == QString("active"))
+                  {
+                      active = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("fileName"))
+                  {
+                      fileName = xml.readElementText();
+                  }
+                  else if(xml.name() == QString("contextId"))
+                  {
+                      setContextId(xml.readElementText());
+                  }
+                  else if(xml.name() == QString("selection"))
+                  {
+                      selection = xml.readElementText().split(' ');
+                      selection.removeAll(QString()); // empty, if separated by several spaces
+                  }
+              }
+              else if(xml.name() == QString("DLTCanDbc"))
+              {
+                    isDLTCanDbc = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == QString("DLTCanDbc"))
+              {
+                    isDLTCanDbc = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+}
@@ -0,0 +1,176 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcandbc.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_DBC_H
+#define DLT_CAN_DBC_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include "canframe.h"
+
+// maximum size of the verbose arguments of one decoded message
+#define DLT_CAN_DBC_MAX_ARGUMENTS 4000
+
+// maximum number of arguments of one decoded message, the message name is the first
+#define DLT_CAN_DBC_MAX_SIGNALS 254
+
+// frames per second of a fully loaded 1 Mbit/s bus with 8 byte frames
+#define DLT_CAN_DBC_FULL_LOAD 9000
+
+// Extraction plan of one signal, compiled when the DBC file is loaded
+struct DLTCanDbcSignal
+{
+    QString name;
+    QString unit;
+
+    quint16 startBit;       // as in the DBC file
+    quint8 length;          // in bits
+    bool bigEndian;         // Motorola byte order
+    bool isSigned;
+    quint8 valueType;       // 0 integer, 1 float, 2 double
+    qint32 multiplexValue;  // -1 if the signal is always present
+
+    // raw value is (load 8 bytes at byteOffset >> shift) & mask
+    quint8 byteOffset;
+    quint8 shift;
+    quint8 lastByte;        // signal is skipped if the frame is shorter
+    bool generic;           // does not fit into 8 loaded bytes, extracted bit by bit
+    quint64 mask;
+
+    double factor;
+    double offset;
+
+    // encoded type info, name and unit of the DLT argument
+    int argumentOffset;
+    int argumentLength;
+};
+
+// Message with its signals, compiled when the DBC file is loaded
+struct DLTCanDbcMessage
+{
+    QString name;
+    quint32 id;
+    bool extended;
+    int dlc;
+
+    int firstSignal;        // index into the flat list of signals
+    int signalCount;
+    int multiplexor;        // index of the multiplexor signal, -1 if not multiplexed
+
+    // encoded message name, the first DLT argument
+    int argumentOffset;
+    int argumentLength;
+};
+
+/**
+ * Decoding of CAN signals with the definitions of a DBC file.
+ *
+ * When the file is loaded each message is compiled into a flat extraction
+ * plan of its selected signals: byte offset, shift and mask of the raw
+ * value, sign, factor and offset. The DLT type info, name and unit of each
+ * signal are encoded once. Messages are found by a table of all 11 bit ids
+ * and a hash of 29 bit ids, so decoding a frame needs no allocation.
+ *
+ * Each decoded frame is sent as one verbose DLT message: the message name,
+ * followed by one float64 argument with name and unit for each signal.
+ */
+class DLTCanDbc : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DLTCanDbc(QObject *parent = nullptr);
+    ~DLTCanDbc();
+
+    // Parse and compile the DBC file, returns false if the file cannot be read
+    bool load(const QString &fileName);
+    void unload();
+    bool isLoaded() const { return !messages.isEmpty(); }
+
+    // Active
+    bool getActive() { return active; }
+    void setActive(bool active) { this->active = active; }
+
+    QString getFileName() { return fileName; }
+    void setFileName(QString fileName) { this->fileName = fileName; }
+
+    // Context ID of the decoded messages
+    QString getContextId() { return contextId; }
+    void setContextId(QString id);
+    const char *getContextIdData() const { return contextIdData; }
+
+    // Selected messages and signals, "Message", "Signal" or "Message.Signal", empty selects all
+    QStringList getSelection() { return selection; }
+    void setSelection(QStringList selection) { this->selection = selection; }
+
+    int getMessageCount() const { return messages.size(); }
+    int getSignalCount() const { return signalList.size(); }
+    int getErrorCounter() const { return errorCounter; }
+    const DLTCanDbcMessage &getMessage(int index) const { return messages[index]; }
+    const DLTCanDbcSignal &getSignal(int index) const { return signalList[index]; }
+
+    // Message of the frame, 0 if not defined
+    const DLTCanDbcMessage *find(const CanFrame &frame) const
+    {
+        int index;
+        if(frame.isExtended())
+            index = extendedMessages.value(frame.id,-1);
+        else
+            index = frame.id<(quint32)standardMessages.size() ? standardMessages[frame.id] : -1;
+        return index>=0 ? &messages[index] : 0;
+    }
+
+    // Encode the verbose arguments of a frame, returns the length or 0 if the message is not defined
+    int decode(const CanFrame &frame,char *arguments,int *count) const;
+
+    // Raw value of a signal from a payload, which can be read 8 bytes beyond the last byte of the signal
+    static quint64 extractRaw(const DLTCanDbcSignal &signal,const quint8 *data);
+
+    // Physical value of a signal from a payload like extractRaw()
+    static double extract(const DLTCanDbcSignal &signal,const quint8 *data);
+
+    // Decode generated frames of all messages of a DBC file and print the throughput
+    static bool benchmark(const QString &fileName,int frames);
+
+    void clearSettings();
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename);
+
+private:
+
+    bool isSelected(const QString &message,const QString &signal) const;
+    void compile(DLTCanDbcSignal &signal);
+    void appendArgumentHeader(const QString &name,const QString &unit,bool isString,int &offset,int &length);
+
+    // Settings
+    bool active;
+    QString fileName;
+    QString contextId;
+    char contextIdData[4];
+    QStringList selection;
+
+    QVector<DLTCanDbcMessage> messages;
+    QVector<DLTCanDbcSignal> signalList;
+    QVector<int> standardMessages;          // index of message of each 11 bit id, -1 if not defined
+    QHash<quint32,int> extendedMessages;    // index of message of each 29 bit id
+    QByteArray argumentHeaders;
+    int errorCounter;
+};
+
+#endif // DLT_CAN_DBC_H
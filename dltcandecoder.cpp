@@ -0,0 +1,339 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcandecoder.cpp
+ * @licence end@
+ */
+
+#include "dltcandecoder.h"
+#include "dltcanclock.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// number of records decoded at once by the benchmark, like the capture
+#define DLT_CAN_DECODER_BENCHMARK_RECORDS 64
+
+// size of the chunks fed into the decoder by the benchmark, like a serial read
+#define DLT_CAN_DECODER_BENCHMARK_CHUNK 4096
+
+DLTCanDecoder::DispatchTable::DispatchTable()
+{
+    memset(entries,0,sizeof(entries));
+
+    // status messages without any further data
+    entries[0x00].type = TypeInitOk;
+    entries[0x01].type = TypeSendOk;
+    entries[0x02].type = TypeWatchdog;
+    entries[0x04].type = TypeLinkOk;
+    entries[0xfc].type = TypeFilterError;
+    entries[0xfd].type = TypeLinkError;
+    entries[0xfe].type = TypeSendError;
+    entries[0xff].type = TypeInitError;
+
+    // watchdog with timestamp
+    entries[0x06].type = TypeWatchdog;
+    entries[0x06].headerLength = 4;
+    entries[0x06].timestampLength = 4;
+
+    // CAN messages: length, id, payload
+    entries[0x80].type = TypeStandard;
+    entries[0x80].headerLength = 1+2;
+    entries[0x80].lengthLength = 1;
+    entries[0x81].type = TypeExtended;
+    entries[0x81].headerLength = 1+4;
+    entries[0x81].lengthLength = 1;
+    entries[0x81].flags = CAN_FRAME_FLAG_EXTENDED;
+
+    // CAN messages with timestamp: length, id, timestamp, payload
+    entries[0x83].type = TypeStandard;
+    entries[0x83].headerLength = 1+2+4;
+    entries[0x83].lengthLength = 1;
+    entries[0x83].timestampLength = 4;
+    entries[0x84].type = TypeExtended;
+    entries[0x84].headerLength = 1+4+4;
+    entries[0x84].lengthLength = 1;
+    entries[0x84].timestampLength = 4;
+    entries[0x84].flags = CAN_FRAME_FLAG_EXTENDED;
+
+    // link speed acknowledge: length, baud rate
+    entries[0x03].type = TypeLinkAck;
+    entries[0x03].headerLength = 1;
+    entries[0x03].lengthLength = 1;
+
+    // result of a batch of sent messages: length, count, bit mask
+    entries[0x05].type = TypeSendBatch;
+    entries[0x05].headerLength = 1;
+    entries[0x05].lengthLength = 1;
+
+    // cyclic message sent by the adapter: length, index, timestamp
+    entries[0x07].type = TypeCyclicSent;
+    entries[0x07].headerLength = 1+1+4;
+    entries[0x07].lengthLength = 1;
+    entries[0x07].timestampLength = 4;
+
+    // counters of a cyclic message of the adapter: length, index, sent and missed counter
+    entries[0x08].type = TypeCyclicCounters;
+    entries[0x08].headerLength = 1+1;
+    entries[0x08].lengthLength = 1;
+
+    // capabilities of the adapter: length, size of cyclic table
+    entries[0x09].type = TypeCapabilities;
+    entries[0x09].headerLength = 1;
+    entries[0x09].lengthLength = 1;
+
+    // acceptance mask or filter of the adapter: length, index, flags, value
+    entries[0x0a].type = TypeFilter;
+    entries[0x0a].headerLength = 1+1;
+    entries[0x0a].lengthLength = 1;
+}
+
+const DLTCanDecoder::Dispatch *DLTCanDecoder::dispatchTable()
+{
+    static const DispatchTable table;
+
+    return table.entries;
+}
+
+DLTCanDecoder::DLTCanDecoder()
+{
+    dispatch = dispatchTable();
+    errorCounter = 0;
+
+    reset();
+}
+
+void DLTCanDecoder::reset()
+{
+    state = StateIdle;
+    startFound = false;
+    headerLength = 0;
+    lengthLength = 0;
+    timestampLength = 0;
+    headerPos = 0;
+    payloadPos = 0;
+    memset(&record,0,sizeof(record));
+}
+
+int DLTCanDecoder::decode(const unsigned char *data,int length,Record *records,int maxRecords,int *consumed)
+{
+    int count = 0;
+    int num = 0;
+
+    while(num<length && count<maxRecords)
+    {
+        unsigned char byte = data[num++];
+        bool complete;
+
+        if(startFound)
+        {
+            startFound = false;
+
+            if(byte==0x7f)
+            {
+                // two start bytes are a stuffed 0x7f in the data
+                complete = dataByte(byte);
+            }
+            else
+            {
+                // a new message starts
+                complete = startByte(byte);
+            }
+        }
+        else if(byte==0x7f)
+        {
+            startFound = true;
+            complete = false;
+        }
+        else
+        {
+            complete = dataByte(byte);
+        }
+
+        if(complete)
+        {
+            records[count++] = record;
+        }
+    }
+
+    if(consumed)
+        *consumed = num;
+
+    return count;
+}
+
+bool DLTCanDecoder::startByte(unsigned char byte)
+{
+    const Dispatch &entry = dispatch[byte];
+
+    record.type = entry.type;
+    record.timestamped = 0;
+    record.deviceTimestamp = 0;
+    record.frame.flags = entry.flags;
+    record.frame.dlc = 0;
+    record.frame.id = 0;
+
+    if(entry.type==TypeInvalid)
+    {
+        // unknown message, wait for next start byte
+        errorCounter++;
+        state = StateIdle;
+        return false;
+    }
+
+    if(entry.headerLength==0)
+    {
+        // status message is already complete
+        state = StateIdle;
+        return true;
+    }
+
+    headerLength = entry.headerLength;
+    lengthLength = entry.lengthLength;
+    timestampLength = entry.timestampLength;
+    headerPos = 0;
+    state = StateHeader;
+
+    return false;
+}
+
+bool DLTCanDecoder::dataByte(unsigned char byte)
+{
+    switch(state)
+    {
+    case StateHeader:
+        header[headerPos++] = byte;
+        if(headerPos<headerLength)
+            return false;
+
+        // header complete: length, id and timestamp in big endian
+        record.frame.dlc = lengthLength ? header[0] : 0;
+        record.frame.id = 0;
+        for(int num=lengthLength;num<headerLength-timestampLength;num++)
+            record.frame.id = (record.frame.id<<8) | header[num];
+        if(record.frame.id & 0x40000000)
+            record.frame.flags |= CAN_FRAME_FLAG_RTR; // MCP2515 library marks remote frames in the id
+        record.frame.id &= CAN_FRAME_ID_MASK;
+        if(timestampLength)
+        {
+            record.timestamped = 1;
+            for(int num=headerLength-timestampLength;num<headerLength;num++)
+                record.deviceTimestamp = (record.deviceTimestamp<<8) | header[num];
+        }
+
+        if(record.frame.dlc>CAN_FRAME_MAX_DATA_CLASSIC)
+        {
+            // invalid length, wait for next start byte
+            errorCounter++;
+            state = StateIdle;
+            return false;
+        }
+        if(record.frame.dlc==0)
+        {
+            state = StateIdle;
+            return true;
+        }
+        payloadPos = 0;
+        state = StatePayload;
+        return false;
+
+    case StatePayload:
+        record.frame.data[payloadPos++] = byte;
+        if(payloadPos<record.frame.dlc)
+            return false;
+
+        state = StateIdle;
+        return true;
+
+    case StateIdle:
+    default:
+        // data outside of a message is ignored
+        return false;
+    }
+}
+
+static void benchmarkWrite(std::vector<unsigned char> &stream,unsigned char byte)
+{
+    stream.push_back(byte);
+    if(byte==0x7f)
+        stream.push_back(0x7f); // stuff byte
+}
+
+bool DLTCanDecoder::benchmark(int frames,quint64 (*allocations)())
+{
+    if(frames<=0)
+        return false;
+
+    // stream of standard and extended frames with timestamp, allocated before the measurement
+    std::vector<unsigned char> stream;
+    quint32 random = 12345;
+    int streamFrames = 1000;
+    for(int num=0;num<streamFrames;num++)
+    {
+        bool extended = num%4==3;
+        int dlc = num%9;
+
+        stream.push_back(0x7f); // Start of messages
+        stream.push_back(extended ? 0x84 : 0x83);
+        benchmarkWrite(stream,dlc);
+        for(int byte=extended?3:1;byte>=0;byte--)
+            benchmarkWrite(stream,(unsigned char)(((quint32)num*0x1234567)>>(byte*8)) & (byte==3 ? 0x1f : 0xff));
+        for(int byte=3;byte>=0;byte--)
+            benchmarkWrite(stream,(unsigned char)(((quint32)num*1000)>>(byte*8)));
+        for(int byte=0;byte<dlc;byte++)
+        {
+            random = random*1103515245+12345;
+            benchmarkWrite(stream,(unsigned char)(random>>16));
+        }
+    }
+
+    DLTCanDecoder decoder;
+    Record records[DLT_CAN_DECODER_BENCHMARK_RECORDS];
+    quint64 decoded = 0;
+    quint64 bytes = 0;
+
+    quint64 allocationsStart = allocations ? allocations() : 0;
+    quint64 start = DLTCanClock::now();
+    while(decoded<(quint64)frames)
+    {
+        for(size_t pos=0;pos<stream.size();)
+        {
+            int length = (int)qMin(stream.size()-pos,(size_t)DLT_CAN_DECODER_BENCHMARK_CHUNK);
+            const unsigned char *data = stream.data()+pos;
+
+            // like the capture thread: decode until the chunk is consumed
+            while(length>0)
+            {
+                int consumed = 0;
+                decoded += decoder.decode(data,length,records,DLT_CAN_DECODER_BENCHMARK_RECORDS,&consumed);
+                data += consumed;
+                length -= consumed;
+            }
+            pos += qMin(stream.size()-pos,(size_t)DLT_CAN_DECODER_BENCHMARK_CHUNK);
+        }
+        bytes += stream.size();
+    }
+    quint64 duration = qMax(DLTCanClock::now()-start,(quint64)1);
+    quint64 allocationsCount = allocations ? allocations()-allocationsStart : 0;
+
+    double rate = (double)decoded*1000000000.0/duration;
+    fprintf(stdout,"DLTCan: decoded %llu frames from %llu bytes in %.1f ms, errors %u\n",(unsigned long long)decoded,
+            (unsigned long long)bytes,duration/1000000.0,decoder.getErrorCounter());
+    fprintf(stdout,"DLTCan: %.0f frames/s %.1f ns/frame %.1f MB/s\n",rate,(double)duration/decoded,(double)bytes*1000.0/duration);
+    if(allocations)
+        fprintf(stdout,"DLTCan: %llu allocations, %.6f allocations/frame\n",(unsigned long long)allocationsCount,(double)allocationsCount/decoded);
+    else
+        fprintf(stdout,"DLTCan: allocations not counted\n");
+    fflush(stdout);
+
+    return true;
+}
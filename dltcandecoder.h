@@ -0,0 +1,124 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcandecoder.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_DECODER_H
+#define DLT_CAN_DECODER_H
+
+#include "canframe.h"
+
+// maximum number of header bytes between frame type and payload
+#define DLT_CAN_DECODER_MAX_HEADER 9
+
+/**
+ * Incremental decoder for the binary serial protocol of the Wemos CAN adapter.
+ *
+ * Bytes can be fed in chunks of any size, the state is kept between calls.
+ * Complete frames are written into a caller provided array of fixed size
+ * records, so no heap memory is allocated while decoding.
+ */
+class DLTCanDecoder
+{
+public:
+
+    enum Type
+    {
+        TypeInvalid = 0,
+        TypeInitOk,
+        TypeSendOk,
+        TypeWatchdog,
+        TypeSendError,
+        TypeInitError,
+        TypeStandard,
+        TypeExtended,
+        TypeLinkAck,
+        TypeLinkOk,
+        TypeLinkError,
+        TypeSendBatch,
+        TypeCyclicSent,
+        TypeCyclicCounters,
+        TypeCapabilities,
+        TypeFilter,
+        TypeFilterError
+    };
+
+    struct Record
+    {
+        unsigned char type;         // Type of the frame
+        unsigned char timestamped;  // deviceTimestamp is valid
+        quint32 deviceTimestamp;    // time of the adapter in us
+        CanFrame frame;             // CAN messages, data of other messages with payload
+    };
+
+    DLTCanDecoder();
+
+    void reset();
+
+    // Decode up to length bytes of data and write complete frames into records.
+    // Stops when maxRecords are written, consumed returns the number of used bytes.
+    // Returns the number of written records.
+    int decode(const unsigned char *data,int length,Record *records,int maxRecords,int *consumed);
+
+    unsigned int getErrorCounter() const { return errorCounter; }
+
+    // Decode a generated stuffed byte stream and print frames/s and allocations per frame,
+    // allocations returns the number of allocations of the process so far and can be 0
+    static bool benchmark(int frames,quint64 (*allocations)() = 0);
+
+private:
+
+    enum State
+    {
+        StateIdle = 0,
+        StateHeader,
+        StatePayload
+    };
+
+    struct Dispatch
+    {
+        unsigned char type;             // Type of the frame, TypeInvalid if unknown
+        unsigned char headerLength;     // number of bytes between frame type and payload
+        unsigned char lengthLength;     // header starts with length of payload (0 or 1)
+        unsigned char timestampLength;  // header ends with device timestamp (0 or 4)
+        unsigned char flags;            // CAN_FRAME_FLAG_* of the decoded frame
+    };
+
+    struct DispatchTable
+    {
+        DispatchTable();
+        Dispatch entries[256];
+    };
+
+    static const Dispatch *dispatchTable();
+
+    bool startByte(unsigned char byte);
+    bool dataByte(unsigned char byte);
+
+    const Dispatch *dispatch;
+
+    State state;
+    bool startFound;
+
+    unsigned char header[DLT_CAN_DECODER_MAX_HEADER];
+    int headerLength;
+    int lengthLength;
+    int timestampLength;
+    int headerPos;
+    int payloadPos;
+
+    Record record;
+
+    unsigned int errorCounter;
+};
+
+#endif // DLT_CAN_DECODER_H
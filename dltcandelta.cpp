@@ -0,0 +1,220 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcandelta.cpp
+ * @licence end@
+ */
+
+#include "dltcandelta.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <string.h>
+
+// flags which change the type of a frame
+#define DLT_CAN_DELTA_FLAGS (CAN_FRAME_FLAG_RTR|CAN_FRAME_FLAG_FD)
+
+DLTCanDelta::DLTCanDelta()
+{
+    forwardedCounter = 0;
+    suppressedCounter = 0;
+    keyframeCounter = 0;
+
+    clearSettings();
+}
+
+void DLTCanDelta::start()
+{
+    // allocated once, so new ids are added without allocation of the table
+    entries.clear();
+    entries.reserve(DLT_CAN_DELTA_MAX_IDS);
+    standardIndex.fill(-1,DLT_CAN_CHANNELS_MAX*DLT_CAN_DELTA_STANDARD_IDS);
+    extendedIndex.clear();
+    extendedIndex.reserve(DLT_CAN_DELTA_MAX_IDS);
+
+    forwardedCounter = 0;
+    suppressedCounter = 0;
+    keyframeCounter = 0;
+}
+
+void DLTCanDelta::stop()
+{
+    // the entries are kept for the statistics
+    standardIndex.clear();
+    extendedIndex.clear();
+}
+
+int DLTCanDelta::lookup(const CanFrame &frame)
+{
+    int channel = frame.channel<DLT_CAN_CHANNELS_MAX ? frame.channel : 0;
+    int index;
+
+    if(frame.isExtended())
+    {
+        // channel is stored in the upper three bits
+        quint32 key = ((quint32)channel<<29)|(frame.id&CAN_FRAME_ID_MASK);
+        index = extendedIndex.value(key,-1);
+        if(index<0 && entries.size()<DLT_CAN_DELTA_MAX_IDS)
+        {
+            index = entries.size();
+            extendedIndex.insert(key,index);
+        }
+    }
+    else
+    {
+        int key = channel*DLT_CAN_DELTA_STANDARD_IDS+(frame.id&(DLT_CAN_DELTA_STANDARD_IDS-1));
+        index = standardIndex[key];
+        if(index<0 && entries.size()<DLT_CAN_DELTA_MAX_IDS)
+        {
+            index = entries.size();
+            standardIndex[key] = index;
+        }
+    }
+
+    if(index==entries.size())
+    {
+        // first frame of this id
+        DLTCanDeltaEntry entry;
+        memset(&entry,0,sizeof(entry));
+        entry.id = frame.id;
+        entry.channel = channel;
+        entry.flags = frame.flags;
+        entries.append(entry);
+    }
+
+    return index;
+}
+
+bool DLTCanDelta::forward(const CanFrame &frame)
+{
+    if(frame.isTx() || standardIndex.isEmpty())
+        return true;
+
+    int index = lookup(frame);
+    if(index<0)
+    {
+        // table is full
+        forwardedCounter++;
+        return true;
+    }
+
+    DLTCanDeltaEntry &entry = entries[index];
+    int dlc = frame.dlc<=CAN_FRAME_MAX_DATA ? frame.dlc : CAN_FRAME_MAX_DATA;
+
+    bool changed = entry.forwardedCounter==0 || entry.dlc!=dlc ||
+                   ((entry.flags^frame.flags)&DLT_CAN_DELTA_FLAGS) ||
+                   memcmp(entry.data,frame.data,dlc)!=0;
+
+    if(!changed)
+    {
+        // unchanged frames older than the last forwarded one are never due, the difference would wrap
+        if(keyframeInterval<=0 || frame.timestamp<entry.lastForwarded ||
+           frame.timestamp-entry.lastForwarded<(quint64)keyframeInterval*1000000)
+        {
+            entry.suppressedCounter++;
+            suppressedCounter++;
+            return false;
+        }
+        keyframeCounter++;
+    }
+    else
+    {
+        entry.dlc = dlc;
+        entry.flags = frame.flags;
+        memcpy(entry.data,frame.data,dlc);
+    }
+
+    entry.lastForwarded = frame.timestamp;
+    entry.forwardedCounter++;
+    forwardedCounter++;
+
+    return true;
+}
+
+quint64 DLTCanDelta::takeSuppressed(int index)
+{
+    DLTCanDeltaEntry &entry = entries[index];
+    quint64 suppressed = entry.suppressedCounter-entry.reportedCounter;
+
+    entry.reportedCounter = entry.suppressedCounter;
+
+    return suppressed;
+}
+
+void DLTCanDelta::clearSettings()
+{
+    active = false;
+    keyframeInterval = DLT_CAN_DELTA_KEYFRAME_DEFAULT;
+    reportInterval = DLT_CAN_DELTA_REPORT_DEFAULT;
+}
+
+void DLTCanDelta::writeSettings(QXmlStreamWriter &xml)
+{
+    /* Write project settings */
+    xml.writeStartElement("DLTCanDelta");
+        xml.writeTextElement("active",QString("%1").arg(active));
+        xml.writeTextElement("keyframeInterval",QString("%1").arg(keyframeInterval));
+        xml.writeTextElement("reportInterval",QString("%1").arg(reportInterval));
+    xml.writeEndElement(); // DLTCanDelta
+}
+
+void DLTCanDelta::readSettings(const QString &filename)
+{
+    bool isDLTCanDelta = false;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(isDLTCanDelta)
+              {
+                  /* Project settings */
+                  if(xml.name() == QString("active"))
+                  {
+                      active = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("keyframeInterval"))
+                  {
+                      keyframeInterval = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("reportInterval"))
+                  {
+                      reportInterval = xml.readElementText().toInt();
+                  }
+              }
+              else if(xml.name() == QString("DLTCanDelta"))
+              {
+                    isDLTCanDelta = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == QString("DLTCanDelta"))
+              {
+                    isDLTCanDelta = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+}
@@ -0,0 +1,124 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcandelta.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_DELTA_H
+#define DLT_CAN_DELTA_H
+
+#include <QHash>
+#include <QVector>
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include "canframe.h"
+
+// number of standard 11 bit CAN ids of each channel
+#define DLT_CAN_DELTA_STANDARD_IDS 2048
+
+// maximum number of tracked ids, frames of further ids are always forwarded
+#define DLT_CAN_DELTA_MAX_IDS 16384
+
+// default time in ms after which an unchanged frame is forwarded again
+#define DLT_CAN_DELTA_KEYFRAME_DEFAULT 1000
+
+// default time in ms between the reports of the suppressed frames
+#define DLT_CAN_DELTA_REPORT_DEFAULT 10000
+
+// Last forwarded frame of one id
+struct DLTCanDeltaEntry
+{
+    quint32 id;
+    quint8 channel;
+    quint8 flags;
+    quint8 dlc;
+    quint8 data[CAN_FRAME_MAX_DATA];
+    quint64 lastForwarded;      // timestamp of the last forwarded frame
+
+    // Statistics since start
+    quint64 forwardedCounter;
+    quint64 suppressedCounter;
+    quint64 reportedCounter;    // suppressed frames already reported
+};
+
+/**
+ * Change-only forwarding of received CAN frames.
+ *
+ * The last forwarded payload of each id is kept in a flat table, indexed by
+ * a table of all 11 bit ids of each channel and by a hash of the 29 bit ids.
+ * A frame is forwarded only if its payload, DLC or frame type changed, or if
+ * the keyframe interval elapsed since the last forwarded frame of its id.
+ * Other frames are suppressed and counted per id. Sent frames always pass.
+ *
+ * The table is allocated at start, a new id is added once, so checking a
+ * frame needs no allocation.
+ *
+ * Not thread safe, must be used in the thread of its owner.
+ */
+class DLTCanDelta
+{
+public:
+    DLTCanDelta();
+
+    void start();
+    void stop();
+
+    bool isActive() const { return active; }
+    bool getActive() const { return active; }
+    void setActive(bool active) { this->active = active; }
+
+    // Time in ms after which an unchanged frame is forwarded again, 0 forwards only changes
+    int getKeyframeInterval() const { return keyframeInterval; }
+    void setKeyframeInterval(int value) { this->keyframeInterval = value; }
+
+    // Time in ms between the reports of the suppressed frames, 0 reports only at stop
+    int getReportInterval() const { return reportInterval; }
+    void setReportInterval(int value) { this->reportInterval = value; }
+
+    // Check one frame, returns false if it is suppressed
+    bool forward(const CanFrame &frame);
+
+    // Tracked ids
+    int getCount() const { return entries.size(); }
+    const DLTCanDeltaEntry &getEntry(int index) const { return entries[index]; }
+
+    // Suppressed frames of an id since the last call
+    quint64 takeSuppressed(int index);
+
+    // Statistics since start
+    quint64 getForwardedCounter() const { return forwardedCounter; }
+    quint64 getSuppressedCounter() const { return suppressedCounter; }
+    quint64 getKeyframeCounter() const { return keyframeCounter; }
+
+    void clearSettings();
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename);
+
+private:
+
+    int lookup(const CanFrame &frame);
+
+    // Settings
+    bool active;
+    int keyframeInterval;
+    int reportInterval;
+
+    QVector<DLTCanDeltaEntry> entries;
+    QVector<int> standardIndex;         // index of entry of each channel and 11 bit id, -1 if not seen yet
+    QHash<quint32,int> extendedIndex;   // index of entry of each channel and 29 bit id
+
+    quint64 forwardedCounter;
+    quint64 suppressedCounter;
+    quint64 keyframeCounter;
+};
+
+#endif // DLT_CAN_DELTA_H
@@ -0,0 +1,266 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanfilewriter.cpp
+ * @licence end@
+ */
+
+#include "dltcanfilewriter.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+#include <QDateTime>
+#include <QDir>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+void DLTCanFileWriterThread::run()
+{
+    writer->run();
+}
+
+DLTCanFileWriter::DLTCanFileWriter(const QString &name,const QString &extension,QObject *parent) : QObject(parent)
+    , name(name)
+    , extension(extension)
+    , thread(this)
+{
+    active = false;
+    bufferSize = 0;
+    maxFileSize = 0;
+
+    recording = false;
+    stopping = false;
+    wallClockOffset = 0;
+
+    fileSize = 0;
+    fileStart = 0;
+    fileNumber = 0;
+
+    writtenBytes = 0;
+    fileCounter = 0;
+    errorCounter = 0;
+
+    thread.setObjectName(name);
+
+    connect(&timerFlush, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+DLTCanFileWriter::~DLTCanFileWriter()
+{
+    // derived classes must call stop(), the hooks are not available anymore
+    disconnect(&timerFlush, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+void DLTCanFileWriter::start()
+{
+    if(recording || !active)
+        return;
+
+    writtenBytes = 0;
+    fileCounter = 0;
+    errorCounter = 0;
+    fileNumber = 0;
+
+    // files need the wall clock, frames have the monotonic clock
+    wallClockOffset = QDateTime::currentMSecsSinceEpoch()*1000000LL - (qint64)DLTCanClock::now();
+
+    startRecording();
+
+    // all buffers are allocated once
+    bufferSize = qMax(bufferSize,DLT_CAN_FILE_WRITER_BUFFER_MIN);
+    buffer.reserve(bufferSize);
+    buffer.resize(0);
+    freeBuffers.clear();
+    fullBuffers.clear();
+    for(int num=1;num<DLT_CAN_FILE_WRITER_BUFFERS;num++)
+    {
+        QByteArray freeBuffer;
+        freeBuffer.reserve(bufferSize);
+        freeBuffers.append(freeBuffer);
+    }
+
+    if(!QDir().mkpath(path.isEmpty() ? QString(".") : path) || !openFile())
+    {
+        qDebug() << QString("%1: cannot open file in").arg(name) << path;
+        status("error");
+        return;
+    }
+
+    stopping = false;
+    recording = true;
+    thread.start();
+    timerFlush.start(DLT_CAN_FILE_WRITER_FLUSH_INTERVAL);
+
+    status("recording");
+    qDebug() << QString("%1: recording").arg(name) << getFileName();
+}
+
+void DLTCanFileWriter::stop()
+{
+    if(!recording)
+        return;
+
+    timerFlush.stop();
+
+    // write remaining data and wait until the writer thread has finished
+    {
+        QMutexLocker locker(&mutex);
+
+        if(!buffer.isEmpty())
+            fullBuffers.append(buffer);
+        stopping = true;
+        condition.wakeAll();
+    }
+    thread.wait();
+
+    closeFile();
+
+    recording = false;
+
+    // release memory of the buffers
+    buffer = QByteArray();
+    freeBuffers.clear();
+    fullBuffers.clear();
+
+    stopRecording();
+    status("stopped");
+}
+
+void DLTCanFileWriter::flush()
+{
+    if(recording && !buffer.isEmpty())
+        submit();
+}
+
+bool DLTCanFileWriter::submit()
+{
+    QMutexLocker locker(&mutex);
+
+    if(freeBuffers.isEmpty())
+        return false;
+
+    if(!buffer.isEmpty())
+    {
+        fullBuffers.append(buffer);
+        buffer = freeBuffers.takeFirst();
+        condition.wakeAll();
+    }
+
+    return true;
+}
+
+void DLTCanFileWriter::run()
+{
+    QMutexLocker locker(&mutex);
+
+    while(true)
+    {
+        if(fullBuffers.isEmpty())
+        {
+            if(stopping)
+                break;
+
+            condition.wait(&mutex);
+            continue;
+        }
+
+        // write without lock, so the producer can fill the next buffer
+        QByteArray fullBuffer = fullBuffers.takeFirst();
+
+        locker.unlock();
+
+        writeBuffer(fullBuffer.constData(),fullBuffer.size());
+
+        // keeps the reserved capacity
+        fullBuffer.resize(0);
+
+        locker.relock();
+
+        freeBuffers.append(fullBuffer);
+    }
+}
+
+bool DLTCanFileWriter::writeData(const char *data,int length)
+{
+    if(!file.isOpen() || file.write(data,length)!=length)
+    {
+        errorCounter.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+
+    fileSize += length;
+    writtenBytes.fetch_add(length,std::memory_order_relaxed);
+
+    return true;
+}
+
+void DLTCanFileWriter::rotateFile()
+{
+    closeFile();
+    openFile();
+}
+
+bool DLTCanFileWriter::openFile()
+{
+    QString fileBaseName = QString("%1_%2_%3.%4").arg(prefix).arg(QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss"))
+            .arg(++fileNumber,3,10,QChar('0')).arg(extension);
+
+    QMutexLocker locker(&mutex);
+
+    fileName = QDir(path.isEmpty() ? QString(".") : path).filePath(fileBaseName);
+    file.setFileName(fileName);
+    fileSize = 0;
+    fileStart = DLTCanClock::now();
+
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        errorCounter.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+
+    fileCounter.fetch_add(1,std::memory_order_relaxed);
+
+    openedFile();
+
+    return true;
+}
+
+void DLTCanFileWriter::closeFile()
+{
+    if(!file.isOpen())
+        return;
+
+    closingFile();
+    file.close();
+}
+
+void DLTCanFileWriter::sync()
+{
+    if(!file.isOpen() || !file.flush())
+        return;
+
+    // data written to the file is also stored on the disk
+#ifdef Q_OS_WIN
+    _commit(file.handle());
+#else
+    fsync(file.handle());
+#endif
+}
+
+QString DLTCanFileWriter::getFileName() const
+{
+    QMutexLocker locker(&mutex);
+
+    return fileName;
+}
@@ -0,0 +1,177 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanfilewriter.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_FILE_WRITER_H
+#define DLT_CAN_FILE_WRITER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFile>
+#include <QList>
+#include <QTimer>
+
+#include <atomic>
+
+// number of buffers passed between producer and writer thread
+#define DLT_CAN_FILE_WRITER_BUFFERS 4
+
+// minimum size of each buffer, so it can hold any message or line
+#define DLT_CAN_FILE_WRITER_BUFFER_MIN 65536
+
+// interval in ms in which a partly filled buffer is written
+#define DLT_CAN_FILE_WRITER_FLUSH_INTERVAL 1000
+
+class DLTCanFileWriter;
+
+class DLTCanFileWriterThread : public QThread
+{
+public:
+    explicit DLTCanFileWriterThread(DLTCanFileWriter *writer) : writer(writer) {}
+
+protected:
+    void run() override;
+
+private:
+    DLTCanFileWriter *writer;
+};
+
+/**
+ * Buffered writing of recorded data into files in a background thread.
+ *
+ * The producer appends encoded data to a large buffer, which is allocated
+ * once. Full buffers are written by a writer thread, so the thread of the
+ * producer never waits for the disk. If all buffers are still being written,
+ * new data must be dropped and counted by the producer.
+ *
+ * Derived classes encode the data and decide in writeBuffer() where a
+ * buffer is split into the next file.
+ */
+class DLTCanFileWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DLTCanFileWriter(const QString &name,const QString &extension,QObject *parent = nullptr);
+    ~DLTCanFileWriter();
+
+    void start();
+    void stop();
+    bool isRecording() const { return recording; }
+
+    // Active
+    bool getActive() { return active; }
+    void setActive(bool active) { this->active = active; }
+
+    // Directory and file name prefix, files are named <prefix>_<date>_<time>_<number>.<extension>
+    QString getPath() { return path; }
+    void setPath(QString path) { this->path = path; }
+
+    QString getPrefix() { return prefix; }
+    void setPrefix(QString prefix) { this->prefix = prefix; }
+
+    // Size of each buffer in bytes
+    int getBufferSize() { return bufferSize; }
+    void setBufferSize(int value) { this->bufferSize = value; }
+
+    // Maximum size of a file in bytes, 0 is unlimited
+    qint64 getMaxFileSize() { return maxFileSize; }
+    void setMaxFileSize(qint64 value) { this->maxFileSize = value; }
+
+    // Statistics since start
+    quint64 getWrittenBytes() const { return writtenBytes.load(std::memory_order_relaxed); }
+    unsigned int getFileCounter() const { return fileCounter.load(std::memory_order_relaxed); }
+    unsigned int getErrorCounter() const { return errorCounter.load(std::memory_order_relaxed); }
+    QString getFileName() const;
+
+signals:
+
+    void status(QString text);
+
+public slots:
+
+    // Write the partly filled buffer now
+    void flush();
+
+protected:
+
+    // Called at start before the first file is opened
+    virtual void startRecording() {}
+
+    // Called at stop after all buffers are written
+    virtual void stopRecording() {}
+
+    // Write one full buffer in the writer thread with writeData() and rotateFile()
+    virtual void writeBuffer(const char *data,int length) = 0;
+
+    // Called after a file is opened and before it is closed, e.g. for a header and a footer
+    virtual void openedFile() {}
+    virtual void closingFile() {}
+
+    // Pass the filled buffer to the writer thread, false if no free buffer is left
+    bool submit();
+
+    // Used by the writer thread
+    bool writeData(const char *data,int length);
+    void rotateFile();
+    void sync();
+
+    // Settings
+    bool active;
+    QString path;
+    QString prefix;
+    int bufferSize;
+    qint64 maxFileSize;
+
+    // Producer, only used in the thread of the owner
+    bool recording;
+    QByteArray buffer;
+    qint64 wallClockOffset;    // wall clock minus monotonic clock in ns
+
+    // Writer thread
+    QFile file;
+    qint64 fileSize;
+    quint64 fileStart;
+
+    std::atomic<quint64> writtenBytes;
+    std::atomic<unsigned int> fileCounter;
+    std::atomic<unsigned int> errorCounter;
+
+private:
+
+    friend class DLTCanFileWriterThread;
+
+    void run();
+
+    bool openFile();
+    void closeFile();
+
+    QString name;
+    QString extension;
+    QTimer timerFlush;
+
+    // Passed between producer and writer thread
+    mutable QMutex mutex;
+    QWaitCondition condition;
+    QList<QByteArray> freeBuffers;
+    QList<QByteArray> fullBuffers;
+    bool stopping;
+    DLTCanFileWriterThread thread;
+
+    // Writer thread
+    QString fileName;
+    unsigned int fileNumber;
+};
+
+#endif // DLT_CAN_FILE_WRITER_H
@@ -0,0 +1,553 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanfilter.cpp
+ * @licence end@
+ */
+
+#include "dltcanfilter.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <string.h>
+
+DLTCanFilterRule::DLTCanFilterRule()
+{
+    include = true;
+    extended = false;
+    first = 0;
+    last = 0;
+    mask = CAN_FRAME_ID_MASK;
+
+    hitCounter = 0;
+}
+
+// id and mask of one MCP2515 filter
+struct DLTCanFilterPair
+{
+    quint32 id;
+    quint32 mask;
+};
+
+static int bitCount(quint32 value)
+{
+    int count = 0;
+    for(;value;value&=value-1)
+        count++;
+    return count;
+}
+
+// id/mask pair accepting all ids of a rule
+static DLTCanFilterPair toPair(const DLTCanFilterRule &rule)
+{
+    DLTCanFilterPair pair;
+    quint32 diff = rule.first ^ rule.last;
+
+    // ids of a range only share the bits above the highest differing bit
+    while(diff & (diff+1))
+        diff |= diff>>1;
+
+    pair.mask = rule.mask & ~diff;
+    pair.id = rule.first & pair.mask;
+
+    return pair;
+}
+
+// merge pairs, which lose the least mask bits, until count pairs are left
+static void reducePairs(QVector<DLTCanFilterPair> &pairs,int count)
+{
+    while(pairs.size()>count && pairs.size()>1)
+    {
+        int best1 = 0, best2 = 1, bestLoss = 64;
+        DLTCanFilterPair bestPair = pairs[0];
+
+        for(int num1=0;num1<pairs.size();num1++)
+        {
+            for(int num2=num1+1;num2<pairs.size();num2++)
+            {
+                DLTCanFilterPair pair;
+                pair.mask = pairs[num1].mask & pairs[num2].mask & ~(pairs[num1].id ^ pairs[num2].id);
+                pair.id = pairs[num1].id & pair.mask;
+                int loss = qMax(bitCount(pairs[num1].mask),bitCount(pairs[num2].mask)) - bitCount(pair.mask);
+                if(loss<bestLoss)
+                {
+                    best1 = num1;
+                    best2 = num2;
+                    bestLoss = loss;
+                    bestPair = pair;
+                }
+            }
+        }
+
+        pairs[best1] = bestPair;
+        pairs.remove(best2);
+    }
+}
+
+// mask bits lost by using one mask for all pairs
+static int groupLoss(const QVector<DLTCanFilterPair> &pairs,quint32 *mask)
+{
+    int loss = 0;
+
+    *mask = CAN_FRAME_ID_MASK;
+    for(int num=0;num<pairs.size();num++)
+        *mask &= pairs[num].mask;
+    for(int num=0;num<pairs.size();num++)
+        loss += bitCount(pairs[num].mask) - bitCount(*mask);
+
+    return loss;
+}
+
+// program pairs into the filters of one mask, unused filters repeat the first one
+static void setGroup(DLTCanFilterHardware &hardware,int mask,const QVector<DLTCanFilterPair> &pairs,bool extended)
+{
+    int first = mask==0 ? 0 : 2;
+    int last = mask==0 ? 2 : DLT_CAN_FILTER_HARDWARE_FILTERS;
+
+    groupLoss(pairs,&hardware.mask[mask]);
+    hardware.maskExtended[mask] = extended;
+    for(int num=first;num<last;num++)
+    {
+        const DLTCanFilterPair &pair = pairs[num-first<pairs.size() ? num-first : 0];
+        hardware.filterExtended[num] = extended;
+        hardware.filter[num] = pair.id & hardware.mask[mask];
+    }
+}
+
+DLTCanFilterHardware::DLTCanFilterHardware()
+{
+    // masks without any bit accept standard and extended frames in both receive buffers
+    for(int num=0;num<DLT_CAN_FILTER_HARDWARE_MASKS;num++)
+    {
+        maskExtended[num] = false;
+        mask[num] = 0;
+    }
+    for(int num=0;num<DLT_CAN_FILTER_HARDWARE_FILTERS;num++)
+    {
+        filterExtended[num] = num&1;
+        filter[num] = 0;
+    }
+}
+
+QString DLTCanFilterHardware::toString() const
+{
+    QString text = "filter";
+
+    for(int num=0;num<DLT_CAN_FILTER_HARDWARE_FILTERS;num++)
+    {
+        if(num==0 || num==2)
+            text += QString(" mask %1%2").arg(mask[maskOf(num)],0,16).arg(maskExtended[maskOf(num)] ? "x" : "");
+        text += QString(" %1%2").arg(filter[num],0,16).arg(filterExtended[num] ? "x" : "");
+    }
+
+    return text;
+}
+
+DLTCanFilter::DLTCanFilter()
+{
+    active = true;
+    acceptedCounter = 0;
+    rejectedCounter = 0;
+
+    compile();
+}
+
+void DLTCanFilter::addRule(bool include,quint32 first,quint32 last,quint32 mask,bool extended)
+{
+    DLTCanFilterRule rule;
+
+    rule.include = include;
+    rule.extended = extended || first>DLT_CAN_FILTER_STANDARD_MASK || last>DLT_CAN_FILTER_STANDARD_MASK;
+    rule.mask = mask & (rule.extended ? CAN_FRAME_ID_MASK : DLT_CAN_FILTER_STANDARD_MASK);
+    rule.first = qMin(first,last) & rule.mask;
+    rule.last = qMax(first,last) & rule.mask;
+    rules.append(rule);
+
+    compile();
+}
+
+bool DLTCanFilter::addRule(bool include,const QString &text)
+{
+    bool ok1 = false, ok2 = true;
+    quint32 first,last,mask = CAN_FRAME_ID_MASK;
+
+    if(text.contains('-'))
+    {
+        first = text.section('-',0,0).toUInt(&ok1,16);
+        last = text.section('-',1,1).toUInt(&ok2,16);
+    }
+    else if(text.contains('/'))
+    {
+        first = text.section('/',0,0).toUInt(&ok1,16);
+        mask = text.section('/',1,1).toUInt(&ok2,16);
+        last = first;
+    }
+    else
+    {
+        first = text.toUInt(&ok1,16);
+        last = first;
+    }
+
+    if(!ok1 || !ok2 || first>CAN_FRAME_ID_MASK || last>CAN_FRAME_ID_MASK)
+        return false;
+
+    addRule(include,first,last,mask);
+
+    return true;
+}
+
+QString DLTCanFilter::toString(int index) const
+{
+    const DLTCanFilterRule &rule = rules[index];
+    QString text = rule.include ? "include " : "exclude ";
+
+    if(rule.mask!=(rule.extended ? (quint32)CAN_FRAME_ID_MASK : (quint32)DLT_CAN_FILTER_STANDARD_MASK))
+        text += QString("%1/%2").arg(rule.first,0,16).arg(rule.mask,0,16);
+    else if(rule.first!=rule.last)
+        text += QString("%1-%2").arg(rule.first,0,16).arg(rule.last,0,16);
+    else
+        text += QString("%1").arg(rule.first,0,16);
+
+    return text;
+}
+
+void DLTCanFilter::removeRule(int index)
+{
+    if(index<0 || index>=rules.size())
+        return;
+
+    rules.remove(index);
+
+    compile();
+}
+
+void DLTCanFilter::clear()
+{
+    rules.clear();
+
+    compile();
+}
+
+void DLTCanFilter::compile()
+{
+    includeOnly = false;
+    for(int index=0;index<rules.size();index++)
+    {
+        if(rules[index].include)
+            includeOnly = true;
+    }
+
+    // deciding rule of each 11 bit id: first exclude, else first include
+    memset(standardAccepted,0,sizeof(standardAccepted));
+    for(quint32 id=0;id<DLT_CAN_FILTER_STANDARD_IDS;id++)
+    {
+        int exclude = DLT_CAN_FILTER_NO_RULE;
+        int include = DLT_CAN_FILTER_NO_RULE;
+
+        for(int index=0;index<rules.size() && exclude==DLT_CAN_FILTER_NO_RULE;index++)
+        {
+            const DLTCanFilterRule &rule = rules[index];
+            if(rule.extended || !rule.matches(id))
+                continue;
+            if(!rule.include)
+                exclude = index;
+            else if(include==DLT_CAN_FILTER_NO_RULE)
+                include = index;
+        }
+
+        if(exclude!=DLT_CAN_FILTER_NO_RULE)
+        {
+            standardRule[id] = exclude;
+        }
+        else
+        {
+            standardRule[id] = include;
+            if(include!=DLT_CAN_FILTER_NO_RULE || !includeOnly)
+                standardAccepted[id>>6] |= (quint64)1<<(id&0x3f);
+        }
+    }
+
+    // 29 bit ids cannot be expanded, single ids are hashed
+    extendedIncludeIds.clear();
+    extendedExcludeIds.clear();
+    extendedIncludeRules.clear();
+    extendedExcludeRules.clear();
+    for(int index=0;index<rules.size();index++)
+    {
+        const DLTCanFilterRule &rule = rules[index];
+        if(!rule.extended)
+            continue;
+
+        QHash<quint32,int> &ids = rule.include ? extendedIncludeIds : extendedExcludeIds;
+        if(rule.mask==CAN_FRAME_ID_MASK && rule.first==rule.last)
+        {
+            if(!ids.contains(rule.first))
+                ids.insert(rule.first,index);
+        }
+        else
+        {
+            (rule.include ? extendedIncludeRules : extendedExcludeRules).append(index);
+        }
+    }
+}
+
+bool DLTCanFilter::decideExtended(quint32 id,int *rule) const
+{
+    *rule = DLT_CAN_FILTER_NO_RULE;
+
+    // the first matching exclude rule wins
+    QHash<quint32,int>::const_iterator it = extendedExcludeIds.constFind(id);
+    if(it!=extendedExcludeIds.constEnd())
+        *rule = it.value();
+    for(int num=0;num<extendedExcludeRules.size();num++)
+    {
+        int index = extendedExcludeRules[num];
+        if(*rule!=DLT_CAN_FILTER_NO_RULE && index>*rule)
+            break;
+        if(rules[index].matches(id))
+        {
+            *rule = index;
+            break;
+        }
+    }
+    if(*rule!=DLT_CAN_FILTER_NO_RULE)
+        return false;
+
+    // else the first matching include rule
+    it = extendedIncludeIds.constFind(id);
+    if(it!=extendedIncludeIds.constEnd())
+        *rule = it.value();
+    for(int num=0;num<extendedIncludeRules.size();num++)
+    {
+        int index = extendedIncludeRules[num];
+        if(*rule!=DLT_CAN_FILTER_NO_RULE && index>*rule)
+            break;
+        if(rules[index].matches(id))
+        {
+            *rule = index;
+            break;
+        }
+    }
+    if(*rule!=DLT_CAN_FILTER_NO_RULE)
+        return true;
+
+    return !includeOnly;
+}
+
+int DLTCanFilter::apply(CanFrame *frames,int count)
+{
+    if(!isActive())
+        return count;
+
+    int accepted = 0;
+    for(int num=0;num<count;num++)
+    {
+        if(frames[num].isTx() || accept(frames[num]))
+        {
+            if(accepted!=num)
+                frames[accepted] = frames[num];
+            accepted++;
+        }
+    }
+
+    return accepted;
+}
+
+quint64 DLTCanFilter::getFilteredCounter() const
+{
+    quint64 counter = rejectedCounter;
+
+    for(int index=0;index<rules.size();index++)
+    {
+        if(!rules[index].include)
+            counter += rules[index].hitCounter;
+    }
+
+    return counter;
+}
+
+void DLTCanFilter::clearStatistics()
+{
+    acceptedCounter = 0;
+    rejectedCounter = 0;
+
+    for(int index=0;index<rules.size();index++)
+        rules[index].hitCounter = 0;
+}
+
+void DLTCanFilter::compileHardware(DLTCanFilterHardware &hardware) const
+{
+    hardware = DLTCanFilterHardware();
+
+    // without include rules all frames must be received
+    if(!isActive() || !includeOnly)
+        return;
+
+    QVector<DLTCanFilterPair> standardPairs;
+    QVector<DLTCanFilterPair> extendedPairs;
+    for(int index=0;index<rules.size();index++)
+    {
+        if(rules[index].include)
+            (rules[index].extended ? extendedPairs : standardPairs).append(toPair(rules[index]));
+    }
+
+    quint32 mask;
+    if(!standardPairs.isEmpty() && !extendedPairs.isEmpty())
+    {
+        // one receive buffer for each id type, the type with more pairs gets the four filters
+        bool standardFirst = standardPairs.size()<=extendedPairs.size();
+        QVector<DLTCanFilterPair> &pairs0 = standardFirst ? standardPairs : extendedPairs;
+        QVector<DLTCanFilterPair> &pairs1 = standardFirst ? extendedPairs : standardPairs;
+        reducePairs(pairs0,2);
+        reducePairs(pairs1,DLT_CAN_FILTER_HARDWARE_FILTERS-2);
+        setGroup(hardware,0,pairs0,!standardFirst);
+        setGroup(hardware,1,pairs1,standardFirst);
+        return;
+    }
+
+    // one id type uses both receive buffers
+    bool extended = standardPairs.isEmpty();
+    QVector<DLTCanFilterPair> &pairs = extended ? extendedPairs : standardPairs;
+    reducePairs(pairs,DLT_CAN_FILTER_HARDWARE_FILTERS);
+
+    // split into two and four filters with the least loss of mask bits
+    QVector<DLTCanFilterPair> best0, best1;
+    int bestLoss = -1;
+    for(int num1=0;num1<pairs.size();num1++)
+    {
+        for(int num2=num1;num2<pairs.size();num2++)
+        {
+            QVector<DLTCanFilterPair> pairs0, pairs1;
+            for(int num=0;num<pairs.size();num++)
+                (num==num1 || num==num2 ? pairs0 : pairs1).append(pairs[num]);
+            if(pairs1.size()>DLT_CAN_FILTER_HARDWARE_FILTERS-2)
+                continue;
+            if(pairs1.isEmpty())
+                pairs1 = pairs0;
+            int loss = groupLoss(pairs0,&mask)+groupLoss(pairs1,&mask);
+            if(bestLoss<0 || loss<bestLoss)
+            {
+                best0 = pairs0;
+                best1 = pairs1;
+                bestLoss = loss;
+            }
+        }
+    }
+    setGroup(hardware,0,best0,extended);
+    setGroup(hardware,1,best1,extended);
+}
+
+void DLTCanFilter::writeSettings(QXmlStreamWriter &xml)
+{
+    /* Write filter */
+    xml.writeTextElement("filterActive",QString("%1").arg(active));
+    xml.writeStartElement("filters");
+    for(int index=0;index<rules.size();index++)
+    {
+        const DLTCanFilterRule &rule = rules[index];
+
+        xml.writeStartElement("filter");
+            xml.writeTextElement("include",QString("%1").arg(rule.include));
+            xml.writeTextElement("extended",QString("%1").arg(rule.extended));
+            xml.writeTextElement("first",QString("%1").arg(rule.first,0,16));
+            xml.writeTextElement("last",QString("%1").arg(rule.last,0,16));
+            xml.writeTextElement("mask",QString("%1").arg(rule.mask,0,16));
+        xml.writeEndElement(); // filter
+    }
+    xml.writeEndElement(); // filters
+}
+
+void DLTCanFilter::readSettings(const QString &filename,const QString &element)
+{
+    bool isOwner = false;
+    bool isFilter = false;
+    DLTCanFilterRule rule;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(isFilter)
+              {
+                  /* Filter rule */
+                  if(xml.name() == QString("include"))
+                  {
+                      rule.include = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("extended"))
+                  {
+                      rule.extended = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("first"))
+                  {
+                      rule.first = xml.readElementText().toUInt(nullptr,16);
+                  }
+                  else if(xml.name() == QString("last"))
+                  {
+                      rule.last = xml.readElementText().toUInt(nullptr,16);
+                  }
+                  else if(xml.name() == QString("mask"))
+                  {
+                      rule.mask = xml.readElementText().toUInt(nullptr,16);
+                  }
+              }
+              else if(isOwner)
+              {
+                  if(xml.name() == QString("filterActive"))
+                  {
+                      active = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("filters"))
+                  {
+                      // list replaces all rules
+                      rules.clear();
+                  }
+                  else if(xml.name() == QString("filter"))
+                  {
+                      rule = DLTCanFilterRule();
+                      isFilter = true;
+                  }
+              }
+              else if(xml.name() == element)
+              {
+                    isOwner = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == QString("filter") && isFilter)
+              {
+                    rules.append(rule);
+                    isFilter = false;
+              }
+              else if(xml.name() == element)
+              {
+                    isOwner = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+
+    compile();
+}
@@ -0,0 +1,179 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanfilter.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_FILTER_H
+#define DLT_CAN_FILTER_H
+
+#include <QHash>
+#include <QVector>
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include "canframe.h"
+
+// number of standard 11 bit CAN ids
+#define DLT_CAN_FILTER_STANDARD_IDS 2048
+
+// mask of the 11 bit CAN id
+#define DLT_CAN_FILTER_STANDARD_MASK 0x7ff
+
+// deciding rule of a frame, if no rule matched
+#define DLT_CAN_FILTER_NO_RULE -1
+
+// acceptance masks and filters of the MCP2515, filters 0-1 use mask 0, filters 2-5 use mask 1
+#define DLT_CAN_FILTER_HARDWARE_MASKS 2
+#define DLT_CAN_FILTER_HARDWARE_FILTERS 6
+
+struct DLTCanFilterRule
+{
+    DLTCanFilterRule();
+
+    // Settings, a frame matches if first <= (id & mask) <= last
+    bool include;       // include or exclude matching frames
+    bool extended;      // rule applies to 29 bit ids instead of 11 bit ids
+    quint32 first;
+    quint32 last;
+    quint32 mask;
+
+    // Statistics, frames decided by this rule
+    quint64 hitCounter;
+
+    bool matches(quint32 id) const { return (id&mask)>=first && (id&mask)<=last; }
+};
+
+/**
+ * Acceptance configuration of the MCP2515 of the adapter.
+ *
+ * Default constructed it accepts all frames.
+ */
+struct DLTCanFilterHardware
+{
+    DLTCanFilterHardware();
+
+    bool maskExtended[DLT_CAN_FILTER_HARDWARE_MASKS];
+    quint32 mask[DLT_CAN_FILTER_HARDWARE_MASKS];
+    bool filterExtended[DLT_CAN_FILTER_HARDWARE_FILTERS];
+    quint32 filter[DLT_CAN_FILTER_HARDWARE_FILTERS];
+
+    // mask used by a filter
+    static int maskOf(int filter) { return filter<2 ? 0 : 1; }
+
+    QString toString() const;
+};
+
+/**
+ * Filter of received CAN frames by id.
+ *
+ * The rules are include or exclude lists of single ids, id ranges and
+ * id/mask pairs. An exclude rule always wins, if any include rule exists
+ * only included frames pass. Without any rule all frames pass.
+ *
+ * The rules are compiled into a bitset of all 11 bit ids with the deciding
+ * rule of each id, and into a hash of single 29 bit ids and a list of the
+ * remaining 29 bit rules. So a frame is checked without any allocation and
+ * each rule counts the frames it decided.
+ *
+ * Not thread safe, must be used in the thread of its owner.
+ */
+class DLTCanFilter
+{
+public:
+    DLTCanFilter();
+
+    // Filter is active and has at least one rule
+    bool isActive() const { return active && !rules.isEmpty(); }
+    bool getActive() const { return active; }
+    void setActive(bool active) { this->active = active; }
+
+    int getCount() const { return rules.size(); }
+    const DLTCanFilterRule &getRule(int index) const { return rules[index]; }
+    void addRule(bool include,quint32 first,quint32 last,quint32 mask = CAN_FRAME_ID_MASK,bool extended = false);
+    void removeRule(int index);
+    void clear();
+
+    // Parse a rule from text: "<id>", "<first>-<last>" or "<id>/<mask>", all in hex
+    bool addRule(bool include,const QString &text);
+    QString toString(int index) const;
+
+    // Check one frame, counts the hit of the deciding rule
+    bool accept(const CanFrame &frame)
+    {
+        int rule;
+        bool accepted;
+
+        if(frame.isExtended())
+        {
+            accepted = decideExtended(frame.id,&rule);
+        }
+        else
+        {
+            quint32 id = frame.id & DLT_CAN_FILTER_STANDARD_MASK;
+            accepted = (standardAccepted[id>>6]>>(id&0x3f))&1;
+            rule = standardRule[id];
+        }
+
+        if(rule!=DLT_CAN_FILTER_NO_RULE)
+            rules[rule].hitCounter++;
+        else if(accepted)
+            acceptedCounter++;
+        else
+            rejectedCounter++;
+
+        return accepted;
+    }
+
+    // Remove rejected received frames in place, sent frames always pass, returns the new count
+    int apply(CanFrame *frames,int count);
+
+    // Frames not decided by any rule
+    quint64 getAcceptedCounter() const { return acceptedCounter; }
+    quint64 getRejectedCounter() const { return rejectedCounter; }
+    quint64 getFilteredCounter() const;
+
+    void clearStatistics();
+
+    // Acceptance configuration of the MCP2515, which accepts at least all included frames.
+    // Exclude rules and rules not fitting into the masks and filters are only checked by the host.
+    void compileHardware(DLTCanFilterHardware &hardware) const;
+
+    // Settings are stored inside the element of the owner
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename,const QString &element = "DLTCan");
+
+private:
+
+    void compile();
+    bool decideExtended(quint32 id,int *rule) const;
+
+    bool active;
+    QVector<DLTCanFilterRule> rules;
+
+    // at least one include rule, frames without matching rule are rejected
+    bool includeOnly;
+
+    // compiled 11 bit rules
+    quint64 standardAccepted[DLT_CAN_FILTER_STANDARD_IDS/64];
+    short standardRule[DLT_CAN_FILTER_STANDARD_IDS];
+
+    // compiled 29 bit rules, first matching rule of single ids and all other rules in order
+    QHash<quint32,int> extendedIncludeIds;
+    QHash<quint32,int> extendedExcludeIds;
+    QVector<int> extendedIncludeRules;
+    QVector<int> extendedExcludeRules;
+
+    quint64 acceptedCounter;
+    quint64 rejectedCounter;
+};
+
+#endif // DLT_CAN_FILTER_H
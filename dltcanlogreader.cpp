@@ -0,0 +1,626 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanlogreader.cpp
+ * @licence end@
+ */
+
+#include "dltcanlogreader.h"
+#include "dltcanrecorder.h"
+#include "dltminiserver.h"
+
+#include <string.h>
+
+static int hexValue(char c)
+{
+    if(c>='0' && c<='9')
+        return c-'0';
+    if(c>='a' && c<='f')
+        return c-'a'+10;
+    if(c>='A' && c<='F')
+        return c-'A'+10;
+    return -1;
+}
+
+static quint32 readUInt32(const unsigned char *data,bool bigEndian)
+{
+    if(bigEndian)
+        return ((quint32)data[0]<<24) | ((quint32)data[1]<<16) | ((quint32)data[2]<<8) | data[3];
+    return ((quint32)data[3]<<24) | ((quint32)data[2]<<16) | ((quint32)data[1]<<8) | data[0];
+}
+
+static quint16 readUInt16(const unsigned char *data,bool bigEndian)
+{
+    if(bigEndian)
+        return (quint16)((data[0]<<8) | data[1]);
+    return (quint16)((data[1]<<8) | data[0]);
+}
+
+static bool contains(const char *line,int length,const char *text)
+{
+    int textLength = strlen(text);
+
+    for(int pos=0;pos+textLength<=length;pos++)
+    {
+        if(memcmp(line+pos,text,textLength)==0)
+            return true;
+    }
+    return false;
+}
+
+// flags, id little endian, dlc, payload
+static bool decodeFrameBinary(const unsigned char *data,int length,CanFrame &frame)
+{
+    if(length<6 || data[5]>CAN_FRAME_MAX_DATA || 6+data[5]>length)
+        return false;
+
+    frame.flags = data[0];
+    frame.id = readUInt32(data+1,false) & CAN_FRAME_ID_MASK;
+    frame.dlc = data[5];
+    memcpy(frame.data,data+6,frame.dlc);
+
+    return true;
+}
+
+DLTCanLogReader::DLTCanLogReader()
+{
+    format = FormatUnknown;
+    buffer = new char[DLT_CAN_LOG_READER_BUFFER];
+    begin = 0;
+    end = 0;
+    endOfFile = false;
+    ascDecimal = false;
+    ascRelative = false;
+    ascTimestamp = 0;
+    errorCounter = 0;
+}
+
+DLTCanLogReader::~DLTCanLogReader()
+{
+    close();
+
+    delete[] buffer;
+}
+
+bool DLTCanLogReader::open(const QString &filename)
+{
+    close();
+
+    file.setFileName(filename);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    errorCounter = 0;
+    if(!rewind())
+    {
+        close();
+        return false;
+    }
+
+    // DLT files start with the storage header, candump lines with the timestamp, ASC files with the date or base
+    int pos = begin;
+    while(pos<end && (buffer[pos]==' ' || buffer[pos]=='\t' || buffer[pos]=='\r' || buffer[pos]=='\n'))
+        pos++;
+    if(end-begin>=4 && memcmp(buffer+begin,"DLT\x01",4)==0)
+        format = FormatDlt;
+    else if(pos<end && buffer[pos]=='(')
+        format = FormatCandump;
+    else if(end-pos>=5 && (memcmp(buffer+pos,"date ",5)==0 || memcmp(buffer+pos,"base ",5)==0 || memcmp(buffer+pos,"//",2)==0))
+        format = FormatAsc;
+    else
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void DLTCanLogReader::close()
+{
+    if(file.isOpen())
+        file.close();
+
+    format = FormatUnknown;
+    begin = 0;
+    end = 0;
+    endOfFile = false;
+}
+
+bool DLTCanLogReader::rewind()
+{
+    if(!file.isOpen() || !file.seek(0))
+        return false;
+
+    begin = 0;
+    end = 0;
+    endOfFile = false;
+    ascDecimal = false;
+    ascRelative = false;
+    ascTimestamp = 0;
+
+    return fill();
+}
+
+bool DLTCanLogReader::fill()
+{
+    if(endOfFile)
+        return false;
+
+    // keep the incomplete record at the front of the buffer
+    if(begin>0)
+    {
+        memmove(buffer,buffer+begin,end-begin);
+        end -= begin;
+        begin = 0;
+    }
+
+    qint64 length = file.read(buffer+end,DLT_CAN_LOG_READER_BUFFER-end);
+    if(length<=0)
+    {
+        endOfFile = true;
+        return false;
+    }
+    end += length;
+
+    return true;
+}
+
+bool DLTCanLogReader::readFrame(CanFrame &frame)
+{
+    switch(format)
+    {
+    case FormatDlt:
+        return readDlt(frame);
+    case FormatCandump:
+    case FormatAsc:
+        return readText(frame);
+    default:
+        return false;
+    }
+}
+
+bool DLTCanLogReader::readDlt(CanFrame &frame)
+{
+    while(true)
+    {
+        // storage header and start of the standard header with the length
+        if(end-begin<DLT_STORAGE_HEADER_SIZE+4)
+        {
+            if(!fill())
+                return false;
+            continue;
+        }
+
+        const unsigned char *data = (const unsigned char*)buffer+begin;
+        if(memcmp(data,"DLT\x01",4)!=0)
+        {
+            // search the next storage header
+            errorCounter++;
+            begin++;
+            while(end-begin>=4 && memcmp(buffer+begin,"DLT\x01",4)!=0)
+                begin++;
+            continue;
+        }
+
+        int length = DLT_STORAGE_HEADER_SIZE+((data[DLT_STORAGE_HEADER_SIZE+2]<<8) | data[DLT_STORAGE_HEADER_SIZE+3]);
+        if(length<DLT_STORAGE_HEADER_SIZE+4)
+        {
+            errorCounter++;
+            begin += 4;
+            continue;
+        }
+        if(end-begin<length)
+        {
+            if(!fill())
+                return false;
+            continue;
+        }
+
+        begin += length;
+
+        // other messages, e.g. status, are skipped
+        if(decodeDlt(data,length,frame))
+            return true;
+    }
+}
+
+bool DLTCanLogReader::readText(CanFrame &frame)
+{
+    while(true)
+    {
+        const char *line = buffer+begin;
+        const char *newline = (const char*)memchr(line,'\n',end-begin);
+        int length;
+
+        if(newline)
+        {
+            length = newline-line;
+            begin += length+1;
+        }
+        else if(end-begin>=DLT_CAN_LOG_READER_BUFFER)
+        {
+            // line does not fit into the buffer
+            errorCounter++;
+            begin = end;
+            continue;
+        }
+        else if(fill())
+        {
+            continue;
+        }
+        else if(end>begin)
+        {
+            // last line without newline
+            line = buffer+begin;
+            length = end-begin;
+            begin = end;
+        }
+        else
+        {
+            return false;
+        }
+
+        while(length>0 && (line[length-1]=='\r' || line[length-1]==' '))
+            length--;
+        if(length==0)
+            continue;
+
+        if(format==FormatAsc)
+        {
+            // header, events and other bus systems are skipped
+            if(readAscHeader(line,length) || !decodeAsc(line,length,ascDecimal,frame))
+                continue;
+
+            if(ascRelative)
+            {
+                ascTimestamp += frame.timestamp;
+                frame.timestamp = ascTimestamp;
+            }
+            return true;
+        }
+
+        if(decodeCandump(line,length,frame))
+            return true;
+
+        errorCounter++;
+    }
+}
+
+bool DLTCanLogReader::readAscHeader(const char *line,int length)
+{
+    // "base hex|dec  timestamps absolute|relative"
+    if(length<5 || memcmp(line,"base ",5)!=0)
+        return false;
+
+    ascDecimal = contains(line,length," dec");
+    ascRelative = contains(line,length,"relative");
+
+    return true;
+}
+
+bool DLTCanLogReader::decodeDlt(const unsigned char *data,int length,CanFrame &frame)
+{
+    memset(&frame,0,sizeof(frame));
+
+    // Storage Header: pattern, seconds and microseconds little endian, ECU ID
+    frame.timestamp = (quint64)readUInt32(data+4,false)*1000000000ULL + (quint64)readUInt32(data+8,false)*1000ULL;
+
+    const unsigned char *msg = data+DLT_STORAGE_HEADER_SIZE;
+    length -= DLT_STORAGE_HEADER_SIZE;
+
+    // Standard Header: htyp, counter, length, optional ECU ID, session ID and timestamp
+    unsigned char htyp = msg[0];
+    bool bigEndian = htyp&0x02;
+    int pos = 4;
+    if(htyp&0x04)
+        pos += 4;
+    if(htyp&0x08)
+        pos += 4;
+    if(htyp&0x10)
+        pos += 4;
+
+    // frames are always sent as log messages with extended header
+    if(!(htyp&0x01) || pos+10>length)
+        return false;
+    unsigned char msin = msg[pos];
+    int noar = msg[pos+1];
+    pos += 10;
+    if(((msin>>1)&0x07)!=0)
+        return false;
+
+    if(!(msin&0x01))
+    {
+        // Non-Verbose: message id per direction, followed by binary frame
+        if(pos+4>length)
+            return false;
+        quint32 messageId = readUInt32(msg+pos,bigEndian);
+        pos += 4;
+        if(messageId!=DLT_CAN_MESSAGE_ID_RX && messageId!=DLT_CAN_MESSAGE_ID_TX)
+            return false;
+        if(!decodeFrameBinary(msg+pos,length-pos,frame))
+            return false;
+        if(messageId==DLT_CAN_MESSAGE_ID_TX)
+            frame.flags |= CAN_FRAME_FLAG_TX;
+        return true;
+    }
+
+    if(noar==1)
+    {
+        // Verbose Raw: binary frame
+        if(pos+6>length || !(readUInt32(msg+pos,bigEndian)&0x400))
+            return false;
+        int rawLength = readUInt16(msg+pos+4,bigEndian);
+        pos += 6;
+        if(pos+rawLength>length)
+            return false;
+        return decodeFrameBinary(msg+pos,rawLength,frame);
+    }
+
+    if(noar!=3)
+        return false;
+
+    // Verbose Hex Strings: direction, id and payload
+    const char *args[3];
+    int lengths[3];
+    for(int num=0;num<3;num++)
+    {
+        if(pos+6>length || !(readUInt32(msg+pos,bigEndian)&0x200))
+            return false;
+        int argLength = readUInt16(msg+pos+4,bigEndian);
+        pos += 6;
+        if(pos+argLength>length)
+            return false;
+        args[num] = (const char*)msg+pos;
+        lengths[num] = argLength;
+        while(lengths[num]>0 && args[num][lengths[num]-1]==0)
+            lengths[num]--;
+        pos += argLength;
+    }
+
+    if(lengths[0]!=2 || args[0][1]!='x' || (args[0][0]!='R' && args[0][0]!='T'))
+        return false;
+    if(args[0][0]=='T')
+        frame.flags |= CAN_FRAME_FLAG_TX;
+
+    if(lengths[1]<1 || lengths[1]>8)
+        return false;
+    for(int num=0;num<lengths[1];num++)
+    {
+        int value = hexValue(args[1][num]);
+        if(value<0)
+            return false;
+        frame.id = (frame.id<<4) | value;
+    }
+    if(frame.id>CAN_FRAME_ID_MASK)
+        return false;
+    if(frame.id>0x7ff)
+        frame.flags |= CAN_FRAME_FLAG_EXTENDED;
+
+    if((lengths[2]&1) || lengths[2]/2>CAN_FRAME_MAX_DATA)
+        return false;
+    frame.dlc = lengths[2]/2;
+    for(int num=0;num<frame.dlc;num++)
+    {
+        int high = hexValue(args[2][num*2]);
+        int low = hexValue(args[2][num*2+1]);
+        if(high<0 || low<0)
+            return false;
+        frame.data[num] = (quint8)((high<<4) | low);
+    }
+
+    return true;
+}
+
+bool DLTCanLogReader::decodeAsc(const char *line,int length,bool decimal,CanFrame &frame)
+{
+    int pos = 0;
+    int base = decimal ? 10 : 16;
+
+    memset(&frame,0,sizeof(frame));
+
+    // time in s
+    while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+        pos++;
+    int start = pos;
+    quint64 seconds = 0;
+    while(pos<length && line[pos]>='0' && line[pos]<='9')
+        seconds = seconds*10+(line[pos++]-'0');
+    if(pos==start)
+        return false;
+    quint64 nanoseconds = 0;
+    if(pos<length && line[pos]=='.')
+    {
+        pos++;
+        quint64 scale = 100000000;
+        while(pos<length && line[pos]>='0' && line[pos]<='9')
+        {
+            nanoseconds += (line[pos++]-'0')*scale;
+            scale /= 10;
+        }
+    }
+    frame.timestamp = seconds*1000000000ULL+nanoseconds;
+
+    // channel, CAN FD and other events start with a name
+    while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+        pos++;
+    start = pos;
+    while(pos<length && line[pos]>='0' && line[pos]<='9')
+        pos++;
+    if(pos==start || pos>=length || (line[pos]!=' ' && line[pos]!='\t'))
+        return false;
+
+    // id, 29 bit ids end with x
+    while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+        pos++;
+    start = pos;
+    while(pos<length)
+    {
+        int value = hexValue(line[pos]);
+        if(value<0 || value>=base)
+            break;
+        frame.id = frame.id*base+value;
+        if(frame.id>CAN_FRAME_ID_MASK)
+            return false;
+        pos++;
+    }
+    if(pos==start)
+        return false;
+    if(pos<length && line[pos]=='x')
+    {
+        frame.flags |= CAN_FRAME_FLAG_EXTENDED;
+        pos++;
+    }
+    if(pos>=length || (line[pos]!=' ' && line[pos]!='\t'))
+        return false;
+
+    // direction
+    while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+        pos++;
+    if(pos+2>length || line[pos+1]!='x' || (line[pos]!='R' && line[pos]!='T'))
+        return false;
+    if(line[pos]=='T')
+        frame.flags |= CAN_FRAME_FLAG_TX;
+    pos += 2;
+
+    // data or remote frame, followed by the length
+    while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+        pos++;
+    if(pos>=length || (line[pos]!='d' && line[pos]!='r'))
+        return false;
+    bool remote = line[pos++]=='r';
+    while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+        pos++;
+    int dlc = 0;
+    if(pos<length && hexValue(line[pos])>=0)
+        dlc = hexValue(line[pos++]);
+    if(dlc>CAN_FRAME_MAX_DATA_CLASSIC)
+        return false;
+
+    if(remote)
+    {
+        frame.flags |= CAN_FRAME_FLAG_RTR;
+        frame.dlc = dlc;
+        return true;
+    }
+
+    // payload bytes, further fields like length or bit count follow
+    while(frame.dlc<dlc)
+    {
+        while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+            pos++;
+        int value = 0;
+        start = pos;
+        while(pos<length && hexValue(line[pos])>=0 && hexValue(line[pos])<base)
+            value = value*base+hexValue(line[pos++]);
+        if(pos==start || value>0xff)
+            return false;
+        frame.data[frame.dlc++] = (quint8)value;
+    }
+
+    return true;
+}
+
+bool DLTCanLogReader::decodeCandump(const char *line,int length,CanFrame &frame)
+{
+    int pos = 0;
+
+    memset(&frame,0,sizeof(frame));
+
+    // timestamp "(<seconds>.<fraction>)"
+    while(pos<length && (line[pos]==' ' || line[pos]=='\t'))
+        pos++;
+    if(pos>=length || line[pos++]!='(')
+        return false;
+    quint64 seconds = 0;
+    while(pos<length && line[pos]>='0' && line[pos]<='9')
+        seconds = seconds*10+(line[pos++]-'0');
+    quint64 nanoseconds = 0;
+    if(pos<length && line[pos]=='.')
+    {
+        pos++;
+        quint64 scale = 100000000;
+        while(pos<length && line[pos]>='0' && line[pos]<='9')
+        {
+            nanoseconds += (line[pos++]-'0')*scale;
+            scale /= 10;
+        }
+    }
+    if(pos>=length || line[pos++]!=')')
+        return false;
+    frame.timestamp = seconds*1000000000ULL+nanoseconds;
+
+    // interface name
+    while(pos<length && line[pos]==' ')
+        pos++;
+    while(pos<length && line[pos]!=' ')
+        pos++;
+    while(pos<length && line[pos]==' ')
+        pos++;
+
+    // id with 3 hex digits for 11 bit ids and 8 hex digits for 29 bit ids
+    int digits = 0;
+    while(pos<length && line[pos]!='#')
+    {
+        int value = hexValue(line[pos++]);
+        if(value<0 || ++digits>8)
+            return false;
+        frame.id = (frame.id<<4) | value;
+    }
+    if(digits==0 || pos>=length || frame.id>CAN_FRAME_ID_MASK)
+        return false;
+    if(digits>3)
+        frame.flags |= CAN_FRAME_FLAG_EXTENDED;
+    pos++;
+
+    if(pos<length && line[pos]=='#')
+    {
+        // CAN FD: "##<flags><payload>"
+        pos++;
+        if(pos>=length || hexValue(line[pos])<0)
+            return false;
+        pos++;
+        frame.flags |= CAN_FRAME_FLAG_FD;
+    }
+    else if(pos<length && line[pos]=='R')
+    {
+        // remote frame with optional length
+        pos++;
+        frame.flags |= CAN_FRAME_FLAG_RTR;
+        if(pos<length && hexValue(line[pos])>=0 && hexValue(line[pos])<=CAN_FRAME_MAX_DATA_CLASSIC)
+            frame.dlc = hexValue(line[pos++]);
+    }
+
+    // payload, optionally separated by dots
+    while(!(frame.flags&CAN_FRAME_FLAG_RTR) && pos<length && line[pos]!=' ')
+    {
+        if(line[pos]=='.')
+        {
+            pos++;
+            continue;
+        }
+        if(pos+1>=length || frame.dlc>=CAN_FRAME_MAX_DATA)
+            return false;
+        int high = hexValue(line[pos]);
+        int low = hexValue(line[pos+1]);
+        if(high<0 || low<0)
+            return false;
+        frame.data[frame.dlc++] = (quint8)((high<<4) | low);
+        pos += 2;
+    }
+
+    // optional direction of newer candump versions
+    while(pos<length && line[pos]==' ')
+        pos++;
+    if(pos<length && line[pos]=='T')
+        frame.flags |= CAN_FRAME_FLAG_TX;
+
+    return true;
+}
@@ -0,0 +1,107 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanlogreader.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_LOG_READER_H
+#define DLT_CAN_LOG_READER_H
+
+#include <QFile>
+#include <QString>
+
+#include "canframe.h"
+
+// size of the read buffer, larger than the biggest DLT message with storage header
+#define DLT_CAN_LOG_READER_BUFFER 131072
+
+/**
+ * Incremental reader of CAN frames from recorded log files.
+ *
+ * Supported are DLT files with frames in any of the DLT frame encodings of
+ * DLTCan, candump log files and Vector ASC files. The file is read block by
+ * block into one buffer, which is allocated once, so files of any size can
+ * be read.
+ *
+ * The timestamp of each frame is the time of the file in ns, for DLT files
+ * the time of the storage header, for ASC files the time since the start of
+ * the measurement.
+ */
+class DLTCanLogReader
+{
+public:
+    DLTCanLogReader();
+    ~DLTCanLogReader();
+
+    enum Format
+    {
+        FormatUnknown = 0,
+        FormatDlt = 1,
+        FormatCandump = 2,
+        FormatAsc = 3
+    };
+
+    // Open a file, the format is detected from its content
+    bool open(const QString &filename);
+    void close();
+    bool isOpen() const { return file.isOpen(); }
+
+    // Start again at the beginning of the file
+    bool rewind();
+
+    // Next frame of the file, returns false at the end of the file
+    bool readFrame(CanFrame &frame);
+
+    int getFormat() const { return format; }
+
+    // Records of the file, which could not be parsed
+    quint64 getErrorCounter() const { return errorCounter; }
+
+    // Position of the next record and size of the file in bytes
+    qint64 getPosition() const { return file.pos()-(end-begin); }
+    qint64 getSize() const { return file.size(); }
+
+    // Decode one DLT message with storage header, returns false if it contains no frame
+    static bool decodeDlt(const unsigned char *data,int length,CanFrame &frame);
+
+    // Decode one line of a candump log file, e.g. "(1436509052.249713) can0 123#1122334455667788"
+    static bool decodeCandump(const char *line,int length,CanFrame &frame);
+
+    // Decode one line of an ASC file, e.g. "   0.010000 1  123             Rx   d 2 11 22", with ids and bytes in hex or decimal
+    static bool decodeAsc(const char *line,int length,bool decimal,CanFrame &frame);
+
+private:
+
+    bool fill();
+    bool readDlt(CanFrame &frame);
+    bool readText(CanFrame &frame);
+    bool readAscHeader(const char *line,int length);
+
+    QFile file;
+    int format;
+
+    char *buffer;
+    int begin;
+    int end;
+    bool endOfFile;
+
+    // ASC header settings
+    bool ascDecimal;
+    bool ascRelative;
+    quint64 ascTimestamp;
+
+    quint64 errorCounter;
+
+    DLTCanLogReader(const DLTCanLogReader &);
+    DLTCanLogReader &operator=(const DLTCanLogReader &);
+};
+
+#endif // DLT_CAN_LOG_READER_H
@@ -0,0 +1,476 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanlogwriter.cpp
+ * @licence end@
+ */
+
+#include "dltcanlogwriter.h"
+#include "dltcanlogreader.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+#include <QLocale>
+
+#include <string.h>
+
+// upper case hex digits of each byte
+static const char hexPairs[] =
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+// decimal digits of 0 to 99
+static const char decimalPairs[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+static inline char *formatHex(quint8 value,char *line)
+{
+    line[0] = hexPairs[value*2];
+    line[1] = hexPairs[value*2+1];
+    return line+2;
+}
+
+// decimal number with at least width digits
+static char *formatDecimal(quint64 value,int width,char *line)
+{
+    char digits[24];
+    int count = 0;
+
+    // two digits per division, in reverse order
+    while(value>=100)
+    {
+        int index = (int)(value%100)*2;
+        digits[count++] = decimalPairs[index+1];
+        digits[count++] = decimalPairs[index];
+        value /= 100;
+    }
+    if(value>=10)
+    {
+        digits[count++] = decimalPairs[value*2+1];
+        digits[count++] = decimalPairs[value*2];
+    }
+    else
+    {
+        digits[count++] = (char)('0'+value);
+    }
+    while(count<width)
+        digits[count++] = '0';
+
+    while(count>0)
+        *line++ = digits[--count];
+
+    return line;
+}
+
+DLTCanLogWriter::DLTCanLogWriter(int format,QObject *parent) : DLTCanFileWriter("DLTCanLogWriter",format==FormatAsc ? "asc" : "log",parent)
+    , format(format)
+{
+    clearSettings();
+
+    startTimestamp = 0;
+
+    frameCounter = 0;
+    droppedFrames = 0;
+}
+
+DLTCanLogWriter::~DLTCanLogWriter()
+{
+    stop();
+}
+
+void DLTCanLogWriter::startRecording()
+{
+    frameCounter = 0;
+    droppedFrames = 0;
+
+    // candump needs the wall clock, ASC the time since start
+    startTimestamp = DLTCanClock::now();
+    interfaceText = interfaceName.toLatin1().left(DLT_CAN_LOG_WRITER_MAX_LINE/4);
+    header = format==FormatAsc ? ascHeader(QDateTime::currentDateTime()) : QByteArray();
+}
+
+void DLTCanLogWriter::stopRecording()
+{
+    qDebug() << "DLTCanLogWriter: stopped frames" << getFrameCounter() << "bytes" << getWrittenBytes()
+             << "files" << getFileCounter() << "dropped frames" << getDroppedFrames();
+}
+
+void DLTCanLogWriter::writeFrames(const CanFrame *frames,int count)
+{
+    if(!recording)
+        return;
+
+    char line[DLT_CAN_LOG_WRITER_MAX_LINE];
+
+    for(int num=0;num<count;num++)
+    {
+        if(buffer.size()+DLT_CAN_LOG_WRITER_MAX_LINE>bufferSize && !submit())
+        {
+            // writer thread cannot keep up, never wait for the disk
+            frameCounter.fetch_add(num,std::memory_order_relaxed);
+            droppedFrames.fetch_add(count-num,std::memory_order_relaxed);
+            return;
+        }
+
+        const CanFrame &frame = frames[num];
+        int length;
+        if(format==FormatAsc)
+            length = formatAsc(frame,frame.timestamp>startTimestamp ? frame.timestamp-startTimestamp : 0,line);
+        else
+            length = formatCandump(frame,(quint64)((qint64)frame.timestamp+wallClockOffset),interfaceText.constData(),line);
+        buffer.append(line,length);
+    }
+
+    frameCounter.fetch_add(count,std::memory_order_relaxed);
+}
+
+void DLTCanLogWriter::writeBuffer(const char *data,int length)
+{
+    int pos = 0;
+
+    while(pos<length)
+    {
+        int end = length;
+        bool rotate = false;
+
+        if(maxFileSize>0 && fileSize+(length-pos)>maxFileSize)
+        {
+            // split after the last line, which fits into the file
+            rotate = true;
+            end = pos+(int)qMax((qint64)0,qMin((qint64)(length-pos),maxFileSize-fileSize));
+            while(end>pos && data[end-1]!='\n')
+                end--;
+            if(end==pos && fileSize<=header.size())
+            {
+                // line is larger than a file
+                const char *newline = (const char*)memchr(data+pos,'\n',length-pos);
+                end = newline ? newline-data+1 : length;
+            }
+        }
+
+        if(end>pos)
+        {
+            writeData(data+pos,end-pos);
+            pos = end;
+        }
+
+        if(rotate)
+            rotateFile();
+    }
+}
+
+void DLTCanLogWriter::openedFile()
+{
+    if(!header.isEmpty() && file.write(header)==header.size())
+        fileSize += header.size();
+}
+
+void DLTCanLogWriter::closingFile()
+{
+    if(format==FormatAsc)
+        file.write(ascFooter());
+}
+
+int DLTCanLogWriter::formatCandump(const CanFrame &frame,quint64 time,const char *interfaceName,char *line)
+{
+    char *pos = line;
+
+    // "(<seconds>.<microseconds>) <interface> "
+    *pos++ = '(';
+    pos = formatDecimal(time/1000000000ULL,10,pos);
+    *pos++ = '.';
+    pos = formatDecimal((time/1000)%1000000,6,pos);
+    *pos++ = ')';
+    *pos++ = ' ';
+    while(*interfaceName)
+        *pos++ = *interfaceName++;
+    *pos++ = ' ';
+
+    // id with 3 hex digits for 11 bit ids and 8 hex digits for 29 bit ids
+    if(frame.isExtended())
+    {
+        pos = formatHex((quint8)(frame.id>>24),pos);
+        pos = formatHex((quint8)(frame.id>>16),pos);
+        pos = formatHex((quint8)(frame.id>>8),pos);
+    }
+    else
+    {
+        *pos++ = hexPairs[((frame.id>>8)&0x07)*2+1];
+    }
+    pos = formatHex((quint8)frame.id,pos);
+    *pos++ = '#';
+
+    if(frame.flags&CAN_FRAME_FLAG_RTR)
+    {
+        *pos++ = 'R';
+        if(frame.dlc>0)
+            *pos++ = hexPairs[frame.dlc*2+1];
+    }
+    else
+    {
+        // CAN FD frames have a second separator followed by the flags
+        if(frame.flags&CAN_FRAME_FLAG_FD)
+        {
+            *pos++ = '#';
+            *pos++ = '0';
+        }
+        for(int num=0;num<frame.dlc;num++)
+            pos = formatHex(frame.data[num],pos);
+    }
+    *pos++ = '\n';
+
+    return pos-line;
+}
+
+int DLTCanLogWriter::formatAsc(const CanFrame &frame,quint64 time,char *line)
+{
+    char *pos = line;
+
+    // time in s, right aligned with 6 decimals
+    char timeText[32];
+    char *timeEnd = formatDecimal(time/1000000000ULL,1,timeText);
+    *timeEnd++ = '.';
+    timeEnd = formatDecimal((time/1000)%1000000,6,timeEnd);
+    for(int num=timeEnd-timeText;num<11;num++)
+        *pos++ = ' ';
+    memcpy(pos,timeText,timeEnd-timeText);
+    pos += timeEnd-timeText;
+
+    // channel, starting with 1
+    *pos++ = ' ';
+    *pos++ = (char)('1'+(frame.channel<DLT_CAN_CHANNELS_MAX ? frame.channel : 0));
+    *pos++ = ' ';
+    *pos++ = ' ';
+
+    // id in hex without leading zeros, 29 bit ids end with x, padded to 15 characters
+    char *idStart = pos;
+    int digits = 1;
+    while(digits<8 && (frame.id>>(digits*4))!=0)
+        digits++;
+    for(int num=digits-1;num>=0;num--)
+        *pos++ = hexPairs[((frame.id>>(num*4))&0x0f)*2+1];
+    if(frame.isExtended())
+        *pos++ = 'x';
+    while(pos-idStart<15)
+        *pos++ = ' ';
+    *pos++ = ' ';
+
+    *pos++ = frame.isTx() ? 'T' : 'R';
+    *pos++ = 'x';
+    *pos++ = ' ';
+    *pos++ = ' ';
+    *pos++ = ' ';
+
+    // classic CAN lines only, longer payloads are cut
+    int dlc = frame.dlc<=CAN_FRAME_MAX_DATA_CLASSIC ? frame.dlc : CAN_FRAME_MAX_DATA_CLASSIC;
+    if(frame.flags&CAN_FRAME_FLAG_RTR)
+    {
+        *pos++ = 'r';
+        if(dlc>0)
+        {
+            *pos++ = ' ';
+            *pos++ = (char)('0'+dlc);
+        }
+    }
+    else
+    {
+        *pos++ = 'd';
+        *pos++ = ' ';
+        *pos++ = (char)('0'+dlc);
+        for(int num=0;num<dlc;num++)
+        {
+            *pos++ = ' ';
+            pos = formatHex(frame.data[num],pos);
+        }
+    }
+    *pos++ = '\n';
+
+    return pos-line;
+}
+
+QByteArray DLTCanLogWriter::ascHeader(const QDateTime &start)
+{
+    QString date = QLocale(QLocale::English,QLocale::UnitedStates).toString(start,"ddd MMM d hh:mm:ss.zzz ap yyyy");
+
+    QByteArray text;
+    text += "date " + date.toLatin1() + "\n";
+    text += "base hex  timestamps absolute\n";
+    text += "no internal events logged\n";
+    text += "Begin Triggerblock " + date.toLatin1() + "\n";
+
+    return text;
+}
+
+QByteArray DLTCanLogWriter::ascFooter()
+{
+    return QByteArray("End TriggerBlock\n");
+}
+
+bool DLTCanLogWriter::convert(const QString &input,const QString &output)
+{
+    DLTCanLogReader reader;
+    if(!reader.open(input))
+    {
+        qDebug() << "DLTCanLogWriter: cannot read" << input;
+        return false;
+    }
+
+    QFile file(output);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "DLTCanLogWriter: cannot write" << output;
+        return false;
+    }
+
+    bool asc = output.endsWith(".asc",Qt::CaseInsensitive);
+    QByteArray buffer;
+    buffer.reserve(DLT_CAN_FILE_WRITER_BUFFER_MIN+DLT_CAN_LOG_WRITER_MAX_LINE);
+    char line[DLT_CAN_LOG_WRITER_MAX_LINE];
+    quint64 count = 0;
+
+    // ASC times start with the first frame, ASC input keeps its times
+    CanFrame frame;
+    bool available = reader.readFrame(frame);
+    quint64 start = available && reader.getFormat()!=DLTCanLogReader::FormatAsc ? frame.timestamp : 0;
+    if(asc)
+        buffer += ascHeader(start ? QDateTime::fromMSecsSinceEpoch(start/1000000) : QDateTime::currentDateTime());
+
+    while(available)
+    {
+        int length;
+        if(asc)
+            length = formatAsc(frame,frame.timestamp>start ? frame.timestamp-start : 0,line);
+        else
+            length = formatCandump(frame,frame.timestamp,"can0",line);
+        buffer.append(line,length);
+        count++;
+
+        if(buffer.size()>=DLT_CAN_FILE_WRITER_BUFFER_MIN)
+        {
+            file.write(buffer);
+            buffer.resize(0);
+        }
+
+        available = reader.readFrame(frame);
+    }
+
+    if(asc)
+        buffer += ascFooter();
+    bool ok = file.write(buffer)==buffer.size();
+    file.close();
+
+    qDebug() << "DLTCanLogWriter: converted" << count << "frames from" << input << "to" << output << "errors" << reader.getErrorCounter();
+
+    return ok;
+}
+
+QString DLTCanLogWriter::elementName() const
+{
+    return format==FormatAsc ? QString("DLTCanAscWriter") : QString("DLTCanCandumpWriter");
+}
+
+void DLTCanLogWriter::clearSettings()
+{
+    active = false;
+    path = "";
+    prefix = "DLTCan";
+    interfaceName = "can0";
+    bufferSize = 1024*1024;
+    maxFileSize = 0;
+}
+
+void DLTCanLogWriter::writeSettings(QXmlStreamWriter &xml)
+{
+    /* Write project settings */
+    xml.writeStartElement(elementName());
+        xml.writeTextElement("active",QString("%1").arg(active));
+        xml.writeTextElement("path",path);
+        xml.writeTextElement("prefix",prefix);
+        if(format==FormatCandump)
+            xml.writeTextElement("interfaceName",interfaceName);
+        xml.writeTextElement("bufferSize",QString("%1").arg(bufferSize));
+        xml.writeTextElement("maxFileSize",QString("%1").arg(maxFileSize));
+    xml.writeEndElement(); // DLTCanCandumpWriter or DLTCanAscWriter
+}
+
+void DLTCanLogWriter::readSettings(const QString &filename)
+{
+    bool isElement = false;
+    QString element = elementName();
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(isElement)
+              {
+                  /* Project settings */
+                  if(xml.name() == QString("active"))
+                  {
+                      active = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("path"))
+                  {
+                      path = xml.readElementText();
+                  }
+                  else if(xml.name() == QString("prefix"))
+                  {
+                      prefix = xml.readElementText();
+                  }
+                  else if(xml.name() == QString("interfaceName"))
+                  {
+                      interfaceName = xml.readElementText();
+                  }
+                  else if(xml.name() == QString("bufferSize"))
+                  {
+                      bufferSize = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("maxFileSize"))
+                  {
+                      maxFileSize = xml.readElementText().toLongLong();
+                  }
+              }
+              else if(xml.name() == element)
+              {
+                    isElement = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == element)
+              {
+                    isElement = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+}
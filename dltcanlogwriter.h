@@ -0,0 +1,110 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanlogwriter.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_LOG_WRITER_H
+#define DLT_CAN_LOG_WRITER_H
+
+#include <QDateTime>
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include "canframe.h"
+#include "dltcanfilewriter.h"
+
+// maximum length of one formatted frame
+#define DLT_CAN_LOG_WRITER_MAX_LINE 256
+
+/**
+ * Recording of CAN frames into candump log or Vector ASC files.
+ *
+ * Frames are taken directly from the capture, not from the DLT messages.
+ * Each frame is formatted with lookup tables into the buffer of
+ * DLTCanFileWriter, which writes it in its writer thread. If all buffers
+ * are still being written, new frames are dropped and counted.
+ *
+ * A new file is started when the maximum size of a file is reached, files
+ * are only split between lines. ASC files of one recording share the start
+ * time of the header, so the timestamps continue in the next file.
+ */
+class DLTCanLogWriter : public DLTCanFileWriter
+{
+    Q_OBJECT
+public:
+
+    enum Format
+    {
+        FormatCandump = 0,  // "(<s>.<us>) <interface> <id>#<payload>"
+        FormatAsc = 1       // Vector ASC with hex ids and absolute timestamps
+    };
+
+    explicit DLTCanLogWriter(int format,QObject *parent = nullptr);
+    ~DLTCanLogWriter();
+
+    // Add received and sent frames
+    void writeFrames(const CanFrame *frames,int count);
+
+    int getFormat() const { return format; }
+
+    // Interface name of candump lines
+    QString getInterfaceName() { return interfaceName; }
+    void setInterfaceName(QString name) { this->interfaceName = name; }
+
+    // Statistics since start
+    quint64 getFrameCounter() const { return frameCounter.load(std::memory_order_relaxed); }
+    quint64 getDroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+
+    void clearSettings();
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename);
+
+    // Format one frame with the time in ns, returns the length of the line
+    static int formatCandump(const CanFrame &frame,quint64 time,const char *interfaceName,char *line);
+    static int formatAsc(const CanFrame &frame,quint64 time,char *line);
+
+    // Header and footer of an ASC file with the start time of the recording
+    static QByteArray ascHeader(const QDateTime &start);
+    static QByteArray ascFooter();
+
+    // Convert a DLT, candump or ASC file into a candump or ASC file, the format is selected by the extension .asc
+    static bool convert(const QString &input,const QString &output);
+
+protected:
+
+    void startRecording() override;
+    void stopRecording() override;
+    void writeBuffer(const char *data,int length) override;
+    void openedFile() override;
+    void closingFile() override;
+
+private:
+
+    QString elementName() const;
+
+    int format;
+
+    // Settings
+    QString interfaceName;
+
+    // Producer
+    quint64 startTimestamp;    // monotonic clock at start, time 0 of ASC files
+    QByteArray interfaceText;
+
+    // Writer thread
+    QByteArray header;
+
+    std::atomic<quint64> frameCounter;
+    std::atomic<quint64> droppedFrames;
+};
+
+#endif // DLT_CAN_LOG_WRITER_H
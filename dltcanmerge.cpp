@@ -0,0 +1,224 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanmerge.cpp
+ * @licence end@
+ */
+
+#include "dltcanmerge.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+
+DLTCanMerge::DLTCanMerge(QObject *parent) : QObject(parent)
+    , timer(this)
+{
+    batchCount = 0;
+    lastReleased = 0;
+    frameCounter = 0;
+    lateCounter = 0;
+    forcedCounter = 0;
+
+    clearSettings();
+
+    connect(&timer, SIGNAL(timeout()), this, SLOT(timeout()));
+}
+
+DLTCanMerge::~DLTCanMerge()
+{
+}
+
+void DLTCanMerge::start()
+{
+    // queues are only allocated while merging
+    queues.resize(channelCount);
+    for(int num=0;num<channelCount;num++)
+    {
+        queues[num].head = 0;
+        queues[num].count = 0;
+    }
+
+    batchCount = 0;
+    lastReleased = 0;
+    frameCounter = 0;
+    lateCounter = 0;
+    forcedCounter = 0;
+
+    // frames of a quiet bus are released at the latest half a window late
+    timer.start(qMax(1,reorderWindow/2));
+}
+
+void DLTCanMerge::stop()
+{
+    timer.stop();
+
+    release(~(quint64)0);
+
+    std::vector<Queue>().swap(queues);
+}
+
+void DLTCanMerge::push(const CanFrame *frames,int count)
+{
+    if(queues.empty())
+        return;
+
+    for(int num=0;num<count;num++)
+    {
+        const CanFrame &frame = frames[num];
+        Queue &queue = queues[frame.channel<(int)queues.size() ? frame.channel : 0];
+
+        if(queue.count==DLT_CAN_MERGE_QUEUE_SIZE)
+        {
+            // release up to the oldest frame of the full queue
+            release(queue.frames[queue.head].timestamp);
+            forcedCounter++;
+        }
+
+        queue.frames[(queue.head+queue.count)%DLT_CAN_MERGE_QUEUE_SIZE] = frame;
+        queue.count++;
+    }
+
+    timeout();
+}
+
+void DLTCanMerge::timeout()
+{
+    quint64 now = DLTCanClock::now();
+    quint64 window = (quint64)reorderWindow*1000000;
+
+    if(now>window)
+        release(now-window);
+}
+
+void DLTCanMerge::release(quint64 limit)
+{
+    // min-heap of the oldest frame of each channel
+    int heapSize = 0;
+    for(int num=0;num<(int)queues.size();num++)
+    {
+        if(queues[num].count>0)
+        {
+            heap[heapSize].timestamp = queues[num].frames[queues[num].head].timestamp;
+            heap[heapSize].channel = num;
+            heapSize++;
+        }
+    }
+    std::make_heap(heap,heap+heapSize);
+
+    while(heapSize>0 && heap[0].timestamp<=limit)
+    {
+        std::pop_heap(heap,heap+heapSize);
+        heapSize--;
+
+        int channel = heap[heapSize].channel;
+        Queue &queue = queues[channel];
+        const CanFrame &frame = queue.frames[queue.head];
+
+        if(frame.timestamp<lastReleased)
+            lateCounter++;
+        else
+            lastReleased = frame.timestamp;
+
+        batch[batchCount++] = frame;
+        if(batchCount==DLT_CAN_MERGE_BATCH)
+            flushBatch();
+
+        queue.head = (queue.head+1)%DLT_CAN_MERGE_QUEUE_SIZE;
+        queue.count--;
+
+        if(queue.count>0)
+        {
+            heap[heapSize].timestamp = queue.frames[queue.head].timestamp;
+            heap[heapSize].channel = channel;
+            heapSize++;
+            std::push_heap(heap,heap+heapSize);
+        }
+    }
+
+    flushBatch();
+}
+
+void DLTCanMerge::flushBatch()
+{
+    if(batchCount==0)
+        return;
+
+    frameCounter += batchCount;
+
+    frames(batch,batchCount);
+    batchCount = 0;
+}
+
+void DLTCanMerge::clearSettings()
+{
+    channelCount = 1;
+    reorderWindow = DLT_CAN_MERGE_WINDOW_DEFAULT;
+}
+
+void DLTCanMerge::writeSettings(QXmlStreamWriter &xml)
+{
+    /* Write project settings */
+    xml.writeStartElement("DLTCanChannels");
+        xml.writeTextElement("count",QString("%1").arg(channelCount));
+        xml.writeTextElement("reorderWindow",QString("%1").arg(reorderWindow));
+    xml.writeEndElement(); // DLTCanChannels
+}
+
+void DLTCanMerge::readSettings(const QString &filename)
+{
+    bool isDLTCanChannels = false;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(isDLTCanChannels)
+              {
+                  /* Project settings */
+                  if(xml.name() == QString("count"))
+                  {
+                      setChannelCount(xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("reorderWindow"))
+                  {
+                      reorderWindow = xml.readElementText().toInt();
+                  }
+              }
+              else if(xml.name() == QString("DLTCanChannels"))
+              {
+                    isDLTCanChannels = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == QString("DLTCanChannels"))
+              {
+                    isDLTCanChannels = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+}
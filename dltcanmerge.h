@@ -0,0 +1,126 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanmerge.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_MERGE_H
+#define DLT_CAN_MERGE_H
+
+#include <QObject>
+#include <QTimer>
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include <vector>
+
+#include "canframe.h"
+
+// number of frames of each channel held within the reorder window
+#define DLT_CAN_MERGE_QUEUE_SIZE 8192
+
+// maximum number of merged frames forwarded at once
+#define DLT_CAN_MERGE_BATCH 64
+
+// default reorder window in ms
+#define DLT_CAN_MERGE_WINDOW_DEFAULT 20
+
+/**
+ * Merge of the frames of several capture channels in timestamp order.
+ *
+ * Each channel has its own queue. Frames are held for the reorder window,
+ * so frames of a channel which is read later can still be sorted in. Frames
+ * older than the window are released with a k-way merge over the heads of
+ * the queues, using a min-heap ordered by timestamp.
+ *
+ * A frame which arrives after a later frame was already released is
+ * forwarded at once and counted as late. If the queue of a channel is full,
+ * frames are released early and counted as forced, so the memory is bounded.
+ */
+class DLTCanMerge : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DLTCanMerge(QObject *parent = nullptr);
+    ~DLTCanMerge();
+
+    void start();
+    // Release all frames which are still held
+    void stop();
+
+    // Number of capture channels, up to DLT_CAN_CHANNELS_MAX
+    int getChannelCount() { return channelCount; }
+    void setChannelCount(int value) { this->channelCount = qBound(1,value,DLT_CAN_CHANNELS_MAX); }
+
+    // Time in ms a frame is held for sorting
+    int getReorderWindow() { return reorderWindow; }
+    void setReorderWindow(int value) { this->reorderWindow = value; }
+
+    // Statistics since start
+    quint64 getFrameCounter() const { return frameCounter; }
+    quint64 getLateCounter() const { return lateCounter; }
+    quint64 getForcedCounter() const { return forcedCounter; }
+
+    void clearSettings();
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename);
+
+signals:
+
+    // Batch of merged frames, only valid during the call
+    void frames(const CanFrame *frames,int count);
+
+public slots:
+
+    void push(const CanFrame *frames,int count);
+
+private slots:
+
+    void timeout();
+
+private:
+
+    struct Queue
+    {
+        CanFrame frames[DLT_CAN_MERGE_QUEUE_SIZE];
+        int head;
+        int count;
+    };
+
+    struct Head
+    {
+        quint64 timestamp;
+        int channel;
+
+        // min-heap with the standard heap functions
+        bool operator<(const Head &other) const { return timestamp>other.timestamp; }
+    };
+
+    void release(quint64 limit);
+    void flushBatch();
+
+    // Settings
+    int channelCount;
+    int reorderWindow;
+
+    std::vector<Queue> queues;   // allocated at start
+    Head heap[DLT_CAN_CHANNELS_MAX];
+    CanFrame batch[DLT_CAN_MERGE_BATCH];
+    int batchCount;
+    quint64 lastReleased;
+    QTimer timer;
+
+    quint64 frameCounter;
+    quint64 lateCounter;
+    quint64 forcedCounter;
+};
+
+#endif // DLT_CAN_MERGE_H
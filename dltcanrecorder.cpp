@@ -0,0 +1,225 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanrecorder.cpp
+ * @licence end@
+ */
+
+#include "dltcanrecorder.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+
+#include <string.h>
+
+DLTCanRecorder::DLTCanRecorder(QObject *parent) : DLTCanFileWriter("DLTCanRecorder","dlt",parent)
+{
+    clearSettings();
+
+    memset(storageEcuId,0,sizeof(storageEcuId));
+
+    messageCounter = 0;
+    droppedMessages = 0;
+}
+
+DLTCanRecorder::~DLTCanRecorder()
+{
+    stop();
+}
+
+void DLTCanRecorder::startRecording()
+{
+    messageCounter = 0;
+    droppedMessages = 0;
+
+    for(int num=0;num<4;num++)
+        storageEcuId[num] = num<ecuId.length()?ecuId[num].toLatin1():0;
+}
+
+void DLTCanRecorder::stopRecording()
+{
+    qDebug() << "DLTCanRecorder: stopped messages" << getMessageCounter() << "bytes" << getWrittenBytes()
+             << "files" << getFileCounter() << "dropped messages" << getDroppedMessages();
+}
+
+void DLTCanRecorder::writeMessage(const char *data,int length,quint64 timestamp)
+{
+    if(!recording)
+        return;
+
+    if(!buffer.isEmpty() && buffer.size()+DLT_STORAGE_HEADER_SIZE+length>bufferSize && !submit())
+    {
+        // writer thread cannot keep up, never wait for the disk
+        droppedMessages.fetch_add(1,std::memory_order_relaxed);
+        return;
+    }
+
+    // Storage Header (16 Byte): pattern, seconds, microseconds, ECU ID
+    qint64 time = (qint64)timestamp + wallClockOffset;
+    quint32 seconds = (quint32)(time/1000000000LL);
+    quint32 microseconds = (quint32)((time/1000)%1000000);
+    char header[DLT_STORAGE_HEADER_SIZE];
+    header[0] = 'D';
+    header[1] = 'L';
+    header[2] = 'T';
+    header[3] = 0x01;
+    header[4] = (char)(seconds&0xff); // seconds, little endian
+    header[5] = (char)((seconds>>8)&0xff);
+    header[6] = (char)((seconds>>16)&0xff);
+    header[7] = (char)((seconds>>24)&0xff);
+    header[8] = (char)(microseconds&0xff); // microseconds, little endian
+    header[9] = (char)((microseconds>>8)&0xff);
+    header[10] = (char)((microseconds>>16)&0xff);
+    header[11] = (char)((microseconds>>24)&0xff);
+    memcpy(header+12,storageEcuId,4); // ECU ID
+
+    buffer.append(header,DLT_STORAGE_HEADER_SIZE);
+    buffer.append(data,length);
+
+    messageCounter.fetch_add(1,std::memory_order_relaxed);
+}
+
+void DLTCanRecorder::writeBuffer(const char *data,int length)
+{
+    int pos = 0;
+
+    while(pos<length)
+    {
+        bool rotate = maxFileTime>0 && DLTCanClock::now()-fileStart>=(quint64)maxFileTime*1000000000ULL;
+
+        // split only between messages, the length is in the standard header after the storage header
+        int end = pos;
+        while(end<length)
+        {
+            int messageLength = ((unsigned char)data[end+DLT_STORAGE_HEADER_SIZE+2]<<8) | (unsigned char)data[end+DLT_STORAGE_HEADER_SIZE+3];
+            int size = DLT_STORAGE_HEADER_SIZE+messageLength;
+            if(maxFileSize>0 && fileSize+(end-pos)+size>maxFileSize && fileSize+(end-pos)>0)
+            {
+                rotate = true;
+                break;
+            }
+            end += size;
+        }
+
+        if(end>pos)
+        {
+            writeData(data+pos,end-pos);
+            pos = end;
+        }
+
+        if(rotate)
+            rotateFile();
+    }
+
+    if(syncPolicy==SyncBuffer)
+        sync();
+}
+
+void DLTCanRecorder::closingFile()
+{
+    file.flush();
+    if(syncPolicy==SyncFile || syncPolicy==SyncBuffer)
+        sync();
+}
+
+void DLTCanRecorder::clearSettings()
+{
+    active = false;
+    path = "";
+    prefix = "DLTCan";
+    bufferSize = 4*1024*1024;
+    maxFileSize = 0;
+    maxFileTime = 0;
+    syncPolicy = SyncFile;
+    ecuId = "ECU1";
+}
+
+void DLTCanRecorder::writeSettings(QXmlStreamWriter &xml)
+{
+    /* Write project settings */
+    xml.writeStartElement("DLTCanRecorder");
+        xml.writeTextElement("active",QString("%1").arg(active));
+        xml.writeTextElement("path",path);
+        xml.writeTextElement("prefix",prefix);
+        xml.writeTextElement("bufferSize",QString("%1").arg(bufferSize));
+        xml.writeTextElement("maxFileSize",QString("%1").arg(maxFileSize));
+        xml.writeTextElement("maxFileTime",QString("%1").arg(maxFileTime));
+        xml.writeTextElement("syncPolicy",QString("%1").arg(syncPolicy));
+    xml.writeEndElement(); // DLTCanRecorder
+}
+
+void DLTCanRecorder::readSettings(const QString &filename)
+{
+    bool isDLTCanRecorder = false;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(isDLTCanRecorder)
+              {
+                  /* Project settings */
+                  if(xml.name() == QString("active"))
+                  {
+                      active = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("path"))
+                  {
+                      path = xml.readElementText();
+                  }
+                  else if(xml.name() == QString("prefix"))
+                  {
+                      prefix = xml.readElementText();
+                  }
+                  else if(xml.name() == QString("bufferSize"))
+                  {
+                      bufferSize = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("maxFileSize"))
+                  {
+                      maxFileSize = xml.readElementText().toLongLong();
+                  }
+                  else if(xml.name() == QString("maxFileTime"))
+                  {
+                      maxFileTime = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("syncPolicy"))
+                  {
+                      syncPolicy = xml.readElementText().toInt();
+                  }
+              }
+              else if(xml.name() == QString("DLTCanRecorder"))
+              {
+                    isDLTCanRecorder = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == QString("DLTCanRecorder"))
+              {
+                    isDLTCanRecorder = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+}
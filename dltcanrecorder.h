@@ -0,0 +1,95 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanrecorder.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_RECORDER_H
+#define DLT_CAN_RECORDER_H
+
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include "dltcanfilewriter.h"
+
+// size of the storage header in front of each DLT message in a file
+#define DLT_STORAGE_HEADER_SIZE 16
+
+/**
+ * Recording of the DLT messages into DLT files.
+ *
+ * Each message gets a storage header with the wall clock time of the frame
+ * and is appended to the buffer of DLTCanFileWriter, which writes it in its
+ * writer thread. If all buffers are still being written, new messages are
+ * dropped and counted.
+ *
+ * A new file is started when the maximum size or time of a file is reached.
+ * Files are only split between messages.
+ */
+class DLTCanRecorder : public DLTCanFileWriter
+{
+    Q_OBJECT
+public:
+    explicit DLTCanRecorder(QObject *parent = nullptr);
+    ~DLTCanRecorder();
+
+    // Behaviour of the data written into the file
+    enum SyncPolicy
+    {
+        SyncNone = 0,       // left to the operating system
+        SyncFile = 1,       // synced when a file is closed
+        SyncBuffer = 2      // synced after each written buffer
+    };
+
+    // Add one DLT message with the timestamp of the monotonic clock in ns
+    void writeMessage(const char *data,int length,quint64 timestamp);
+
+    // Maximum time of a file in s, 0 is unlimited
+    int getMaxFileTime() { return maxFileTime; }
+    void setMaxFileTime(int value) { this->maxFileTime = value; }
+
+    int getSyncPolicy() { return syncPolicy; }
+    void setSyncPolicy(int value) { this->syncPolicy = value; }
+
+    // ECU ID of the storage header
+    QString getEcuId() { return ecuId; }
+    void setEcuId(QString id) { this->ecuId = id; }
+
+    // Statistics since start
+    quint64 getMessageCounter() const { return messageCounter.load(std::memory_order_relaxed); }
+    quint64 getDroppedMessages() const { return droppedMessages.load(std::memory_order_relaxed); }
+
+    void clearSettings();
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename);
+
+protected:
+
+    void startRecording() override;
+    void stopRecording() override;
+    void writeBuffer(const char *data,int length) override;
+    void closingFile() override;
+
+private:
+
+    // Settings
+    int maxFileTime;
+    int syncPolicy;
+    QString ecuId;
+
+    // Producer
+    char storageEcuId[4];
+
+    std::atomic<quint64> messageCounter;
+    std::atomic<quint64> droppedMessages;
+};
+
+#endif // DLT_CAN_RECORDER_H
@@ -0,0 +1,360 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanreplay.cpp
+ * @licence end@
+ */
+
+#include "dltcanreplay.h"
+#include "dltcanbackend.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <QFile>
+
+#include <chrono>
+
+void DLTCanReplayThread::run()
+{
+    replay->run();
+}
+
+DLTCanReplay::DLTCanReplay(QObject *parent) : QObject(parent)
+    , thread(this)
+{
+    clearSettings();
+
+    running = false;
+    notified = false;
+
+    runSpeed = 1.0;
+    runLoop = false;
+    fileStarted = false;
+    fileStart = 0;
+    offset = 0;
+    lastDeadline = 0;
+    fastCount = 0;
+    passFrames = 0;
+
+    frameCounter = 0;
+    filteredCounter = 0;
+    errorCounter = 0;
+    loopCounter = 0;
+    timingErrorSum = 0;
+    timingErrorMax = 0;
+    startTime = 0;
+    lastTime = 0;
+    progress = 0;
+
+    thread.setObjectName("DLTCanReplay");
+}
+
+DLTCanReplay::~DLTCanReplay()
+{
+    stop();
+}
+
+void DLTCanReplay::start()
+{
+    if(running)
+        return;
+
+    // replay of the last start has finished by itself
+    thread.wait();
+
+    frameCounter = 0;
+    filteredCounter = 0;
+    errorCounter = 0;
+    loopCounter = 0;
+    timingErrorSum = 0;
+    timingErrorMax = 0;
+    startTime = 0;
+    lastTime = 0;
+    progress = 0;
+
+    // settings are only read by the timing thread while it is running
+    runFileName = fileName;
+    runFilter = filter;
+    runFilter.clearStatistics();
+    runSpeed = speed>0 ? speed : 0;
+    runLoop = loop;
+
+    running = true;
+    thread.start(QThread::TimeCriticalPriority);
+}
+
+void DLTCanReplay::stop()
+{
+    {
+        QMutexLocker locker(&mutex);
+
+        running = false;
+        condition.wakeAll();
+    }
+
+    thread.wait();
+}
+
+quint64 DLTCanReplay::getTimingErrorAverage() const
+{
+    quint64 frames = getFrameCounter();
+
+    return frames ? timingErrorSum.load(std::memory_order_relaxed)/frames : 0;
+}
+
+double DLTCanReplay::getRate() const
+{
+    quint64 start = startTime.load(std::memory_order_relaxed);
+    quint64 last = lastTime.load(std::memory_order_relaxed);
+
+    if(last<=start)
+        return 0;
+
+    return (double)getFrameCounter()*1000000000.0/(last-start);
+}
+
+int DLTCanReplay::readFrames(CanFrame *frames,int maxFrames)
+{
+    // reset before reading, so frames pushed afterwards are signaled again
+    notified.store(false);
+
+    return ring.pop(frames,maxFrames);
+}
+
+void DLTCanReplay::run()
+{
+    DLTCanLogReader reader;
+
+    if(!reader.open(runFileName))
+    {
+        qDebug() << "DLTCanReplay: cannot open" << runFileName;
+        status("replay error");
+        running = false;
+        return;
+    }
+
+    qDebug() << "DLTCanReplay: started" << runFileName << "speed" << runSpeed << "loop" << runLoop;
+    status("replay started");
+
+    fileStarted = false;
+    lastDeadline = 0;
+    fastCount = 0;
+    passFrames = 0;
+
+    CanFrame frame;
+    quint64 deadline;
+    bool available = next(reader,frame,deadline);
+
+    QMutexLocker locker(&mutex);
+
+    while(running && available)
+    {
+        // sleep until the absolute deadline, woken up early by stop
+        quint64 now = DLTCanClock::now();
+        if(deadline>now)
+        {
+            condition.wait(&mutex,QDeadlineTimer(std::chrono::nanoseconds(deadline-now),Qt::PreciseTimer));
+            continue;
+        }
+
+        locker.unlock();
+
+        // all frames due now are sent in one batch
+        int count = 0;
+        quint64 timingError = 0;
+        while(available && count<DLT_CAN_REPLAY_BATCH && deadline<=now)
+        {
+            timingError += now-deadline;
+            if(now-deadline>timingErrorMax.load(std::memory_order_relaxed))
+                timingErrorMax.store(now-deadline,std::memory_order_relaxed);
+
+            batch[count] = frame;
+            batch[count].timestamp = now;
+            batch[count].flags |= CAN_FRAME_FLAG_TX;
+            if(batch[count].dlc>CAN_FRAME_MAX_DATA_CLASSIC)
+                batch[count].dlc = CAN_FRAME_MAX_DATA_CLASSIC;
+            count++;
+
+            available = next(reader,frame,deadline);
+        }
+
+        sendFrames(DLTCanBackend::packFrames(batch,count));
+
+        bool pushed = false;
+        for(int num=0;num<count;num++)
+            pushed |= ring.push(batch[num]);
+        if(pushed && !notified.exchange(true))
+            framesAvailable();
+
+        if(startTime.load(std::memory_order_relaxed)==0)
+            startTime.store(now,std::memory_order_relaxed);
+        lastTime.store(now,std::memory_order_relaxed);
+        frameCounter.fetch_add(count,std::memory_order_relaxed);
+        timingErrorSum.fetch_add(timingError,std::memory_order_relaxed);
+        errorCounter.store(reader.getErrorCounter(),std::memory_order_relaxed);
+        if(reader.getSize()>0)
+            progress.store((int)(reader.getPosition()*100/reader.getSize()),std::memory_order_relaxed);
+
+        locker.relock();
+    }
+
+    bool finished = running;
+    running = false;
+
+    locker.unlock();
+
+    qDebug() << "DLTCanReplay: stopped frames" << getFrameCounter() << "filtered" << getFilteredCounter() << "errors" << getErrorCounter()
+             << "loops" << getLoopCounter() << "rate" << getRate() << "timing error avg" << getTimingErrorAverage()/1000
+             << "max" << getTimingErrorMax()/1000 << "us";
+    if(finished)
+        status("replay finished");
+}
+
+bool DLTCanReplay::next(DLTCanLogReader &reader,CanFrame &frame,quint64 &deadline)
+{
+    while(true)
+    {
+        if(!reader.readFrame(frame))
+        {
+            errorCounter.store(reader.getErrorCounter(),std::memory_order_relaxed);
+
+            // a file without replayed frames is not looped
+            if(!runLoop || passFrames==0 || !running || !reader.rewind())
+                return false;
+
+            loopCounter.fetch_add(1,std::memory_order_relaxed);
+            fileStarted = false;
+            passFrames = 0;
+            continue;
+        }
+
+        // sent frames of the recording were not on the bus before
+        if(frame.isTx() || (runFilter.isActive() && !runFilter.accept(frame)))
+        {
+            filteredCounter.fetch_add(1,std::memory_order_relaxed);
+            continue;
+        }
+
+        // next pass continues at the last deadline of the previous pass
+        if(!fileStarted)
+        {
+            fileStart = frame.timestamp;
+            offset = lastDeadline ? lastDeadline : DLTCanClock::now();
+            fastCount = 0;
+            fileStarted = true;
+        }
+
+        if(runSpeed>0)
+        {
+            // time of the file relative to the first frame, earlier frames are due immediately
+            quint64 delta = frame.timestamp>fileStart ? frame.timestamp-fileStart : 0;
+            deadline = offset+(quint64)(delta/runSpeed);
+            if(deadline<lastDeadline)
+                deadline = lastDeadline;
+        }
+        else
+        {
+            // one batch per interval
+            deadline = offset+(fastCount++/DLT_CAN_REPLAY_BATCH)*(quint64)DLT_CAN_REPLAY_FAST_INTERVAL;
+        }
+
+        lastDeadline = deadline;
+        passFrames++;
+
+        return true;
+    }
+}
+
+void DLTCanReplay::clearSettings()
+{
+    active = false;
+    fileName = "";
+    speed = 1.0;
+    loop = false;
+    filter.clear();
+    filter.setActive(true);
+}
+
+void DLTCanReplay::writeSettings(QXmlStreamWriter &xml)
+{
+    /* Write project settings */
+    xml.writeStartElement("DLTCanReplay");
+        xml.writeTextElement("active",QString("%1").arg(active));
+        xml.writeTextElement("fileName",fileName);
+        xml.writeTextElement("speed",QString("%1").arg(speed));
+        xml.writeTextElement("loop",QString("%1").arg(loop));
+        filter.writeSettings(xml);
+    xml.writeEndElement(); // DLTCanReplay
+}
+
+void DLTCanReplay::readSettings(const QString &filename)
+{
+    bool isDLTCanReplay = false;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(isDLTCanReplay)
+              {
+                  /* Project settings */
+                  if(xml.name() == QString("active"))
+                  {
+                      active = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("fileName"))
+                  {
+                      fileName = xml.readElementText();
+                  }
+                  else if(xml.name() == QString("speed"))
+                  {
+                      speed = xml.readElementText().toDouble();
+                  }
+                  else if(xml.name() == QString("loop"))
+                  {
+                      loop = xml.readElementText().toInt();
+                  }
+                  else if(xml.name() == QString("filters"))
+                  {
+                      // read by the filter
+                      xml.skipCurrentElement();
+                  }
+              }
+              else if(xml.name() == QString("DLTCanReplay"))
+              {
+                    isDLTCanReplay = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == QString("DLTCanReplay"))
+              {
+                    isDLTCanReplay = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+
+    filter.readSettings(filename,"DLTCanReplay");
+}
@@ -0,0 +1,172 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanreplay.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_REPLAY_H
+#define DLT_CAN_REPLAY_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include <atomic>
+
+#include "canframe.h"
+#include "dltcanfilter.h"
+#include "dltcanlogreader.h"
+#include "dltcanring.h"
+
+// maximum number of due frames sent at once
+#define DLT_CAN_REPLAY_BATCH 16
+
+// number of sent frames buffered until they are forwarded
+#define DLT_CAN_REPLAY_RING_SIZE 1024
+
+// interval in ns between two batches if replayed as fast as possible,
+// about the frame rate of a fully loaded 1 Mbit/s bus
+#define DLT_CAN_REPLAY_FAST_INTERVAL 2000000
+
+class DLTCanReplay;
+
+class DLTCanReplayThread : public QThread
+{
+public:
+    explicit DLTCanReplayThread(DLTCanReplay *replay) : replay(replay) {}
+
+protected:
+    void run() override;
+
+private:
+    DLTCanReplay *replay;
+};
+
+/**
+ * Replay of received frames from a recorded DLT, candump or ASC file.
+ *
+ * The file is read incrementally by a timing thread. Each frame gets an
+ * absolute deadline on the monotonic clock from its time in the file,
+ * divided by the speed factor, so the replay does not drift. All frames due
+ * at the same time are sent by the backend in one batch, the sent
+ * frames are passed back through a lock-free ring for forwarding.
+ *
+ * Sent frames of the file are not replayed. The filter is copied at start,
+ * changes take effect with the next start.
+ */
+class DLTCanReplay : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DLTCanReplay(QObject *parent = nullptr);
+    ~DLTCanReplay();
+
+    void start();
+    void stop();
+    bool isRunning() const { return running; }
+
+    // Start replay with the communication
+    bool getActive() { return active; }
+    void setActive(bool active) { this->active = active; }
+
+    // DLT, candump or ASC file
+    QString getFileName() { return fileName; }
+    void setFileName(QString fileName) { this->fileName = fileName; }
+
+    // Factor of the original timing, 0 replays as fast as possible
+    double getSpeed() { return speed; }
+    void setSpeed(double speed) { this->speed = speed; }
+
+    // Start again at the beginning of the file at the end
+    bool getLoop() { return loop; }
+    void setLoop(bool loop) { this->loop = loop; }
+
+    // Filter of the replayed frames
+    DLTCanFilter &getFilter() { return filter; }
+
+    // Statistics since start, times in ns
+    quint64 getFrameCounter() const { return frameCounter.load(std::memory_order_relaxed); }
+    quint64 getFilteredCounter() const { return filteredCounter.load(std::memory_order_relaxed); }
+    quint64 getErrorCounter() const { return errorCounter.load(std::memory_order_relaxed); }
+    unsigned int getLoopCounter() const { return loopCounter.load(std::memory_order_relaxed); }
+    quint64 getTimingErrorAverage() const;
+    quint64 getTimingErrorMax() const { return timingErrorMax.load(std::memory_order_relaxed); }
+    // Achieved frames per second
+    double getRate() const;
+    // Read part of the current file in percent
+    int getProgress() const { return progress.load(std::memory_order_relaxed); }
+
+    void clearSettings();
+    void writeSettings(QXmlStreamWriter &xml);
+    void readSettings(const QString &filename);
+
+    // Consumer side of the ring of sent frames, must only be called from one thread
+    int readFrames(CanFrame *frames,int maxFrames);
+
+signals:
+
+    void status(QString text);
+
+    // Due frames packed with DLTCanBackend::packFrames()
+    void sendFrames(QByteArray frames);
+    void framesAvailable();
+
+private:
+
+    friend class DLTCanReplayThread;
+
+    void run();
+    bool next(DLTCanLogReader &reader,CanFrame &frame,quint64 &deadline);
+
+    // Settings
+    bool active;
+    QString fileName;
+    double speed;
+    bool loop;
+    DLTCanFilter filter;
+
+    mutable QMutex mutex;
+    QWaitCondition condition;
+    DLTCanReplayThread thread;
+    std::atomic<bool> running;
+
+    // Timing thread
+    QString runFileName;
+    DLTCanFilter runFilter;
+    double runSpeed;
+    bool runLoop;
+    bool fileStarted;       // first frame of the current pass was read
+    quint64 fileStart;      // time of the first frame in the file
+    quint64 offset;         // deadline of the first frame
+    quint64 lastDeadline;
+    quint64 fastCount;      // frames replayed as fast as possible
+    quint64 passFrames;     // frames of the current pass
+
+    CanFrame batch[DLT_CAN_REPLAY_BATCH];
+
+    DLTCanRing<CanFrame,DLT_CAN_REPLAY_RING_SIZE> ring;
+    std::atomic<bool> notified;
+
+    std::atomic<quint64> frameCounter;
+    std::atomic<quint64> filteredCounter;
+    std::atomic<quint64> errorCounter;
+    std::atomic<unsigned int> loopCounter;
+    std::atomic<quint64> timingErrorSum;
+    std::atomic<quint64> timingErrorMax;
+    std::atomic<quint64> startTime;
+    std::atomic<quint64> lastTime;
+    std::atomic<int> progress;
+};
+
+#endif // DLT_CAN_REPLAY_H
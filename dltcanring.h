@@ -0,0 +1,98 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanring.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_RING_H
+#define DLT_CAN_RING_H
+
+#include <atomic>
+
+/**
+ * Bounded lock-free ring buffer for exactly one producer and one consumer thread.
+ *
+ * Size must be a power of two. If the ring is full new items are dropped
+ * and counted, so the producer is never blocked by a slow consumer.
+ */
+template <typename T,unsigned int Size>
+class DLTCanRing
+{
+    static_assert((Size & (Size-1))==0,"Size of DLTCanRing must be a power of two");
+
+public:
+    DLTCanRing() : head(0), tail(0), overflowCounter(0), highWaterMark(0), items(new T[Size]) {}
+    ~DLTCanRing() { delete[] items; }
+
+    // Producer: add one item, returns false if the ring is full
+    bool push(const T &item)
+    {
+        unsigned int currentHead = head.load(std::memory_order_relaxed);
+        unsigned int used = currentHead - tail.load(std::memory_order_acquire);
+
+        if(used>=Size)
+        {
+            overflowCounter.fetch_add(1,std::memory_order_relaxed);
+            return false;
+        }
+
+        items[currentHead & (Size-1)] = item;
+        head.store(currentHead+1,std::memory_order_release);
+
+        if(used+1>highWaterMark.load(std::memory_order_relaxed))
+            highWaterMark.store(used+1,std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // Consumer: remove up to maxItems, returns the number of removed items
+    int pop(T *out,int maxItems)
+    {
+        unsigned int currentTail = tail.load(std::memory_order_relaxed);
+        unsigned int available = head.load(std::memory_order_acquire) - currentTail;
+
+        if(available>(unsigned int)maxItems)
+            available = maxItems;
+
+        for(unsigned int num=0;num<available;num++)
+            out[num] = items[(currentTail+num) & (Size-1)];
+
+        tail.store(currentTail+available,std::memory_order_release);
+
+        return available;
+    }
+
+    // Consumer: drop all items
+    void clear() { tail.store(head.load(std::memory_order_acquire),std::memory_order_release); }
+
+    unsigned int count() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    unsigned int capacity() const { return Size; }
+
+    unsigned int getOverflowCounter() const { return overflowCounter.load(std::memory_order_relaxed); }
+    unsigned int getHighWaterMark() const { return highWaterMark.load(std::memory_order_relaxed); }
+
+private:
+
+    // producer and consumer index on separate cache lines
+    alignas(64) std::atomic<unsigned int> head;
+    alignas(64) std::atomic<unsigned int> tail;
+
+    alignas(64) std::atomic<unsigned int> overflowCounter;
+    std::atomic<unsigned int> highWaterMark;
+
+    // allocated once, not on the stack of the owner
+    T *items;
+
+    DLTCanRing(const DLTCanRing &);
+    DLTCanRing &operator=(const DLTCanRing &);
+};
+
+#endif // DLT_CAN_RING_H
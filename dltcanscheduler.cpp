@@ -0,0 +1,695 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanscheduler.cpp
+ * @licence end@
+ */
+
+#include "dltcanscheduler.h"
+#include "dltcancapture.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <QFile>
+
+#include <chrono>
+#include <string.h>
+
+// upper limits of the jitter histogram buckets in us
+static const quint64 histogramLimits[DLT_CAN_SCHEDULER_HISTOGRAM-1] = { 50, 100, 200, 500, 1000, 2000, 5000, 10000 };
+
+DLTCanCyclicMessage::DLTCanCyclicMessage()
+{
+    active = false;
+    period = 1000;
+    phase = 0;
+    id = 0;
+    extended = false;
+
+    sendCounter = 0;
+    missedCounter = 0;
+    periodCount = 0;
+    periodSum = 0;
+    periodMin = 0;
+    periodMax = 0;
+    jitterSum = 0;
+    jitterMax = 0;
+    memset(jitterHistogram,0,sizeof(jitterHistogram));
+
+    lastSent = 0;
+    generation = 0;
+}
+
+void DLTCanSchedulerThread::run()
+{
+    scheduler->run();
+}
+
+DLTCanScheduler::DLTCanScheduler(QObject *parent) : QObject(parent)
+    , thread(this)
+{
+    running = false;
+    policy = PolicySkip;
+    notified = false;
+    firmwareCount = 0;
+    firmwareChanged = false;
+
+    thread.setObjectName("DLTCanScheduler");
+}
+
+DLTCanScheduler::~DLTCanScheduler()
+{
+    stop();
+}
+
+void DLTCanScheduler::start()
+{
+    if(running)
+        return;
+
+    clearStatistics();
+
+    {
+        QMutexLocker locker(&mutex);
+
+        running = true;
+
+        for(int index=0;index<cyclicMessages.size();index++)
+        {
+            if(cyclicMessages[index].active)
+                restart(index);
+        }
+    }
+
+    thread.start(QThread::TimeCriticalPriority);
+
+    upload();
+}
+
+void DLTCanScheduler::stop()
+{
+    if(!running)
+        return;
+
+    {
+        QMutexLocker locker(&mutex);
+
+        running = false;
+        condition.wakeAll();
+    }
+
+    thread.wait();
+
+    QMutexLocker locker(&mutex);
+
+    deadlines = std::priority_queue<Deadline,std::vector<Deadline>,Later>();
+
+    bool stopFirmware = firmwareCount>0;
+    firmwareCount = 0;
+    firmwareChanged = false;
+
+    for(int index=0;index<cyclicMessages.size();index++)
+    {
+        const DLTCanCyclicMessage &cyclicMessage = cyclicMessages[index];
+        if(cyclicMessage.sendCounter)
+        {
+            qDebug() << "DLTCanScheduler: message" << index+1 << "sent" << cyclicMessage.sendCounter << "missed" << cyclicMessage.missedCounter
+                     << "period avg us" << cyclicMessage.getPeriodAverage()/1000 << "min us" << cyclicMessage.periodMin/1000 << "max us" << cyclicMessage.periodMax/1000
+                     << "jitter avg us" << cyclicMessage.getJitterAverage()/1000 << "max us" << cyclicMessage.jitterMax/1000;
+        }
+    }
+
+    // send without lock, like the timing thread
+    locker.unlock();
+
+    if(stopFirmware)
+    {
+        // empty table stops the cyclic messages of the adapter
+        char buffer[DLT_CAN_CYCLIC_TABLE_BUFFER];
+        int length = DLTCanCapture::encodeCyclicTable(0,0,buffer);
+        write(QByteArray(buffer,length));
+    }
+}
+
+int DLTCanScheduler::getCount() const
+{
+    QMutexLocker locker(&mutex);
+
+    return cyclicMessages.size();
+}
+
+DLTCanCyclicMessage DLTCanScheduler::getMessage(int index) const
+{
+    QMutexLocker locker(&mutex);
+
+    if(index<0 || index>=cyclicMessages.size())
+        return DLTCanCyclicMessage();
+
+    return cyclicMessages[index];
+}
+
+void DLTCanScheduler::ensure(int index)
+{
+    while(cyclicMessages.size()<=index)
+        cyclicMessages.append(DLTCanCyclicMessage());
+}
+
+void DLTCanScheduler::setMessage(int index,quint32 id,const QByteArray &data,bool extended)
+{
+    if(index<0)
+        return;
+
+    QMutexLocker locker(&mutex);
+
+    ensure(index);
+
+    // used with next transmission, no restart needed
+    cyclicMessages[index].id = id & CAN_FRAME_ID_MASK;
+    cyclicMessages[index].extended = extended || id>0x7ff;
+    cyclicMessages[index].data = data.left(CAN_FRAME_MAX_DATA_CLASSIC);
+
+    if(index<firmwareCount)
+    {
+        firmwareChanged = true;
+        locker.unlock();
+        upload();
+    }
+}
+
+void DLTCanScheduler::setPeriod(int index,int period)
+{
+    if(index<0)
+        return;
+
+    QMutexLocker locker(&mutex);
+
+    ensure(index);
+
+    if(cyclicMessages[index].period==period)
+        return;
+
+    cyclicMessages[index].period = period;
+
+    if(cyclicMessages[index].active)
+        restart(index);
+
+    locker.unlock();
+    upload();
+}
+
+void DLTCanScheduler::setActive(int index,bool active)
+{
+    if(index<0)
+        return;
+
+    QMutexLocker locker(&mutex);
+
+    ensure(index);
+
+    if(cyclicMessages[index].active==active)
+        return;
+
+    cyclicMessages[index].active = active;
+
+    if(active)
+        restart(index);
+    else
+        cyclicMessages[index].generation++;
+
+    if(index<firmwareCount)
+        firmwareChanged = true;
+
+    locker.unlock();
+    upload();
+}
+
+void DLTCanScheduler::setPhase(int index,int phase)
+{
+    if(index<0)
+        return;
+
+    QMutexLocker locker(&mutex);
+
+    ensure(index);
+
+    if(cyclicMessages[index].phase==phase)
+        return;
+
+    cyclicMessages[index].phase = phase;
+
+    if(cyclicMessages[index].active)
+        restart(index);
+
+    locker.unlock();
+    upload();
+}
+
+void DLTCanScheduler::setPolicy(int policy)
+{
+    QMutexLocker locker(&mutex);
+
+    this->policy = policy;
+}
+
+int DLTCanScheduler::getFirmwareCount() const
+{
+    QMutexLocker locker(&mutex);
+
+    return firmwareCount;
+}
+
+void DLTCanScheduler::setFirmwareCount(int count)
+{
+    QMutexLocker locker(&mutex);
+
+    // messages moved between host and adapter are restarted on the new side
+    int changed = qMax(count,firmwareCount);
+    firmwareCount = count;
+    for(int index=0;index<cyclicMessages.size() && index<changed;index++)
+    {
+        if(cyclicMessages[index].active)
+            restart(index);
+    }
+
+    // always upload, the adapter might have lost its table
+    firmwareChanged = true;
+
+    locker.unlock();
+    upload();
+}
+
+void DLTCanScheduler::upload()
+{
+    QMutexLocker locker(&mutex);
+
+    if(!running || firmwareCount==0 || !firmwareChanged)
+        return;
+
+    firmwareChanged = false;
+
+    char buffer[DLT_CAN_CYCLIC_TABLE_BUFFER];
+    int count = qMin(cyclicMessages.size(),firmwareCount);
+    int length = DLTCanCapture::encodeCyclicTable(cyclicMessages.constData(),count,buffer);
+
+    locker.unlock();
+
+    qDebug() << "DLTCanScheduler: upload cyclic messages" << count;
+    write(QByteArray(buffer,length));
+}
+
+bool DLTCanScheduler::firmwareSent(int index,quint64 timestamp,CanFrame &frame)
+{
+    QMutexLocker locker(&mutex);
+
+    if(index>=cyclicMessages.size() || index>=firmwareCount)
+        return false;
+
+    DLTCanCyclicMessage &cyclicMessage = cyclicMessages[index];
+
+    // deadlines are only known by the adapter, so the jitter is the deviation of the period
+    quint64 jitter = 0;
+    if(cyclicMessage.lastSent && timestamp>cyclicMessage.lastSent)
+    {
+        quint64 period = timestamp-cyclicMessage.lastSent;
+        quint64 nominal = (quint64)cyclicMessage.period*1000000;
+        jitter = period>nominal ? period-nominal : nominal-period;
+    }
+    statistics(cyclicMessage,timestamp,jitter);
+
+    memset(&frame,0,sizeof(frame));
+    frame.timestamp = timestamp;
+    frame.id = cyclicMessage.id;
+    frame.flags = CAN_FRAME_FLAG_TX | (cyclicMessage.extended ? CAN_FRAME_FLAG_EXTENDED : 0);
+    frame.dlc = cyclicMessage.data.size();
+    memcpy(frame.data,cyclicMessage.data.constData(),frame.dlc);
+
+    return true;
+}
+
+void DLTCanScheduler::firmwareCounters(int index,quint32 sent,quint32 missed)
+{
+    QMutexLocker locker(&mutex);
+
+    if(index>=cyclicMessages.size() || index>=firmwareCount)
+        return;
+
+    // counters of the adapter also contain messages, which were not reported because of a lost link
+    cyclicMessages[index].sendCounter = sent;
+    cyclicMessages[index].missedCounter = missed;
+}
+
+quint64 DLTCanScheduler::getHistogramLimit(int bucket)
+{
+    if(bucket<0 || bucket>=DLT_CAN_SCHEDULER_HISTOGRAM-1)
+        return 0;
+
+    return histogramLimits[bucket]*1000;
+}
+
+void DLTCanScheduler::clear()
+{
+    QMutexLocker locker(&mutex);
+
+    deadlines = std::priority_queue<Deadline,std::vector<Deadline>,Later>();
+    cyclicMessages.clear();
+    firmwareChanged = true;
+
+    locker.unlock();
+    upload();
+}
+
+void DLTCanScheduler::clearStatistics()
+{
+    QMutexLocker locker(&mutex);
+
+    for(int index=0;index<cyclicMessages.size();index++)
+    {
+        DLTCanCyclicMessage &cyclicMessage = cyclicMessages[index];
+
+        cyclicMessage.sendCounter = 0;
+        cyclicMessage.missedCounter = 0;
+        cyclicMessage.periodCount = 0;
+        cyclicMessage.periodSum = 0;
+        cyclicMessage.periodMin = 0;
+        cyclicMessage.periodMax = 0;
+        cyclicMessage.jitterSum = 0;
+        cyclicMessage.jitterMax = 0;
+        memset(cyclicMessage.jitterHistogram,0,sizeof(cyclicMessage.jitterHistogram));
+        cyclicMessage.lastSent = 0;
+    }
+}
+
+void DLTCanScheduler::restart(int index)
+{
+    // must be called with locked mutex
+    DLTCanCyclicMessage &cyclicMessage = cyclicMessages[index];
+
+    // deadlines of the old period are ignored when they are due
+    cyclicMessage.generation++;
+    cyclicMessage.lastSent = 0;
+
+    if(index<firmwareCount)
+    {
+        // sent by the adapter
+        firmwareChanged = true;
+        return;
+    }
+
+    if(!running || cyclicMessage.period<=0)
+        return;
+
+    schedule(index,DLTCanClock::now()+((quint64)cyclicMessage.phase+cyclicMessage.period)*1000000);
+
+    // timing thread must recalculate its wake up time
+    condition.wakeAll();
+}
+
+void DLTCanScheduler::statistics(DLTCanCyclicMessage &cyclicMessage,quint64 timestamp,quint64 jitter)
+{
+    int bucket = 0;
+    while(bucket<DLT_CAN_SCHEDULER_HISTOGRAM-1 && jitter>=histogramLimits[bucket]*1000)
+        bucket++;
+    cyclicMessage.jitterHistogram[bucket]++;
+    cyclicMessage.sendCounter++;
+    cyclicMessage.jitterSum += jitter;
+    if(jitter>cyclicMessage.jitterMax)
+        cyclicMessage.jitterMax = jitter;
+
+    if(cyclicMessage.lastSent && timestamp>cyclicMessage.lastSent)
+    {
+        quint64 period = timestamp-cyclicMessage.lastSent;
+        cyclicMessage.periodCount++;
+        cyclicMessage.periodSum += period;
+        if(cyclicMessage.periodMin==0 || period<cyclicMessage.periodMin)
+            cyclicMessage.periodMin = period;
+        if(period>cyclicMessage.periodMax)
+            cyclicMessage.periodMax = period;
+    }
+    cyclicMessage.lastSent = timestamp;
+}
+
+void DLTCanScheduler::schedule(int index,quint64 deadline)
+{
+    Deadline entry;
+
+    entry.deadline = deadline;
+    entry.index = index;
+    entry.generation = cyclicMessages[index].generation;
+
+    deadlines.push(entry);
+}
+
+int DLTCanScheduler::readFrames(CanFrame *frames,int maxFrames)
+{
+    // reset before reading, so frames pushed afterwards are signaled again
+    notified.store(false);
+
+    return ring.pop(frames,maxFrames);
+}
+
+void DLTCanScheduler::run()
+{
+    QMutexLocker locker(&mutex);
+
+    while(running)
+    {
+        // remove deadlines of stopped or changed messages
+        while(!deadlines.empty() && deadlines.top().generation!=cyclicMessages[deadlines.top().index].generation)
+            deadlines.pop();
+
+        if(deadlines.empty())
+        {
+            condition.wait(&mutex);
+            continue;
+        }
+
+        // sleep until the absolute deadline, woken up early if the messages are changed
+        quint64 now = DLTCanClock::now();
+        quint64 deadline = deadlines.top().deadline;
+        if(deadline>now)
+        {
+            condition.wait(&mutex,QDeadlineTimer(std::chrono::nanoseconds(deadline-now),Qt::PreciseTimer));
+            continue;
+        }
+
+        int count = process(now);
+        if(count==0)
+            continue;
+
+        // send and forward without lock, so the GUI is not blocked
+        QByteArray frames = DLTCanBackend::packFrames(batch,count);
+
+        locker.unlock();
+
+        sendFrames(frames);
+
+        bool pushed = false;
+        for(int num=0;num<count;num++)
+            pushed |= ring.push(batch[num]);
+        if(pushed && !notified.exchange(true))
+            framesAvailable();
+
+        locker.relock();
+    }
+}
+
+int DLTCanScheduler::process(quint64 now)
+{
+    // must be called with locked mutex
+    int count = 0;
+
+    while(count<DLT_CAN_SCHEDULER_BATCH && count<DLT_CAN_BATCH_MAX && !deadlines.empty() && deadlines.top().deadline<=now)
+    {
+        Deadline entry = deadlines.top();
+        deadlines.pop();
+
+        DLTCanCyclicMessage &cyclicMessage = cyclicMessages[entry.index];
+        if(entry.generation!=cyclicMessage.generation)
+            continue;
+
+        statistics(cyclicMessage,now,now-entry.deadline);
+
+        // next deadline relative to the last one, so the period does not drift
+        quint64 period = (quint64)cyclicMessage.period*1000000;
+        quint64 next = entry.deadline+period;
+        if(next<=now)
+        {
+            quint64 missed = (now-entry.deadline)/period;
+            if(policy==PolicyCatchUp && missed<=DLT_CAN_SCHEDULER_CATCH_UP_MAX)
+            {
+                // next deadline is already due, so the missed messages are sent immediately
+            }
+            else
+            {
+                // too late for one or more periods, skip them
+                cyclicMessage.missedCounter += missed;
+                next += missed*period;
+            }
+        }
+        schedule(entry.index,next);
+
+        CanFrame &frame = batch[count++];
+        memset(&frame,0,sizeof(frame));
+        frame.timestamp = now;
+        frame.id = cyclicMessage.id;
+        frame.flags = CAN_FRAME_FLAG_TX | (cyclicMessage.extended ? CAN_FRAME_FLAG_EXTENDED : 0);
+        frame.dlc = cyclicMessage.data.size();
+        memcpy(frame.data,cyclicMessage.data.constData(),frame.dlc);
+    }
+
+    return count;
+}
+
+void DLTCanScheduler::writeSettings(QXmlStreamWriter &xml)
+{
+    QMutexLocker locker(&mutex);
+
+    /* Write cyclic messages */
+    xml.writeTextElement("cyclicPolicy",QString("%1").arg(policy));
+    xml.writeStartElement("cyclicMessages");
+    for(int index=0;index<cyclicMessages.size();index++)
+    {
+        const DLTCanCyclicMessage &cyclicMessage = cyclicMessages[index];
+
+        xml.writeStartElement("cyclicMessage");
+            xml.writeTextElement("active",QString("%1").arg(cyclicMessage.active));
+            xml.writeTextElement("period",QString("%1").arg(cyclicMessage.period));
+            xml.writeTextElement("phase",QString("%1").arg(cyclicMessage.phase));
+            xml.writeTextElement("id",QString("%1").arg(cyclicMessage.id));
+            xml.writeTextElement("extended",QString("%1").arg(cyclicMessage.extended));
+            xml.writeTextElement("data",cyclicMessage.data.toHex());
+        xml.writeEndElement(); // cyclicMessage
+    }
+    xml.writeEndElement(); // cyclicMessages
+}
+
+void DLTCanScheduler::readSettings(const QString &filename,const QString &element)
+{
+    bool isOwner = false;
+    int index = -1;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+             return;
+
+    QXmlStreamReader xml(&file);
+
+    while (!xml.atEnd())
+    {
+          xml.readNext();
+
+          if(xml.isStartElement())
+          {
+              if(index>=0)
+              {
+                  /* Cyclic message */
+                  if(xml.name() == QString("active"))
+                  {
+                      setActive(index,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("period"))
+                  {
+                      setPeriod(index,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("phase"))
+                  {
+                      setPhase(index,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("id"))
+                  {
+                      DLTCanCyclicMessage cyclicMessage = getMessage(index);
+                      setMessage(index,xml.readElementText().toUInt(),cyclicMessage.data,cyclicMessage.extended);
+                  }
+                  else if(xml.name() == QString("extended"))
+                  {
+                      DLTCanCyclicMessage cyclicMessage = getMessage(index);
+                      setMessage(index,cyclicMessage.id,cyclicMessage.data,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("data"))
+                  {
+                      DLTCanCyclicMessage cyclicMessage = getMessage(index);
+                      setMessage(index,cyclicMessage.id,QByteArray::fromHex(xml.readElementText().toLatin1()),cyclicMessage.extended);
+                  }
+              }
+              else if(isOwner)
+              {
+                  if(xml.name() == QString("cyclicPolicy"))
+                  {
+                      setPolicy(xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("cyclicMessages"))
+                  {
+                      // list replaces all messages
+                      clear();
+                  }
+                  else if(xml.name() == QString("cyclicMessage"))
+                  {
+                      index = getCount();
+                      setActive(index,false);
+                  }
+                  /* Settings of older versions with two cyclic messages */
+                  else if(xml.name() == QString("cyclicMessageActive1"))
+                  {
+                      setActive(0,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("cyclicMessageTimeout1"))
+                  {
+                      setPeriod(0,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("cyclicMessageId1"))
+                  {
+                      setMessage(0,xml.readElementText().toUInt(),getMessage(0).data);
+                  }
+                  else if(xml.name() == QString("cyclicMessageData1"))
+                  {
+                      setMessage(0,getMessage(0).id,QByteArray::fromHex(xml.readElementText().toLatin1()));
+                  }
+                  else if(xml.name() == QString("cyclicMessageActive2"))
+                  {
+                      setActive(1,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("cyclicMessageTimeout2"))
+                  {
+                      setPeriod(1,xml.readElementText().toInt());
+                  }
+                  else if(xml.name() == QString("cyclicMessageId2"))
+                  {
+                      setMessage(1,xml.readElementText().toUInt(),getMessage(1).data);
+                  }
+                  else if(xml.name() == QString("cyclicMessageData2"))
+                  {
+                      setMessage(1,getMessage(1).id,QByteArray::fromHex(xml.readElementText().toLatin1()));
+                  }
+              }
+              else if(xml.name() == element)
+              {
+                    isOwner = true;
+              }
+          }
+          else if(xml.isEndElement())
+          {
+              if(xml.name() == QString("cyclicMessage"))
+              {
+                    index = -1;
+              }
+              else if(xml.name() == element)
+              {
+                    isOwner = false;
+              }
+          }
+    }
+    if (xml.hasError())
+    {
+         qDebug() << "Error in processing filter file" << filename << xml.errorString();
+    }
+
+    file.close();
+}
@@ -0,0 +1,205 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcanscheduler.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_SCHEDULER_H
+#define DLT_CAN_SCHEDULER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+
+#include <atomic>
+#include <queue>
+#include <vector>
+
+#include "canframe.h"
+#include "dltcanring.h"
+
+// maximum number of due messages sent at once
+#define DLT_CAN_SCHEDULER_BATCH 16
+
+// number of sent messages buffered until they are forwarded
+#define DLT_CAN_SCHEDULER_RING_SIZE 1024
+
+// maximum number of missed periods sent again with the catch up policy
+#define DLT_CAN_SCHEDULER_CATCH_UP_MAX 10
+
+// number of buckets of the jitter histogram
+#define DLT_CAN_SCHEDULER_HISTOGRAM 9
+
+struct DLTCanCyclicMessage
+{
+    DLTCanCyclicMessage();
+
+    // Settings
+    bool active;
+    int period;             // ms
+    int phase;              // ms, additional delay of the first transmission
+    quint32 id;
+    bool extended;
+    QByteArray data;
+
+    // Statistics, times in ns
+    quint64 sendCounter;
+    quint64 missedCounter;  // deadlines skipped, because the scheduler was too late
+    quint64 periodCount;
+    quint64 periodSum;
+    quint64 periodMin;
+    quint64 periodMax;
+    quint64 jitterSum;      // delay of each transmission after its deadline
+    quint64 jitterMax;
+    quint64 jitterHistogram[DLT_CAN_SCHEDULER_HISTOGRAM];
+
+    quint64 getPeriodAverage() const { return periodCount ? periodSum/periodCount : 0; }
+    quint64 getJitterAverage() const { return sendCounter ? jitterSum/sendCounter : 0; }
+
+    // Runtime
+    quint64 lastSent;
+    unsigned int generation;   // invalidates queued deadlines after a change
+};
+
+class DLTCanScheduler;
+
+class DLTCanSchedulerThread : public QThread
+{
+public:
+    explicit DLTCanSchedulerThread(DLTCanScheduler *scheduler) : scheduler(scheduler) {}
+
+protected:
+    void run() override;
+
+private:
+    DLTCanScheduler *scheduler;
+};
+
+/**
+ * Cyclic transmission of any number of CAN messages.
+ *
+ * The next deadline of each active message is kept in a min-heap. A timing
+ * thread sleeps until the earliest absolute deadline on the monotonic clock,
+ * so the period does not drift and the GUI does not add jitter. All messages
+ * due at the same time are sent by the backend in one batch. The
+ * sent messages are passed back through a lock-free ring for forwarding.
+ *
+ * If the firmware of the adapter supports a cyclic table, the first messages
+ * up to its table size are uploaded to the adapter and transmitted by the
+ * firmware itself. The adapter reports each transmission with its timestamp
+ * and the counters of each message, which are merged into the statistics.
+ */
+class DLTCanScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DLTCanScheduler(QObject *parent = nullptr);
+    ~DLTCanScheduler();
+
+    enum Policy
+    {
+        PolicySkip = 0,     // missed deadlines are skipped and counted
+        PolicyCatchUp = 1   // missed deadlines are sent at once, up to DLT_CAN_SCHEDULER_CATCH_UP_MAX
+    };
+
+    void start();
+    void stop();
+    bool isRunning() const { return running; }
+
+    // Messages are addressed by index, setting a message behind the end extends the list
+    int getCount() const;
+    DLTCanCyclicMessage getMessage(int index) const;
+    void setMessage(int index,quint32 id,const QByteArray &data,bool extended = false);
+    void setPeriod(int index,int period);
+    void setActive(int index,bool active);
+    void setPhase(int index,int phase);
+
+    int getPolicy() const { return policy; }
+    void setPolicy(int policy);
+
+    // Number of messages transmitted by the adapter, 0 if not supported by the firmware
+    int getFirmwareCount() const;
+    void setFirmwareCount(int count);
+
+    // Called by the capture thread for messages transmitted by the adapter
+    bool firmwareSent(int index,quint64 timestamp,CanFrame &frame);
+    void firmwareCounters(int index,quint32 sent,quint32 missed);
+
+    // Upper limit of a histogram bucket in ns, the last bucket has no limit
+    static quint64 getHistogramLimit(int bucket);
+
+    void clear();
+    void clearStatistics();
+
+    void writeSettings(QXmlStreamWriter &xml);
+    // Settings are read from the element of the owning DLTCan
+    void readSettings(const QString &filename,const QString &element = "DLTCan");
+
+    // Consumer side of the ring of sent messages, must only be called from one thread
+    int readFrames(CanFrame *frames,int maxFrames);
+
+signals:
+
+    // Encoded cyclic table for the adapter
+    void write(QByteArray data);
+    // Due messages packed with DLTCanBackend::packFrames()
+    void sendFrames(QByteArray frames);
+    void framesAvailable();
+
+private:
+
+    friend class DLTCanSchedulerThread;
+
+    struct Deadline
+    {
+        quint64 deadline;
+        int index;
+        unsigned int generation;
+    };
+
+    struct Later
+    {
+        bool operator()(const Deadline &a,const Deadline &b) const { return a.deadline>b.deadline; }
+    };
+
+    void run();
+    int process(quint64 now);
+
+    void ensure(int index);
+    void schedule(int index,quint64 deadline);
+    void restart(int index);
+    static void statistics(DLTCanCyclicMessage &cyclicMessage,quint64 timestamp,quint64 jitter);
+    void upload();
+
+    mutable QMutex mutex;
+    QWaitCondition condition;
+    DLTCanSchedulerThread thread;
+
+    QVector<DLTCanCyclicMessage> cyclicMessages;
+    std::priority_queue<Deadline,std::vector<Deadline>,Later> deadlines;
+
+    std::atomic<bool> running;
+    int policy;
+
+    int firmwareCount;
+    bool firmwareChanged;   // table must be uploaded to the adapter again
+
+    CanFrame batch[DLT_CAN_SCHEDULER_BATCH];
+
+    DLTCanRing<CanFrame,DLT_CAN_SCHEDULER_RING_SIZE> ring;
+    std::atomic<bool> notified;
+};
+
+#endif // DLT_CAN_SCHEDULER_H
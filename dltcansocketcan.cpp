@@ -0,0 +1,306 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcansocketcan.cpp
+ * @licence end@
+ */
+
+#include "dltcansocketcan.h"
+#include "dltcanclock.h"
+
+#include <QDebug>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+DLTCanSocketCan::DLTCanSocketCan(QObject *parent) : DLTCanBackend(parent)
+    , timer(this)
+{
+    socketFd = -1;
+    notifier = 0;
+    droppedLast = 0;
+
+    // buffers of each message point to the preallocated frames
+    memset(rxMessages,0,sizeof(rxMessages));
+    memset(txMessages,0,sizeof(txMessages));
+    for(int num=0;num<DLT_CAN_SOCKETCAN_BATCH;num++)
+    {
+        rxVectors[num].iov_base = &rxFrames[num];
+        rxVectors[num].iov_len = sizeof(rxFrames[num]);
+        rxMessages[num].msg_hdr.msg_iov = &rxVectors[num];
+        rxMessages[num].msg_hdr.msg_iovlen = 1;
+        rxMessages[num].msg_hdr.msg_control = rxControls[num];
+
+        txVectors[num].iov_base = &txFrames[num];
+        txMessages[num].msg_hdr.msg_iov = &txVectors[num];
+        txMessages[num].msg_hdr.msg_iovlen = 1;
+    }
+
+    connect(&timer, SIGNAL(timeout()), this, SLOT(timeout()));
+}
+
+DLTCanSocketCan::~DLTCanSocketCan()
+{
+    closeSocket();
+}
+
+void DLTCanSocketCan::open(QString interface,int baudRate)
+{
+    Q_UNUSED(baudRate)
+
+    this->interface = interface;
+
+    if(openSocket())
+    {
+        status("started");
+        qDebug() << "DLTCan: started" << interface;
+    }
+    else
+    {
+        qDebug() << "DLTCan: Failed to open interface" << interface;
+        status("error");
+        timer.start(5000);
+    }
+}
+
+void DLTCanSocketCan::close()
+{
+    timer.stop();
+    closeSocket();
+}
+
+bool DLTCanSocketCan::openSocket()
+{
+    closeSocket();
+
+    socketFd = ::socket(PF_CAN,SOCK_RAW|SOCK_NONBLOCK|SOCK_CLOEXEC,CAN_RAW);
+    if(socketFd<0)
+    {
+        qDebug() << "DLTCan: SocketCAN not available" << strerror(errno);
+        return false;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr,0,sizeof(ifr));
+    strncpy(ifr.ifr_name,interface.toLatin1().constData(),IFNAMSIZ-1);
+    if(::ioctl(socketFd,SIOCGIFINDEX,&ifr)<0)
+    {
+        closeSocket();
+        return false;
+    }
+
+    // CAN FD frames are received, if the interface supports them
+    int enable = 1;
+    ::setsockopt(socketFd,SOL_CAN_RAW,CAN_RAW_FD_FRAMES,&enable,sizeof(enable));
+
+    // receive timestamp of the kernel and number of frames dropped by the kernel
+    int timestamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if(::setsockopt(socketFd,SOL_SOCKET,SO_TIMESTAMPING,&timestamping,sizeof(timestamping))<0)
+        qDebug() << "DLTCan: No kernel timestamps" << strerror(errno);
+    ::setsockopt(socketFd,SOL_SOCKET,SO_RXQ_OVFL,&enable,sizeof(enable));
+
+    // absorb bursts while the capture thread is busy
+    int receiveBuffer = DLT_CAN_SOCKETCAN_RECEIVE_BUFFER;
+    ::setsockopt(socketFd,SOL_SOCKET,SO_RCVBUF,&receiveBuffer,sizeof(receiveBuffer));
+
+    struct sockaddr_can addr;
+    memset(&addr,0,sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if(::bind(socketFd,(struct sockaddr*)&addr,sizeof(addr))<0)
+    {
+        closeSocket();
+        return false;
+    }
+
+    droppedLast = 0;
+
+    notifier = new QSocketNotifier(socketFd,QSocketNotifier::Read,this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(readyRead()));
+
+    return true;
+}
+
+void DLTCanSocketCan::closeSocket()
+{
+    if(notifier)
+    {
+        delete notifier;
+        notifier = 0;
+    }
+
+    if(socketFd>=0)
+    {
+        ::close(socketFd);
+        socketFd = -1;
+    }
+}
+
+void DLTCanSocketCan::timeout()
+{
+    if(openSocket())
+    {
+        timer.stop();
+        status("reconnect");
+        qDebug() << "DLTCan: reconnect" << interface;
+    }
+}
+
+void DLTCanSocketCan::readyRead()
+{
+    bool pushed = false;
+
+    // kernel timestamps are on the realtime clock, frames without get the time they were read
+    quint64 now = DLTCanClock::now();
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME,&realtime);
+    qint64 offset = (qint64)realtime.tv_sec*1000000000+realtime.tv_nsec-(qint64)now;
+
+    int count;
+    do
+    {
+        for(int num=0;num<DLT_CAN_SOCKETCAN_BATCH;num++)
+        {
+            rxMessages[num].msg_hdr.msg_controllen = DLT_CAN_SOCKETCAN_CONTROL_SIZE;
+            rxMessages[num].msg_hdr.msg_flags = 0;
+        }
+
+        count = ::recvmmsg(socketFd,rxMessages,DLT_CAN_SOCKETCAN_BATCH,MSG_DONTWAIT,0);
+        if(count<0)
+        {
+            if(errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)
+            {
+                // e.g. interface is down, frames are received again when it is up
+                qDebug() << "DLTCan: SocketCAN read error" << strerror(errno);
+                errorCounter.fetch_add(1,std::memory_order_relaxed);
+                status("error");
+            }
+            break;
+        }
+
+        for(int num=0;num<count;num++)
+        {
+            const struct canfd_frame &rxFrame = rxFrames[num];
+            unsigned int length = rxMessages[num].msg_len;
+
+            CanFrame frame;
+            memset(&frame,0,sizeof(frame));
+            frame.timestamp = now;
+
+            for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&rxMessages[num].msg_hdr);cmsg;cmsg = CMSG_NXTHDR(&rxMessages[num].msg_hdr,cmsg))
+            {
+                if(cmsg->cmsg_level!=SOL_SOCKET)
+                    continue;
+
+                if(cmsg->cmsg_type==SO_TIMESTAMPING)
+                {
+                    // first timestamp is the software receive timestamp
+                    struct scm_timestamping timestamps;
+                    memcpy(&timestamps,CMSG_DATA(cmsg),sizeof(timestamps));
+                    qint64 time = (qint64)timestamps.ts[0].tv_sec*1000000000+timestamps.ts[0].tv_nsec;
+                    if(time>offset)
+                        frame.timestamp = time-offset;
+                }
+                else if(cmsg->cmsg_type==SO_RXQ_OVFL)
+                {
+                    quint32 dropped;
+                    memcpy(&dropped,CMSG_DATA(cmsg),sizeof(dropped));
+                    if(dropped!=droppedLast)
+                    {
+                        droppedCounter.fetch_add(dropped-droppedLast,std::memory_order_relaxed);
+                        droppedLast = dropped;
+                    }
+                }
+            }
+
+            if((length!=CAN_MTU && length!=CANFD_MTU) || (rxFrame.can_id & CAN_ERR_FLAG))
+            {
+                errorCounter.fetch_add(1,std::memory_order_relaxed);
+                continue;
+            }
+
+            if(rxFrame.can_id & CAN_EFF_FLAG)
+            {
+                frame.id = rxFrame.can_id & CAN_EFF_MASK;
+                frame.flags |= CAN_FRAME_FLAG_EXTENDED;
+            }
+            else
+            {
+                frame.id = rxFrame.can_id & CAN_SFF_MASK;
+            }
+            if(rxFrame.can_id & CAN_RTR_FLAG)
+                frame.flags |= CAN_FRAME_FLAG_RTR;
+            if(length==CANFD_MTU)
+                frame.flags |= CAN_FRAME_FLAG_FD;
+
+            frame.dlc = rxFrame.len<=CAN_FRAME_MAX_DATA ? rxFrame.len : CAN_FRAME_MAX_DATA;
+            if(!(frame.flags & CAN_FRAME_FLAG_RTR))
+                memcpy(frame.data,rxFrame.data,frame.dlc);
+
+            byteCounter.fetch_add(length,std::memory_order_relaxed);
+            ring.push(frame);
+            pushed = true;
+        }
+    }
+    while(count==DLT_CAN_SOCKETCAN_BATCH);
+
+    if(pushed)
+        notify();
+}
+
+void DLTCanSocketCan::sendFrames(QByteArray frames)
+{
+    if(socketFd<0)
+        return;
+
+    const CanFrame *messages = (const CanFrame*)frames.constData();
+    int count = frames.size()/(int)sizeof(CanFrame);
+    for(int pos=0;pos<count;pos+=DLT_CAN_SOCKETCAN_BATCH)
+    {
+        int batch = qMin(count-pos,DLT_CAN_SOCKETCAN_BATCH);
+        for(int num=0;num<batch;num++)
+        {
+            const CanFrame &frame = messages[pos+num];
+            struct canfd_frame &txFrame = txFrames[num];
+            bool fd = frame.flags & CAN_FRAME_FLAG_FD;
+            int length = qMin((int)frame.dlc,fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN);
+
+            memset(&txFrame,0,sizeof(txFrame));
+            if(frame.flags & CAN_FRAME_FLAG_EXTENDED)
+                txFrame.can_id = (frame.id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+            else
+                txFrame.can_id = frame.id & CAN_SFF_MASK;
+            if(!fd && (frame.flags & CAN_FRAME_FLAG_RTR))
+                txFrame.can_id |= CAN_RTR_FLAG;
+            txFrame.len = length;
+            memcpy(txFrame.data,frame.data,length);
+
+            txVectors[num].iov_len = fd ? CANFD_MTU : CAN_MTU;
+        }
+
+        int sent = ::sendmmsg(socketFd,txMessages,batch,MSG_DONTWAIT);
+        if(sent<batch)
+        {
+            // transmit queue of the interface is full or interface is down
+            qDebug() << "DLTCan: SocketCAN send error" << (sent<0 ? strerror(errno) : "queue full");
+            status("send error");
+            return;
+        }
+    }
+
+    status("send ok");
+}
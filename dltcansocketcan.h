@@ -0,0 +1,92 @@
+/**
+ * @licence app begin@
+ * Copyright (C) 2021 Alexander Wenzel
+ *
+ * This file is part of the DLT Can project.
+ *
+ * \copyright This code is licensed under GPLv3.
+ *
+ * \author Alexander Wenzel <alex@eli2.de>
+ *
+ * \file dltcansocketcan.h
+ * @licence end@
+ */
+
+#ifndef DLT_CAN_SOCKETCAN_H
+#define DLT_CAN_SOCKETCAN_H
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <sys/socket.h>
+#include <linux/can.h>
+
+#include "dltcanbackend.h"
+
+// maximum number of frames read or written with one system call
+#define DLT_CAN_SOCKETCAN_BATCH 64
+
+// size of the kernel receive buffer of the socket in bytes
+#define DLT_CAN_SOCKETCAN_RECEIVE_BUFFER (1024*1024)
+
+// size of the control messages of one received frame, timestamps and dropped counter
+#define DLT_CAN_SOCKETCAN_CONTROL_SIZE 128
+
+/**
+ * Raw SocketCAN interface, backend of DLTCan on Linux.
+ *
+ * The interface must be configured and up, e.g. with "ip link set can0 up
+ * type can bitrate 500000", so the baud rate is not used. For tests a virtual
+ * interface can be used: "ip link add dev vcan0 type vcan".
+ *
+ * All pending frames are read with recvmmsg() in batches, when the socket
+ * notifier reports data. Each frame gets the receive timestamp of the kernel,
+ * which is converted to the monotonic clock. Frames dropped by the kernel,
+ * because the receive queue was full, are counted as overflow. If the
+ * interface does not exist yet, opening is retried like a reconnect of the
+ * adapter.
+ */
+class DLTCanSocketCan : public DLTCanBackend
+{
+    Q_OBJECT
+public:
+    explicit DLTCanSocketCan(QObject *parent = nullptr);
+    ~DLTCanSocketCan();
+
+public slots:
+
+    void open(QString interface,int baudRate) override;
+    void close() override;
+    void sendFrames(QByteArray frames) override;
+
+private slots:
+
+    void readyRead();
+
+    // Retry to open an interface which was not available
+    void timeout();
+
+private:
+
+    bool openSocket();
+    void closeSocket();
+
+    int socketFd;
+    QSocketNotifier *notifier;
+    QTimer timer;
+    QString interface;
+    quint32 droppedLast;    // dropped counter of the kernel
+
+    // preallocated, no allocation for each received batch
+    struct canfd_frame rxFrames[DLT_CAN_SOCKETCAN_BATCH];
+    struct iovec rxVectors[DLT_CAN_SOCKETCAN_BATCH];
+    struct mmsghdr rxMessages[DLT_CAN_SOCKETCAN_BATCH];
+    alignas(struct cmsghdr) char rxControls[DLT_CAN_SOCKETCAN_BATCH][DLT_CAN_SOCKETCAN_CONTROL_SIZE];
+
+    struct canfd_frame txFrames[DLT_CAN_SOCKETCAN_BATCH];
+    struct iovec txVectors[DLT_CAN_SOCKETCAN_BATCH];
+    struct mmsghdr txMessages[DLT_CAN_SOCKETCAN_BATCH];
+};
+
+#endif // DLT_CAN_SOCKETCAN_H
@@ -13,16 +13,31 @@
  */
 
 #include "dltminiserver.h"
+#include "dltcanclock.h"
 
 #include <QDebug>
 #include <QFile>
 
+#include <string.h>
+
 DLTMiniServer::DLTMiniServer(QObject *parent) : QObject(parent)
 {
     clearSettings();
 
-    tcpSocket = 0;
+    messageCounter = 0;
+    recorder = 0;
+
+    sendBufferTimestamp = 0;
+    sendBufferMessages = 0;
+    writeCount = 0;
+    writeBytes = 0;
+    flushLatencySum = 0;
+    flushLatencyMax = 0;
+    droppedMessages = 0;
 
+    timerFlush.setSingleShot(true);
+    timerFlush.setTimerType(Qt::PreciseTimer);
+    connect(&timerFlush, SIGNAL(timeout()), this, SLOT(flush()));
 }
 
 DLTMiniServer::~DLTMiniServer()
@@ -35,7 +50,18 @@ void DLTMiniServer::start()
     if(tcpServer.isListening())
         return;
 
-    tcpServer.setMaxPendingConnections(1);
+    // reusable send buffer, allocated once
+    sendBuffer.reserve(flushSize+DLT_MINI_SERVER_MAX_FRAME_MESSAGE);
+    sendBuffer.resize(0);
+    sendBufferMessages = 0;
+
+    writeCount = 0;
+    writeBytes = 0;
+    flushLatencySum = 0;
+    flushLatencyMax = 0;
+    droppedMessages = 0;
+
+    tcpServer.setMaxPendingConnections(maxClients);
     if(tcpServer.listen(QHostAddress::Any,port)==true)
     {
         connect(&tcpServer, SIGNAL(newConnection()), this, SLOT(newConnection()));
@@ -53,18 +79,23 @@ void DLTMiniServer::start()
 
 void DLTMiniServer::stop()
 {
-    if(tcpSocket && tcpSocket->isOpen())
+    flush();
+
+    if(writeCount)
     {
-        disconnect(tcpSocket, SIGNAL(connected()), this, SLOT(connected()));
-        disconnect(tcpSocket, SIGNAL(disconnected()), this, SLOT(disconnected()));
-        tcpSocket->close();
+        qDebug() << "DLTMiniServer: writes" << writeCount << "bytes/write" << writeBytes/writeCount
+                 << "flush latency avg us" << getFlushLatencyAverage()/1000 << "max us" << flushLatencyMax/1000;
+    }
+
+    // close all clients
+    while(!clients.isEmpty())
+    {
+        removeClient(clients.first());
     }
 
     disconnect(&tcpServer, SIGNAL(newConnection()), this, SLOT(newConnection()));
     tcpServer.close();
 
-    readData.clear();
-
     status("stopped");
     qDebug() << "DLTMiniServer: stopped" << port;
 }
@@ -72,8 +103,17 @@ void DLTMiniServer::stop()
 void DLTMiniServer::clearSettings()
 {
     port = 3491;
+    tcpNoDelay = true;
+    flushSize = 16384;
+    flushTimeout = 1;
+    frameEncoding = FrameEncodingVerbose;
+    maxClients = 8;
+    sendQueueSize = 4*1024*1024;
+    sendQueuePolicy = SendQueueDropOldest;
+    ecuId = "ECU1";
     applicationId = "DLT";
     contextId = "Mini";
+    memset(channelContextIds,0,sizeof(channelContextIds));
 }
 
 void DLTMiniServer::writeSettings(QXmlStreamWriter &xml)
@@ -81,6 +121,14 @@ void DLTMiniServer::writeSettings(QXmlStreamWriter &xml)
     /* Write project settings */
     xml.writeStartElement("DLTMiniServer");
         xml.writeTextElement("port",QString("%1").arg(port));
+        xml.writeTextElement("maxClients",QString("%1").arg(maxClients));
+        xml.writeTextElement("sendQueueSize",QString("%1").arg(sendQueueSize));
+        xml.writeTextElement("sendQueuePolicy",QString("%1").arg(sendQueuePolicy));
+        xml.writeTextElement("tcpNoDelay",QString("%1").arg(tcpNoDelay));
+        xml.writeTextElement("flushSize",QString("%1").arg(flushSize));
+        xml.writeTextElement("flushTimeout",QString("%1").arg(flushTimeout));
+        xml.writeTextElement("ecuId",ecuId);
+        xml.writeTextElement("frameEncoding",QString("%1").arg(frameEncoding));
         xml.writeTextElement("applicationId",applicationId);
         xml.writeTextElement("contextId",contextId);
     xml.writeEndElement(); // DLTMiniServer
@@ -109,6 +157,38 @@ void DLTMiniServer::readSettings(const QString &filename)
                   {
                       port = xml.readElementText().toUShort();
                   }
+                  if(xml.name() == QString("maxClients"))
+                  {
+                      maxClients = xml.readElementText().toInt();
+                  }
+                  if(xml.name() == QString("sendQueueSize"))
+                  {
+                      sendQueueSize = xml.readElementText().toInt();
+                  }
+                  if(xml.name() == QString("sendQueuePolicy"))
+                  {
+                      sendQueuePolicy = xml.readElementText().toInt();
+                  }
+                  if(xml.name() == QString("tcpNoDelay"))
+                  {
+                      tcpNoDelay = xml.readElementText().toInt();
+                  }
+                  if(xml.name() == QString("flushSize"))
+                  {
+                      flushSize = xml.readElementText().toInt();
+                  }
+                  if(xml.name() == QString("flushTimeout"))
+                  {
+                      flushTimeout = xml.readElementText().toInt();
+                  }
+                  if(xml.name() == QString("frameEncoding"))
+                  {
+                      frameEncoding = xml.readElementText().toInt();
+                  }
+                  if(xml.name() == QString("ecuId"))
+                  {
+                      ecuId = xml.readElementText();
+                  }
                   if(xml.name() == QString("applicationId"))
                   {
                       applicationId = xml.readElementText();
@@ -144,9 +224,16 @@ void DLTMiniServer::readSettings(const QString &filename)
 
 void DLTMiniServer::readyRead()
 {
-    while(tcpSocket && tcpSocket->bytesAvailable())
+    DLTMiniServerClient *client = findClient(qobject_cast<QTcpSocket*>(sender()));
+    if(!client)
+        return;
+
+    QByteArray &readData = client->readData;
+
+    // injections are accepted from any client
+    while(client->socket->bytesAvailable())
     {
-        readData += tcpSocket->readAll();
+        readData += client->socket->readAll();
 
         // check if complete DLT message is received
         do
@@ -224,13 +311,30 @@ void DLTMiniServer::readyRead()
 
 void DLTMiniServer::newConnection()
 {
-    tcpSocket = tcpServer.nextPendingConnection();
-    connect(tcpSocket, SIGNAL(connected()), this, SLOT(connected()));
-    connect(tcpSocket, SIGNAL(disconnected()), this, SLOT(disconnected()));
-    connect(tcpSocket, SIGNAL(readyRead()), this, SLOT(readyRead()));
-    tcpServer.pauseAccepting();
+    while(tcpServer.hasPendingConnections())
+    {
+        QTcpSocket *socket = tcpServer.nextPendingConnection();
+
+        DLTMiniServerClient *client = new DLTMiniServerClient;
+        client->socket = socket;
+        client->queuedBytes = 0;
+        client->highWaterMark = 0;
+        client->droppedMessages = 0;
+        clients.append(client);
 
-    readData.clear();
+        connect(socket, SIGNAL(connected()), this, SLOT(connected()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readyRead()));
+        connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(bytesWritten(qint64)));
+
+        // disable Nagle, coalescing is done by the send buffer
+        socket->setSocketOption(QAbstractSocket::LowDelayOption,tcpNoDelay?1:0);
+
+        qDebug() << "DLTMiniServer: client connected" << socket->peerAddress().toString() << socket->peerPort() << "clients" << clients.size();
+    }
+
+    if(clients.size()>=maxClients)
+        tcpServer.pauseAccepting();
 
     status("connected");
 }
@@ -242,33 +346,65 @@ void DLTMiniServer::connected()
 
 void DLTMiniServer::disconnected()
 {
-    tcpSocket->close();
-    disconnect(tcpSocket, SIGNAL(connected()), this, SLOT(connected()));
-    disconnect(tcpSocket, SIGNAL(disconnected()), this, SLOT(disconnected()));
-    disconnect(tcpSocket, SIGNAL(readyRead()), this, SLOT(readyRead()));
-    //delete tcpSocket;
-    tcpSocket = 0;
+    DLTMiniServerClient *client = findClient(qobject_cast<QTcpSocket*>(sender()));
+    if(!client)
+        return;
+
+    removeClient(client);
+
     tcpServer.resumeAccepting();
 
-    readData.clear();
+    if(clients.isEmpty())
+    {
+        sendBuffer.resize(0);
+        sendBufferMessages = 0;
+        timerFlush.stop();
 
-    status("listening");
+        status("listening");
+    }
+}
+
+DLTMiniServerClient *DLTMiniServer::findClient(QTcpSocket *socket)
+{
+    for(int num=0;num<clients.size();num++)
+    {
+        if(clients[num]->socket==socket)
+            return clients[num];
+    }
+
+    return 0;
+}
+
+void DLTMiniServer::removeClient(DLTMiniServerClient *client)
+{
+    clients.removeAll(client);
+
+    qDebug() << "DLTMiniServer: client disconnected" << client->socket->peerAddress().toString() << client->socket->peerPort()
+             << "clients" << clients.size() << "dropped messages" << client->droppedMessages << "queue high-water mark" << client->highWaterMark;
+
+    disconnect(client->socket, SIGNAL(connected()), this, SLOT(connected()));
+    disconnect(client->socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+    disconnect(client->socket, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    disconnect(client->socket, SIGNAL(bytesWritten(qint64)), this, SLOT(bytesWritten(qint64)));
+    client->socket->close();
+    client->socket->deleteLater();
+
+    delete client;
 }
 
 void DLTMiniServer::sendValue(QString appId,QString ctxId, QString text,int logLevel)
 {
-    if(tcpSocket==0 || !tcpSocket->isOpen())
+    if(!isSending())
     {
         return;
     }
 
     QByteArray data;
+    quint64 timestamp = DLTCanClock::now();
 
-    // Standard Header (4 Byte)
-    data += 0x21; // htyp: Use extended header, version 0x1
-    data += (char)0x00; // message counter
-    data += (char)0x00; // length high byte
-    data += (char)4+10+4+2+text.length(); // length low byte
+    // Standard Header (12 Byte)
+    char header[DLT_STANDARD_HEADER_SIZE];
+    data.append(header,encodeStandardHeader(header,DLT_STANDARD_HEADER_SIZE+10+4+2+text.length(),timestamp));
 
     // Extended Header (10 Byte)
     data += (char)0x01|(char)logLevel<<4; // MSIN: Verbose,DLT_TYPE_LOG
@@ -295,23 +431,22 @@ void DLTMiniServer::sendValue(QString appId,QString ctxId, QString text,int logL
     // Payload Type Data
     data += text.toUtf8();
 
-    tcpSocket->write(data);
+    send(data.constData(),data.size(),timestamp);
 }
 
 void DLTMiniServer::sendValue2(QString appId,QString ctxId, QString text1,QString text2,int logLevel)
 {
-    if(tcpSocket==0 || !tcpSocket->isOpen())
+    if(!isSending())
     {
         return;
     }
 
     QByteArray data;
+    quint64 timestamp = DLTCanClock::now();
 
-    // Standard Header (4 Byte)
-    data += 0x21; // htyp: Use extended header, version 0x1
-    data += (char)0x00; // message counter
-    data += (char)0x00; // length high byte
-    data += (char)4+10+4+2+text1.length()+4+2+text2.length(); // length low byte
+    // Standard Header (12 Byte)
+    char header[DLT_STANDARD_HEADER_SIZE];
+    data.append(header,encodeStandardHeader(header,DLT_STANDARD_HEADER_SIZE+10+4+2+text1.length()+4+2+text2.length(),timestamp));
 
     // Extended Header (10 Byte)
     data += (char)0x01|(char)logLevel<<4; // MSIN: Verbose,DLT_TYPE_LOG
@@ -351,24 +486,23 @@ void DLTMiniServer::sendValue2(QString appId,QString ctxId, QString text1,QStrin
     // Payload Type Data
     data += text2.toUtf8();
 
-    tcpSocket->write(data);
+    send(data.constData(),data.size(),timestamp);
 
 }
 
 void DLTMiniServer::sendValue3(QString appId,QString ctxId, QString text1,QString text2,QString text3,int logLevel)
 {
-    if(tcpSocket==0 || !tcpSocket->isOpen())
+    if(!isSending())
     {
         return;
     }
 
     QByteArray data;
+    quint64 timestamp = DLTCanClock::now();
 
-    // Standard Header (4 Byte)
-    data += 0x21; // htyp: Use extended header, version 0x1
-    data += (char)0x00; // message counter
-    data += (char)0x00; // length high byte
-    data += (char)4+10+4+2+text1.length()+4+2+text2.length()+4+2+text3.length(); // length low byte
+    // Standard Header (12 Byte)
+    char header[DLT_STANDARD_HEADER_SIZE];
+    data.append(header,encodeStandardHeader(header,DLT_STANDARD_HEADER_SIZE+10+4+2+text1.length()+4+2+text2.length()+4+2+text3.length(),timestamp));
 
     // Extended Header (10 Byte)
     data += (char)0x01|(char)logLevel<<4; // MSIN: Verbose,DLT_TYPE_LOG
@@ -421,6 +555,334 @@ void DLTMiniServer::sendValue3(QString appId,QString ctxId, QString text1,QStrin
     // Payload Type Data
     data += text3.toUtf8();
 
-    tcpSocket->write(data);
+    send(data.constData(),data.size(),timestamp);
+
+}
+
+void DLTMiniServer::setChannelContextId(int channel,const QString &id)
+{
+    if(channel<0 || channel>=DLT_CAN_CHANNELS_MAX)
+        return;
+
+    // converted once, not for each frame
+    for(int num=0;num<4;num++)
+        channelContextIds[channel][num] = num<id.length()?id[num].toLatin1():0;
+}
+
+void DLTMiniServer::sendFrames(const CanFrame *frames,int count,int logLevel)
+{
+    if(!isSending())
+    {
+        return;
+    }
+
+    char data[DLT_MINI_SERVER_MAX_FRAME_MESSAGE];
 
+    for(int num=0;num<count;num++)
+    {
+        int length = encodeFrame(frames[num],data,logLevel);
+        send(data,length,frames[num].timestamp);
+    }
+}
+
+void DLTMiniServer::sendArguments(const char *arguments,int length,int count,quint64 timestamp,const char *ctxId,int logLevel)
+{
+    if(!isSending() || length>DLT_MINI_SERVER_MAX_ARGUMENTS_MESSAGE-DLT_STANDARD_HEADER_SIZE-10)
+    {
+        return;
+    }
+
+    char data[DLT_MINI_SERVER_MAX_ARGUMENTS_MESSAGE];
+
+    // Standard Header (12 Byte)
+    int pos = encodeStandardHeader(data,DLT_STANDARD_HEADER_SIZE+10+length,timestamp);
+
+    // Extended Header (10 Byte)
+    data[pos++] = 0x01|(char)logLevel<<4; // MSIN: Verbose,DLT_TYPE_LOG
+    data[pos++] = (char)count; // NOAR
+    for(int num=0;num<4;num++)
+        data[pos++] = num<applicationId.length()?applicationId[num].toLatin1():0; // APID
+    memcpy(data+pos,ctxId,4); // CTID
+    pos += 4;
+
+    // Arguments
+    memcpy(data+pos,arguments,length);
+    pos += length;
+
+    send(data,pos,timestamp);
+}
+
+void DLTMiniServer::send(const char *data,int length,quint64 timestamp)
+{
+    if(recorder)
+        recorder->writeMessage(data,length,timestamp);
+
+    if(clients.isEmpty())
+        return;
+
+    if(sendBuffer.isEmpty())
+    {
+        // first message defines the deadline for the flush
+        sendBufferTimestamp = DLTCanClock::now();
+        if(flushSize>0 && flushTimeout>0)
+            timerFlush.start(flushTimeout);
+    }
+
+    sendBuffer.append(data,length);
+    sendBufferMessages++;
+
+    if(sendBuffer.size()>=flushSize || flushTimeout<=0)
+        flush();
+}
+
+void DLTMiniServer::flush()
+{
+    timerFlush.stop();
+
+    if(sendBuffer.isEmpty())
+        return;
+
+    if(!clients.isEmpty())
+    {
+        // encoded once, the same reference counted chunk is shared by all clients
+        QByteArray chunk(sendBuffer.constData(),sendBuffer.size());
+        QList<DLTMiniServerClient*> stalled;
+        for(int num=0;num<clients.size();num++)
+        {
+            if(!enqueue(clients[num],chunk,sendBufferMessages))
+                stalled.append(clients[num]);
+        }
+
+        // disconnect clients which cannot keep up
+        for(int num=0;num<stalled.size();num++)
+        {
+            qDebug() << "DLTMiniServer: send queue full, disconnect client";
+            removeClient(stalled[num]);
+            tcpServer.resumeAccepting();
+        }
+        if(!stalled.isEmpty() && clients.isEmpty())
+            status("listening");
+
+        quint64 latency = DLTCanClock::now()-sendBufferTimestamp;
+        writeCount++;
+        writeBytes += sendBuffer.size();
+        flushLatencySum += latency;
+        if(latency>flushLatencyMax)
+            flushLatencyMax = latency;
+    }
+
+    // keeps the reserved capacity
+    sendBuffer.resize(0);
+    sendBufferMessages = 0;
+}
+
+bool DLTMiniServer::enqueue(DLTMiniServerClient *client,const QByteArray &data,int messages)
+{
+    // write directly as long as the socket keeps up
+    if(client->queue.isEmpty() && client->socket->bytesToWrite()<DLT_MINI_SERVER_SOCKET_BUFFER)
+    {
+        client->socket->write(data);
+        return true;
+    }
+
+    if(client->queuedBytes+data.size()>sendQueueSize)
+    {
+        switch(sendQueuePolicy)
+        {
+        case SendQueueDisconnect:
+            client->droppedMessages += messages;
+            droppedMessages += messages;
+            return false;
+        case SendQueueDropNewest:
+            client->droppedMessages += messages;
+            droppedMessages += messages;
+            return true;
+        case SendQueueDropOldest:
+        default:
+            // chunks contain complete messages, so the stream stays valid
+            while(!client->queue.isEmpty() && client->queuedBytes+data.size()>sendQueueSize)
+            {
+                client->queuedBytes -= client->queue.first().data.size();
+                client->droppedMessages += client->queue.first().messages;
+                droppedMessages += client->queue.first().messages;
+                client->queue.removeFirst();
+            }
+            if(client->queuedBytes+data.size()>sendQueueSize)
+            {
+                client->droppedMessages += messages;
+                droppedMessages += messages;
+                return true;
+            }
+            break;
+        }
+    }
+
+    DLTMiniServerChunk chunk;
+    chunk.data = data;
+    chunk.messages = messages;
+    client->queue.append(chunk);
+    client->queuedBytes += data.size();
+    if(client->queuedBytes>client->highWaterMark)
+        client->highWaterMark = client->queuedBytes;
+
+    return true;
+}
+
+void DLTMiniServer::writeQueue(DLTMiniServerClient *client)
+{
+    while(!client->queue.isEmpty() && client->socket->bytesToWrite()<DLT_MINI_SERVER_SOCKET_BUFFER)
+    {
+        client->queuedBytes -= client->queue.first().data.size();
+        client->socket->write(client->queue.first().data);
+        client->queue.removeFirst();
+    }
+}
+
+void DLTMiniServer::bytesWritten(qint64 bytes)
+{
+    Q_UNUSED(bytes)
+
+    DLTMiniServerClient *client = findClient(qobject_cast<QTcpSocket*>(sender()));
+    if(client)
+        writeQueue(client);
+}
+
+int DLTMiniServer::encodeStandardHeader(char *data,int length,quint64 timestamp)
+{
+    quint32 tmsp = DLTCanClock::toDltTimestamp(timestamp);
+
+    data[0] = 0x35; // htyp: Use extended header, with ECU ID, with timestamp, version 0x1
+    data[1] = (char)messageCounter++; // message counter
+    data[2] = (char)(length>>8); // length high byte
+    data[3] = (char)(length&0xff); // length low byte
+    for(int num=0;num<4;num++)
+        data[4+num] = num<ecuId.length()?ecuId[num].toLatin1():0; // ECU ID
+    data[8] = (char)(tmsp>>24); // timestamp in 0.1ms, big endian
+    data[9] = (char)(tmsp>>16);
+    data[10] = (char)(tmsp>>8);
+    data[11] = (char)tmsp;
+
+    return DLT_STANDARD_HEADER_SIZE;
+}
+
+int DLTMiniServer::encodeFrame(const CanFrame &frame,char *data,int logLevel)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // Standard Header (12 Byte), length is set at the end
+    int pos = encodeStandardHeader(data,0,frame.timestamp);
+
+    // Extended Header (10 Byte)
+    switch(frameEncoding)
+    {
+    case FrameEncodingRaw:
+        data[pos++] = 0x01|(char)logLevel<<4; // MSIN: Verbose,DLT_TYPE_LOG
+        data[pos++] = 0x01; // NOAR
+        break;
+    case FrameEncodingNonVerbose:
+        data[pos++] = (char)logLevel<<4; // MSIN: Non-Verbose,DLT_TYPE_LOG
+        data[pos++] = 0x00; // NOAR
+        break;
+    case FrameEncodingVerbose:
+    default:
+        data[pos++] = 0x01|(char)logLevel<<4; // MSIN: Verbose,DLT_TYPE_LOG
+        data[pos++] = 0x03; // NOAR
+        break;
+    }
+    for(int num=0;num<4;num++)
+        data[pos++] = num<applicationId.length()?applicationId[num].toLatin1():0; // APID
+    if(frame.channel<DLT_CAN_CHANNELS_MAX && channelContextIds[frame.channel][0])
+    {
+        memcpy(data+pos,channelContextIds[frame.channel],4); // CTID
+        pos += 4;
+    }
+    else
+    {
+        for(int num=0;num<4;num++)
+            data[pos++] = num<contextId.length()?contextId[num].toLatin1():0; // CTID
+    }
+
+    if(frameEncoding==FrameEncodingRaw)
+    {
+        // Argument 1: binary frame as raw data
+        int length = 1+4+1+frame.dlc;
+        data[pos++] = 0x00; // Payload Type Info (4 Byte)
+        data[pos++] = 0x04; // Raw
+        data[pos++] = 0x00;
+        data[pos++] = 0x00;
+        data[pos++] = (char)(length&0xff); // Payload Type Data Length low byte
+        data[pos++] = (char)(length>>8); // Payload Type Data Length high byte
+        pos += encodeFrameBinary(frame,data+pos);
+    }
+    else if(frameEncoding==FrameEncodingNonVerbose)
+    {
+        // Message Id per direction, followed by binary frame
+        quint32 messageId = frame.isTx() ? DLT_CAN_MESSAGE_ID_TX : DLT_CAN_MESSAGE_ID_RX;
+        data[pos++] = (char)(messageId&0xff);
+        data[pos++] = (char)((messageId>>8)&0xff);
+        data[pos++] = (char)((messageId>>16)&0xff);
+        data[pos++] = (char)((messageId>>24)&0xff);
+        pos += encodeFrameBinary(frame,data+pos);
+    }
+    else
+    {
+        // Argument 1: direction
+        data[pos++] = 0x00; // Payload Type Info (4 Byte)
+        data[pos++] = 0x02; // String
+        data[pos++] = 0x00;
+        data[pos++] = 0x00;
+        data[pos++] = 0x02; // Payload Type Data Length low byte
+        data[pos++] = 0x00; // Payload Type Data Length high byte
+        data[pos++] = frame.isTx() ? 'T' : 'R';
+        data[pos++] = 'x';
+
+        // Argument 2: id as hex with at least 3 digits
+        int digits = 3;
+        while(digits<8 && (frame.id>>(digits*4))!=0)
+            digits++;
+        data[pos++] = 0x00; // Payload Type Info (4 Byte)
+        data[pos++] = 0x02; // String
+        data[pos++] = 0x00;
+        data[pos++] = 0x00;
+        data[pos++] = (char)digits; // Payload Type Data Length low byte
+        data[pos++] = 0x00; // Payload Type Data Length high byte
+        for(int num=digits-1;num>=0;num--)
+            data[pos++] = hex[(frame.id>>(num*4))&0x0f];
+
+        // Argument 3: payload as hex
+        data[pos++] = 0x00; // Payload Type Info (4 Byte)
+        data[pos++] = 0x02; // String
+        data[pos++] = 0x00;
+        data[pos++] = 0x00;
+        data[pos++] = (char)(frame.dlc*2); // Payload Type Data Length low byte
+        data[pos++] = 0x00; // Payload Type Data Length high byte
+        for(int num=0;num<frame.dlc;num++)
+        {
+            data[pos++] = hex[frame.data[num]>>4];
+            data[pos++] = hex[frame.data[num]&0x0f];
+        }
+    }
+
+    // Standard Header length
+    data[2] = (char)(pos>>8);
+    data[3] = (char)(pos&0xff);
+
+    return pos;
+}
+
+int DLTMiniServer::encodeFrameBinary(const CanFrame &frame,char *data)
+{
+    int pos = 0;
+
+    // flags, id little endian, dlc, payload
+    data[pos++] = (char)frame.flags;
+    data[pos++] = (char)(frame.id&0xff);
+    data[pos++] = (char)((frame.id>>8)&0xff);
+    data[pos++] = (char)((frame.id>>16)&0xff);
+    data[pos++] = (char)((frame.id>>24)&0xff);
+    data[pos++] = (char)frame.dlc;
+    memcpy(data+pos,frame.data,frame.dlc);
+    pos += frame.dlc;
+
+    return pos;
 }
@@ -20,6 +20,10 @@
 #include <QXmlStreamReader>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QTimer>
+
+#include "canframe.h"
+#include "dltcanrecorder.h"
 
 #define DLT_LOG_FATAL 0x1
 #define DLT_LOG_ERROR 0x2
@@ -28,10 +32,63 @@
 #define DLT_LOG_DEBUG 0x5
 #define DLT_LOG_VERBOSE 0x6
 
+// size of the standard header with ECU ID and timestamp
+#define DLT_STANDARD_HEADER_SIZE 12
+
+// message ids of CAN frames in non-verbose mode
+#define DLT_CAN_MESSAGE_ID_RX 0x00000001
+#define DLT_CAN_MESSAGE_ID_TX 0x00000002
+
+// maximum size of a DLT message containing one CAN frame
+#define DLT_MINI_SERVER_MAX_FRAME_MESSAGE 256
+
+// maximum size of a DLT message with encoded verbose arguments
+#define DLT_MINI_SERVER_MAX_ARGUMENTS_MESSAGE 4096
+
+// maximum number of bytes handed to the socket of a client, the rest is queued
+#define DLT_MINI_SERVER_SOCKET_BUFFER 65536
+
+// Encoded DLT messages written to the clients at once
+struct DLTMiniServerChunk
+{
+    QByteArray data;
+    int messages;
+};
+
+// A connected DLT client, e.g. a DLT Viewer
+struct DLTMiniServerClient
+{
+    QTcpSocket *socket;
+    QByteArray readData;
+
+    // bounded outbound queue
+    QList<DLTMiniServerChunk> queue;
+    qint64 queuedBytes;
+    qint64 highWaterMark;
+    quint64 droppedMessages;
+};
+
 class DLTMiniServer : public QObject
 {
     Q_OBJECT
 public:
+
+    // Behaviour if the send queue of a client is full
+    enum SendQueuePolicy
+    {
+        SendQueueDropOldest = 0,
+        SendQueueDropNewest = 1,
+        SendQueueDisconnect = 2
+    };
+
+    // Encoding of CAN frames in DLT messages
+    enum FrameEncoding
+    {
+        FrameEncodingVerbose = 0,   // verbose, direction, id and payload as hex strings
+        FrameEncodingRaw = 1,       // verbose, one raw argument with the binary frame
+        FrameEncodingNonVerbose = 2 // non-verbose, message id per direction with the binary frame
+    };
+
     explicit DLTMiniServer(QObject *parent = nullptr);
     ~DLTMiniServer();
 
@@ -45,15 +102,67 @@ public:
     void sendValue2(QString appId,QString ctxId, QString text1,QString text2,int logLevel = DLT_LOG_INFO);
     void sendValue3(QString appId,QString ctxId, QString text1,QString text2,QString text3,int logLevel = DLT_LOG_INFO);
 
+    // Send each CAN frame as DLT message in the configured frame encoding
+    void sendFrames(const CanFrame *frames,int count,int logLevel = DLT_LOG_INFO);
+
+    // Send one verbose DLT message with already encoded arguments
+    void sendArguments(const char *arguments,int length,int count,quint64 timestamp,const char *ctxId,int logLevel = DLT_LOG_INFO);
+
+    // False if no client is connected and nothing is recorded
+    bool isSending() const { return !clients.isEmpty() || (recorder && recorder->isRecording()); }
+
     unsigned short getPort() { return port; }
     void setPort(unsigned short port) { this->port = port; }
 
+    int getMaxClients() { return maxClients; }
+    void setMaxClients(int value) { this->maxClients = value; }
+
+    int getClientCount() { return clients.size(); }
+    const DLTMiniServerClient *getClient(int num) { return clients[num]; }
+
+    // Size of the send queue of each client in bytes
+    int getSendQueueSize() { return sendQueueSize; }
+    void setSendQueueSize(int value) { this->sendQueueSize = value; }
+
+    int getSendQueuePolicy() { return sendQueuePolicy; }
+    void setSendQueuePolicy(int value) { this->sendQueuePolicy = value; }
+
+    QString getEcuId() { return ecuId; }
+    void setEcuId(QString id) { this->ecuId = id; }
+
+    int getFrameEncoding() { return frameEncoding; }
+    void setFrameEncoding(int value) { this->frameEncoding = value; }
+
     QString getApplicationId() { return applicationId; }
     void setApplicationId(QString id) { this->applicationId = id; }
 
     QString getContextId() { return contextId; }
     void setContextId(QString id) { this->contextId = id; }
 
+    // Context ID of the frames of a capture channel, empty uses the context ID
+    void setChannelContextId(int channel,const QString &id);
+
+    // Output stage: messages are collected and written when flushSize bytes are reached
+    // or flushTimeout ms after the first message; flushSize 0 writes every message at once
+    bool getTcpNoDelay() { return tcpNoDelay; }
+    void setTcpNoDelay(bool value) { this->tcpNoDelay = value; }
+
+    int getFlushSize() { return flushSize; }
+    void setFlushSize(int value) { this->flushSize = value; }
+
+    int getFlushTimeout() { return flushTimeout; }
+    void setFlushTimeout(int value) { this->flushTimeout = value; }
+
+    // Recorder which gets all messages, also if no client is connected
+    void setRecorder(DLTCanRecorder *recorder) { this->recorder = recorder; }
+
+    // Statistics of the output stage since start
+    quint64 getWriteCount() const { return writeCount; }
+    quint64 getWriteBytes() const { return writeBytes; }
+    quint64 getFlushLatencyMax() const { return flushLatencyMax; }
+    quint64 getFlushLatencyAverage() const { return writeCount ? flushLatencySum/writeCount : 0; }
+    quint64 getDroppedMessages() const { return droppedMessages; }
+
     void clearSettings();
     void writeSettings(QXmlStreamWriter &xml);
     void readSettings(const QString &filename);
@@ -69,17 +178,55 @@ private slots:
     void newConnection();
     void connected();
     void disconnected();
+    void bytesWritten(qint64 bytes);
+
+    void flush();
 
 private:
 
     QTcpServer tcpServer;
-    QTcpSocket *tcpSocket;
+    QList<DLTMiniServerClient*> clients;
+    int maxClients;
+    int sendQueueSize;
+    int sendQueuePolicy;
 
     unsigned short port;
+    QString ecuId;
     QString applicationId;
     QString contextId;
+    char channelContextIds[DLT_CAN_CHANNELS_MAX][4];
 
-    QByteArray readData;
+    DLTMiniServerClient *findClient(QTcpSocket *socket);
+    void removeClient(DLTMiniServerClient *client);
+    bool enqueue(DLTMiniServerClient *client,const QByteArray &data,int messages);
+    void writeQueue(DLTMiniServerClient *client);
+
+    unsigned char messageCounter;
+
+    int frameEncoding;
+
+    bool tcpNoDelay;
+    int flushSize;
+    int flushTimeout;
+
+    QByteArray sendBuffer;
+    int sendBufferMessages;
+    quint64 sendBufferTimestamp;
+    QTimer timerFlush;
+
+    quint64 writeCount;
+    quint64 writeBytes;
+    quint64 flushLatencySum;
+    quint64 flushLatencyMax;
+    quint64 droppedMessages;
+
+    DLTCanRecorder *recorder;
+
+    void send(const char *data,int length,quint64 timestamp);
+
+    int encodeStandardHeader(char *data,int length,quint64 timestamp);
+    int encodeFrame(const CanFrame &frame,char *data,int logLevel);
+    int encodeFrameBinary(const CanFrame &frame,char *data);
 
 };
 
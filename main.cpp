@@ -13,15 +13,122 @@
  */
 
 #include "dialog.h"
+#include "dltcancontroller.h"
+#include "dltcandbc.h"
+#include "dltcandecoder.h"
+#include "dltcanlogwriter.h"
 #include "version.h"
 
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QScopedPointer>
 #include <QDebug>
 
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <QSocketNotifier>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+// Allocations of the process, counted for the benchmark of the allocation free decoder
+static std::atomic<quint64> allocationCounter(0);
+
+void *operator new(std::size_t size)
+{
+    allocationCounter.fetch_add(1,std::memory_order_relaxed);
+    if(void *data = malloc(size ? size : 1))
+        return data;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *data) noexcept
+{
+    free(data);
+}
+
+static quint64 allocations()
+{
+    return allocationCounter.load(std::memory_order_relaxed);
+}
+
+// Set when the capture is stopped and all files are flushed
+static std::atomic<bool> quitDone(false);
+
+#ifdef Q_OS_WIN
+static BOOL WINAPI quitHandler(DWORD type)
+{
+    // called in its own thread, the event loop quits in the main thread
+    QMetaObject::invokeMethod(QCoreApplication::instance(), "quit", Qt::QueuedConnection);
+
+    // the process is terminated when the handler returns on close, logoff and shutdown
+    if(type!=CTRL_C_EVENT && type!=CTRL_BREAK_EVENT)
+    {
+        for(int num=0;num<500 && !quitDone.load();num++)
+            Sleep(10); // Windows terminates the process after 5 seconds anyway
+    }
+
+    return TRUE;
+}
+#else
+static int quitPipe[2];
+
+static void quitHandler(int)
+{
+    // only async signal safe calls, the event loop is woken up by the pipe
+    char byte = 1;
+    ssize_t written = ::write(quitPipe[1],&byte,1);
+    Q_UNUSED(written);
+}
+#endif
+
+// Ctrl-C and a service stop quit the event loop, so the capture is stopped and all files are flushed
+static void installQuitHandler(QCoreApplication *application)
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED(application);
+    SetConsoleCtrlHandler(quitHandler,TRUE);
+#else
+    if(::pipe(quitPipe)!=0)
+    {
+        qDebug() << "DLTCan: Cannot create pipe for signals";
+        return;
+    }
+
+    QSocketNotifier *notifier = new QSocketNotifier(quitPipe[0],QSocketNotifier::Read,application);
+    QObject::connect(notifier, SIGNAL(activated(int)), application, SLOT(quit()));
+
+    struct sigaction action;
+    memset(&action,0,sizeof(action));
+    action.sa_handler = quitHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT,&action,0);
+    sigaction(SIGTERM,&action,0);
+    sigaction(SIGHUP,&action,0);
+#endif
+}
+
+// Headless mode runs without Qt Widgets, so the application type must be known before parsing
+static QCoreApplication *createApplication(int &argc, char *argv[])
+{
+    for(int num=1;num<argc;num++)
+    {
+        if(!qstrcmp(argv[num],"--headless") || !qstrcmp(argv[num],"--convert") || !qstrcmp(argv[num],"--dbc-benchmark") || !qstrcmp(argv[num],"--decoder-benchmark"))
+            return new QCoreApplication(argc, argv);
+    }
+    return new QApplication(argc, argv);
+}
+
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
+    QScopedPointer<QCoreApplication> a(createApplication(argc, argv));
 
     QCoreApplication::setOrganizationName("alexmucde");
     QCoreApplication::setOrganizationDomain("github.com");
@@ -38,8 +145,28 @@ int main(int argc, char *argv[])
     QCommandLineOption autostartOption("a", QCoreApplication::translate("main", "Autostart Communication"));
     parser.addOption(autostartOption);
 
+    // Option Headless
+    QCommandLineOption headlessOption("headless", QCoreApplication::translate("main", "Run without user interface, communication is started automatically"));
+    parser.addOption(headlessOption);
+
+    // Option Statistics
+    QCommandLineOption statisticsOption("statistics", QCoreApplication::translate("main", "Print statistics every <seconds> in headless mode"), "seconds", "10");
+    parser.addOption(statisticsOption);
+
+    // Option Convert
+    QCommandLineOption convertOption("convert", QCoreApplication::translate("main", "Convert the DLT, candump or ASC file given as argument into the candump or ASC file <output> and exit"), "output");
+    parser.addOption(convertOption);
+
+    // Option DBC Benchmark
+    QCommandLineOption dbcBenchmarkOption("dbc-benchmark", QCoreApplication::translate("main", "Decode generated frames with the DBC file given as argument, print the throughput and exit"));
+    parser.addOption(dbcBenchmarkOption);
+
+    // Option Decoder Benchmark
+    QCommandLineOption decoderBenchmarkOption("decoder-benchmark", QCoreApplication::translate("main", "Decode a generated byte stream of the adapter protocol, print frames/s and allocations per frame and exit"));
+    parser.addOption(decoderBenchmarkOption);
+
     // Parse the Arguments
-    parser.process(a);
+    parser.process(*a);
 
     // Stop application if help is called
     if(parser.isSet(helpOption))
@@ -53,9 +180,52 @@ int main(int argc, char *argv[])
     bool autostart= false;
     autostart = parser.isSet(autostartOption);
     qDebug() << "Option: -a =" << autostart;
+    bool headless = parser.isSet(headlessOption);
+    qDebug() << "Option: --headless =" << headless;
+
+    if(parser.isSet(convertOption))
+    {
+        // file conversion without communication
+        return DLTCanLogWriter::convert(configuration,parser.value(convertOption)) ? 0 : 1;
+    }
+
+    if(parser.isSet(dbcBenchmarkOption))
+    {
+        // signal decoding without communication
+        return DLTCanDbc::benchmark(configuration,1000000) ? 0 : 1;
+    }
+
+    if(parser.isSet(decoderBenchmarkOption))
+    {
+        // serial protocol decoding without communication
+        return DLTCanDecoder::benchmark(10000000,allocations) ? 0 : 1;
+    }
+
+    installQuitHandler(a.data());
+
+    if(headless)
+    {
+        // run capture to DLT pipeline without dialog
+        DLTCanController controller;
+        if(!configuration.isEmpty())
+            controller.readSettings(configuration);
+        controller.setStatisticsInterval(parser.value(statisticsOption).toInt()*1000);
+        controller.start();
+        int result = a->exec();
+
+        // write and sync all buffered frames and messages
+        controller.stop();
+        quitDone = true;
+        return result;
+    }
 
     // execute dialog
-    Dialog w(autostart,configuration);
-    w.show();
-    return a.exec();
+    int result;
+    {
+        Dialog w(autostart,configuration);
+        w.show();
+        result = a->exec();
+    }
+    quitDone = true;
+    return result;
 }
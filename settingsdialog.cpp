@@ -73,11 +73,15 @@ void SettingsDialog::restoreSettings(DLTCan *dltCan, DLTMiniServer *dltMiniServe
     /* DLTCan*/
     ui->comboBoxSerialPortCan->setCurrentText(dltCan->getInterface());
     ui->checkBoxCanActive->setChecked(dltCan->getActive());
+    ui->comboBoxBaudRate->setCurrentText(QString("%1").arg(dltCan->getBaudRate()));
+    ui->checkBoxHardwareFilter->setChecked(dltCan->getHardwareFilter());
 
     /* DLTMiniServer */
     ui->lineEditPort->setText(QString("%1").arg(dltMiniServer->getPort()));
+    ui->lineEditEcuId->setText(dltMiniServer->getEcuId());
     ui->lineEditApplicationId->setText(dltMiniServer->getApplicationId());
     ui->lineEditContextId->setText(dltMiniServer->getContextId());
+    ui->comboBoxFrameEncoding->setCurrentIndex(dltMiniServer->getFrameEncoding());
 
 
 }
@@ -87,11 +91,15 @@ void SettingsDialog::backupSettings(DLTCan *dltCan, DLTMiniServer *dltMiniServer
     /* DLTCan */
     dltCan->setInterface(ui->comboBoxSerialPortCan->currentText());
     dltCan->setActive(ui->checkBoxCanActive->isChecked());
+    dltCan->setBaudRate(ui->comboBoxBaudRate->currentText().toInt());
+    dltCan->setHardwareFilter(ui->checkBoxHardwareFilter->isChecked());
 
     /* DLTMiniServer */
     dltMiniServer->setPort(ui->lineEditPort->text().toUShort());
+    dltMiniServer->setEcuId(ui->lineEditEcuId->text());
     dltMiniServer->setApplicationId(ui->lineEditApplicationId->text());
     dltMiniServer->setContextId(ui->lineEditContextId->text());
+    dltMiniServer->setFrameEncoding(ui->comboBoxFrameEncoding->currentIndex());
 }
 
 void SettingsDialog::on_checkBoxAutostart_clicked(bool checked)